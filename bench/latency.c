@@ -0,0 +1,277 @@
+#include "editor.h"
+
+#include <setjmp.h>
+
+// Keystroke latency benchmark
+// Replays scripted keystrokes against generated files through the in memory terminal
+// and reports the time from a key being available to the frame being written,
+// along with the bytes written per frame
+//
+// a file of a single LONG_LINE_BYTES line, as minified code is, is replayed last
+// "reloading" is not a key press but a character of the file being rewritten by another process
+//
+// usage: bin/bench.o [lines ...]
+
+#define MAX_SAMPLES 4096
+#define LONG_LINE_BYTES (20 * 1024 * 1024)
+
+struct scenario {
+    const char* name;
+    const char** keys; // each entry is one key press (or one pasted block)
+    int count;
+};
+
+static const char** script;
+static int scriptLen;
+static int scriptPos;
+static double keyStart;
+static unsigned long bytesAtStart;
+static double latencies[MAX_SAMPLES];
+static unsigned long frameBytes[MAX_SAMPLES];
+static int samples;
+static jmp_buf scenarioDone;
+
+// Current time in microseconds
+static double nowMicro(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// Called by the memory terminal whenever the editor waits for input:
+// the previous key has been processed and its frame written out
+static void onDrained(){
+    double now = nowMicro();
+    if (scriptPos > 0 && samples < MAX_SAMPLES){
+        latencies[samples] = now - keyStart;
+        frameBytes[samples] = memoryTerminal.bytesWritten - bytesAtStart;
+        samples++;
+    }
+    if (scriptPos == scriptLen)
+        longjmp(scenarioDone, 1);
+    memoryTerminalInput(script[scriptPos], strlen(script[scriptPos]));
+    scriptPos++;
+    bytesAtStart = memoryTerminal.bytesWritten;
+    keyStart = nowMicro();
+}
+
+static int compareDouble(const void* a, const void* b){
+    double x = *(const double*) a, y = *(const double*) b;
+    return (x > y) - (x < y);
+}
+
+// Runs one scenario against the file which is currently open and prints a row of results
+static void runScenario(int lines, struct scenario* sc){
+    awaitingArrow = 0; // a scenario ending in a prompt leaves it open, the next one starts outside of it
+    cursorPos.x = 1;
+    cursorPos.y = 1;
+    rowOffset = 0;
+    colOffset = 0;
+    refresh();
+
+    script = sc->keys;
+    scriptLen = sc->count;
+    scriptPos = 0;
+    samples = 0;
+    if (setjmp(scenarioDone) == 0){
+        while (1) {
+            processKey();
+            refresh();
+        }
+    }
+
+    unsigned long totalBytes = 0, maxBytes = 0;
+    for (int i = 0; i < samples; i++){
+        totalBytes += frameBytes[i];
+        if (frameBytes[i] > maxBytes)
+            maxBytes = frameBytes[i];
+    }
+    qsort(latencies, samples, sizeof(double), compareDouble);
+    int p99 = (samples * 99) / 100;
+    if (p99 >= samples)
+        p99 = samples - 1;
+    printf("%-10d %-10s %6d %11.1f %11.1f %11.1f %12.1f %10lu\n",
+           lines, sc->name, samples,
+           latencies[samples / 2], latencies[p99], latencies[samples - 1],
+           (double) totalBytes / samples, maxBytes);
+    fflush(stdout);
+}
+
+// Rewrites a character in the middle of the open file as another process would, and times taking the change in
+static void runReload(int lines, const char* path){
+    int fd = open(path, O_RDWR);
+    if (fd < 0)
+        failExit("Could not open the benchmark file");
+    off_t size = lseek(fd, 0, SEEK_END);
+    samples = 0;
+    for (int i = 0; i < 16 && samples < MAX_SAMPLES; i++){
+        off_t at = size / 2 + i * 4096;
+        char c;
+        while (pread(fd, &c, 1, at) == 1 && (c == '\n' || c == 'x' + i % 2))
+            at++;
+        c = 'x' + i % 2;
+        if (pwrite(fd, &c, 1, at) != 1)
+            failExit("Could not write the benchmark file");
+        unsigned long bytes = memoryTerminal.bytesWritten;
+        double start = nowMicro();
+        fileReload();
+        refresh();
+        latencies[samples] = nowMicro() - start;
+        frameBytes[samples] = memoryTerminal.bytesWritten - bytes;
+        samples++;
+    }
+    close(fd);
+
+    unsigned long totalBytes = 0, maxBytes = 0;
+    for (int i = 0; i < samples; i++){
+        totalBytes += frameBytes[i];
+        if (frameBytes[i] > maxBytes)
+            maxBytes = frameBytes[i];
+    }
+    qsort(latencies, samples, sizeof(double), compareDouble);
+    printf("%-10d %-10s %6d %11.1f %11.1f %11.1f %12.1f %10lu\n",
+           lines, "reloading", samples,
+           latencies[samples / 2], latencies[samples - 1], latencies[samples - 1],
+           (double) totalBytes / samples, maxBytes);
+    fflush(stdout);
+}
+
+// Writes a C like file with comments, strings, numbers and tabs
+static void generateFile(const char* path, int lines){
+    FILE* f = fopen(path, "w");
+    if (!f)
+        failExit("Could not create the benchmark file");
+    for (int i = 0; i < lines; i++){
+        switch (i % 8){
+            case 0: fprintf(f, "/* block %d of the generated file */\n", i / 8); break;
+            case 1: fprintf(f, "static int counter%d(int value) {\n", i); break;
+            case 2: fprintf(f, "\tint total = value * %d; // running total\n", i); break;
+            case 3: fprintf(f, "\tif (total > %d)\n", i * 3); break;
+            case 4: fprintf(f, "\t\tprintf(\"line %%d is over the limit\\n\", %d);\n", i); break;
+            case 5: fprintf(f, "\treturn total;\n"); break;
+            case 6: fprintf(f, "}\n"); break;
+            default: fprintf(f, "\n"); break;
+        }
+    }
+    fclose(f);
+}
+
+// Writes a file of a single line of minified JSON like text
+static void generateLongLine(const char* path, int bytes){
+    FILE* f = fopen(path, "w");
+    if (!f)
+        failExit("Could not create the benchmark file");
+    for (int i = 0, written = 0; written < bytes; i++)
+        written += fprintf(f, "{\"id\":%d,\"name\":\"item %d\",\"tags\":[\"a\",\"b\"],\"ok\":true},", i, i);
+    fprintf(f, "\n");
+    fclose(f);
+}
+
+// Frees the open file so that the next one starts from an empty editor
+static void closeFile(){
+    closeDocument();
+    memFree(mem_misc, filename);
+    editorInit();
+}
+
+#define ARROW_UP "\x1b[A"
+#define ARROW_DOWN "\x1b[B"
+#define PAGE_UP "\x1b[5~"
+#define PAGE_DOWN "\x1b[6~"
+#define ARROW_RIGHT "\x1b[C"
+#define END "\x1b[F"
+#define HOME "\x1b[H"
+#define ESC "\x1b"
+
+static const char* scrollKeys[440];
+static const char* typeKeys[64];
+static const char* searchKeys[] = {
+    "\x06", "c", "o", "u", "n", "t", "e", "r", "1", "\r", "\r", "\r", "\r", ESC,
+    "\x06", "z", "q", "x", ESC, // not found, scans the whole file
+};
+static const char* replaceKeys[] = {
+    "\x12", "c", "o", "u", "n", "t", "e", "r", "\r", "t", "a", "l", "l", "y", "\r", // once in every block of the file
+};
+static const char* panKeys[420];
+static const char* undoKeys[64]; // the edits of the scenarios before undone, then redone
+static const char* lineSearchKeys[] = {
+    "\x06", "i", "t", "e", "m", " ", "9", "9", "9", "\r", "\r", ESC,
+    "\x06", "z", "q", "x", ESC, // not found, scans the whole line
+};
+static const char* pasteKeys[] = {
+    "int pasted(int a, int b) {\r\tint sum = a + b; // pasted\r\tif (sum > 10)\r"
+    "\t\treturn sum * 2;\r\treturn sum;\r}\r\r"
+    "int pasted(int a, int b) {\r\tint sum = a + b; // pasted\r\tif (sum > 10)\r"
+    "\t\treturn sum * 2;\r\treturn sum;\r}\r\r",
+    ARROW_DOWN, ARROW_DOWN,
+    "/* a second, shorter paste */",
+};
+
+int main(int argc, char* argv[]){
+    int defaultSizes[] = {10000, 100000};
+    int sizeCount = argc > 1 ? argc - 1 : 2;
+
+    int n = 0;
+    for (int i = 0; i < 300; i++) scrollKeys[n++] = ARROW_DOWN;
+    for (int i = 0; i < 20; i++) scrollKeys[n++] = PAGE_DOWN;
+    for (int i = 0; i < 20; i++) scrollKeys[n++] = PAGE_UP;
+    for (int i = 0; i < 100; i++) scrollKeys[n++] = ARROW_UP;
+    n = 0;
+    for (int i = 0; i < 400; i++) panKeys[n++] = ARROW_RIGHT;
+    for (int i = 0; i < 10; i++){
+        panKeys[n++] = END;
+        panKeys[n++] = HOME;
+    }
+    static const char* letters[] = {"i", "n", "t", " ", "x", " ", "=", " ", "4", "2", ";", " "};
+    for (int i = 0; i < 64; i++)
+        typeKeys[i] = letters[i % 12];
+    for (int i = 0; i < 64; i++)
+        undoKeys[i] = i < 32 ? "\x1a" : "\x19";
+
+    struct scenario scenarios[] = {
+        {"scrolling", scrollKeys, 440},
+        {"typing", typeKeys, 64},
+        {"searching", searchKeys, sizeof(searchKeys) / sizeof(searchKeys[0])},
+        {"pasting", pasteKeys, sizeof(pasteKeys) / sizeof(pasteKeys[0])},
+        {"replacing", replaceKeys, sizeof(replaceKeys) / sizeof(replaceKeys[0])},
+        {"undoing", undoKeys, 64},
+    };
+
+    terminal = &memoryBackend;
+    memoryTerminal.onDrained = onDrained;
+    editorInit();
+
+    printf("%-10s %-10s %6s %11s %11s %11s %12s %10s\n",
+           "lines", "scenario", "keys", "p50 (us)", "p99 (us)", "max (us)", "bytes/frame", "max bytes");
+    for (int s = 0; s < sizeCount; s++){
+        int lines = argc > 1 ? atoi(argv[s + 1]) : defaultSizes[s];
+        if (lines <= 0)
+            continue;
+        char path[64];
+        snprintf(path, sizeof(path), "/tmp/editor-bench-%d.c", lines);
+        generateFile(path, lines);
+
+        openFile(path);
+        for (unsigned int i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++)
+            runScenario(lines, &scenarios[i]);
+        fileModified = 0; // the edits are dropped, as if saved, so the changes made on the disk are all taken in
+        runReload(lines, path);
+        closeFile();
+        unlink(path);
+    }
+
+    struct scenario lineScenarios[] = {
+        {"panning", panKeys, 420},
+        {"typing", typeKeys, 64},
+        {"searching", lineSearchKeys, sizeof(lineSearchKeys) / sizeof(lineSearchKeys[0])},
+        {"undoing", undoKeys, 64},
+    };
+    char path[] = "/tmp/editor-bench-long-line.json";
+    generateLongLine(path, LONG_LINE_BYTES);
+    openFile(path);
+    for (unsigned int i = 0; i < sizeof(lineScenarios) / sizeof(lineScenarios[0]); i++)
+        runScenario(1, &lineScenarios[i]);
+    closeFile();
+    unlink(path);
+    return 0;
+}
@@ -0,0 +1,285 @@
+#include "editor.h"
+
+// Microbenchmarks for the buffer primitives
+// Each primitive is run over different line lengths, tab densities and document sizes
+// after a warmup, the time of a batch of calls is sampled several times
+// and the results are written as JSON to stdout (or to the file given as the first argument)
+//
+// usage: bin/micro.o [output.json]
+
+#define WARMUP_BATCHES 3
+#define REPETITIONS 15
+#define MIN_BATCH_TIME 1e6 // ns, batches are grown until they take at least this long
+#define DOC_BATCH 64 // document level calls are batched and undone outside of the timing
+
+struct microParams {
+    int lineLength;
+    int tabDensity; // tabs per 100 characters
+    int documentLines; // 0 for single line benchmarks
+};
+
+struct microBench {
+    const char* name;
+    void (*prepare)(struct microParams* p);
+    void (*op)();
+    void (*restore)(int batch); // undoes a batch of calls, untimed. NULL if op leaves no trace
+    void (*cleanup)();
+};
+
+static FILE* out;
+static int firstResult = 1;
+
+static struct outputBuffer line; // source line for single line benchmarks
+static struct outputBuffer render; // its rendered copy
+static struct microParams params;
+static char* lineText; // text used to build documents
+static char filePath[64];
+static unsigned int seed;
+
+// Current time in nanoseconds
+static double nowNano(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// small deterministic generator, so that every build benchmarks the same text
+static unsigned int nextRandom(){
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 16) & 0x7fff;
+}
+
+// Fills str with len characters of code like text with the given number of tabs per 100 characters
+static void generateText(char* str, int len, int tabDensity){
+    static const char alphabet[] = "int value = 42; // total \"str\" (x + y) * 3;";
+    for (int i = 0; i < len; i++){
+        if ((int) (nextRandom() % 100) < tabDensity)
+            str[i] = '\t';
+        else
+            str[i] = alphabet[nextRandom() % (sizeof(alphabet) - 1)];
+    }
+    str[len] = '\0';
+}
+
+// Builds a document of p->documentLines lines of p->lineLength characters
+static void buildDocument(struct microParams* p){
+    seed = 1;
+    lineText = malloc(p->lineLength + 1);
+    for (int i = 0; i < p->documentLines; i++){
+        generateText(lineText, p->lineLength, p->tabDensity);
+        insertNewLine(openedFileLines, lineText, p->lineLength);
+    }
+}
+
+static void freeDocument(){
+    closeDocument();
+    free(lineText);
+    lineText = NULL;
+}
+
+/// Single line benchmarks
+
+static void prepareLine(struct microParams* p){
+    seed = 1;
+    line.buf = NULL;
+    line.capacity = 0;
+    line.spans = NULL;
+    lineReserve(mem_lines, &line, p->lineLength + 2); // room for one inserted character
+    line.size = p->lineLength;
+    generateText(line.buf, p->lineLength, p->tabDensity);
+    render.buf = NULL;
+    render.size = 0;
+    render.capacity = 0;
+    render.spans = NULL;
+    updateBuffer(&render, &line);
+}
+
+static void freeLine(){
+    lineFree(mem_lines, line.buf, line.capacity);
+    lineFree(mem_render, render.buf, render.capacity);
+}
+
+static void opInsertIntoBuffer(){
+    insertIntoBuffer(&line, 0, params.lineLength / 2, 'x');
+    line.size = params.lineLength; // drop the last character to keep the length steady
+    line.buf[line.size] = '\0';
+}
+
+static void opDeleteFromBuffer(){
+    deleteFromBuffer(&line, 0, params.lineLength / 2);
+    line.buf[params.lineLength - 1] = 'x'; // put a character back to keep the length steady
+    line.size = params.lineLength;
+    line.buf[line.size] = '\0';
+}
+
+static void opUpdateBuffer(){
+    updateBuffer(&render, &line);
+}
+
+static void opUpdateStatus(){
+    updateStatus(&render);
+}
+
+static void opZeroTabs(){
+    int xPos = render.size + 1; // end of the line, the longest walk
+    zeroTabs(&line, &xPos);
+}
+
+/// Document benchmarks
+
+static void opInsertNewLine(){
+    insertNewLine(openedFileLines / 2, lineText, params.lineLength);
+}
+
+static void restoreInsertNewLine(int batch){
+    for (int i = 0; i < batch; i++)
+        deleteRow(openedFileLines / 2);
+}
+
+static void opDeleteRow(){
+    deleteRow(openedFileLines / 2);
+}
+
+static void restoreDeleteRow(int batch){
+    for (int i = 0; i < batch; i++)
+        insertNewLine(openedFileLines / 2, lineText, params.lineLength);
+}
+
+static void opPrepareToString(){
+    int len;
+    char* str = prepareToString(&len);
+    memFree(mem_misc, str);
+}
+
+// writes the document to a file and lets go of it, so that it can be opened again
+static void prepareFile(struct microParams* p){
+    buildDocument(p);
+    int len;
+    char* str = prepareToString(&len);
+    snprintf(filePath, sizeof(filePath), "/tmp/editor-micro-%d.c", (int) getpid());
+    FILE* f = fopen(filePath, "w");
+    if (!f)
+        failExit("Could not create the benchmark file");
+    fwrite(str, 1, len, f);
+    fclose(f);
+    memFree(mem_misc, str);
+    closeDocument();
+}
+
+static void opOpenFile(){
+    openFile(filePath);
+}
+
+static void restoreOpenFile(int batch){
+    (void) batch;
+    closeDocument();
+}
+
+static void cleanupFile(){
+    unlink(filePath);
+    freeDocument();
+}
+
+static int compareDouble(const void* a, const void* b){
+    double x = *(const double*) a, y = *(const double*) b;
+    return (x > y) - (x < y);
+}
+
+// Runs one benchmark for one set of parameters and appends the result to the JSON output
+static void runBench(struct microBench* b, struct microParams* p){
+    params = *p;
+    b->prepare(p);
+
+    // document level calls are undone in batches, the rest find the batch size which takes long enough
+    int batch = 1;
+    if (b->restore == NULL){
+        while (1){
+            double start = nowNano();
+            for (int i = 0; i < batch; i++)
+                b->op();
+            if (nowNano() - start >= MIN_BATCH_TIME || batch >= (1 << 24))
+                break;
+            batch *= 2;
+        }
+    }
+    else if (b->op != opOpenFile)
+        batch = DOC_BATCH;
+
+    double samples[REPETITIONS];
+    for (int r = -WARMUP_BATCHES; r < REPETITIONS; r++){
+        double start = nowNano();
+        for (int i = 0; i < batch; i++)
+            b->op();
+        double elapsed = nowNano() - start;
+        if (b->restore)
+            b->restore(batch);
+        if (r >= 0)
+            samples[r] = elapsed / batch;
+    }
+    b->cleanup();
+
+    qsort(samples, REPETITIONS, sizeof(double), compareDouble);
+    double mean = 0;
+    for (int r = 0; r < REPETITIONS; r++)
+        mean += samples[r];
+    mean /= REPETITIONS;
+
+    fprintf(out, "%s\n    {\"name\": \"%s\", \"line_length\": %d, \"tab_density\": %d, "
+            "\"document_lines\": %d, \"batch\": %d, \"repetitions\": %d, "
+            "\"ns_per_op\": {\"min\": %.1f, \"median\": %.1f, \"mean\": %.1f, \"max\": %.1f}}",
+            firstResult ? "" : ",", b->name, p->lineLength, p->tabDensity, p->documentLines,
+            batch, REPETITIONS, samples[0], samples[REPETITIONS / 2], mean, samples[REPETITIONS - 1]);
+    firstResult = 0;
+    fprintf(stderr, "%-18s length %5d tabs %3d%% lines %7d: %12.1f ns/op\n",
+            b->name, p->lineLength, p->tabDensity, p->documentLines, samples[REPETITIONS / 2]);
+}
+
+int main(int argc, char* argv[]){
+    out = stdout;
+    if (argc > 1){
+        out = fopen(argv[1], "w");
+        if (!out)
+            failExit("Could not open the output file");
+    }
+
+    // highlight as C, which exercises every rule in updateStatus()
+    filename = memStrdup(mem_misc, "bench.c");
+    detectFileType();
+    undoRecording = 0; // the lines timed are not those of a document, only the edit is timed
+
+    struct microBench lineBenches[] = {
+        {"insertIntoBuffer", prepareLine, opInsertIntoBuffer, NULL, freeLine},
+        {"deleteFromBuffer", prepareLine, opDeleteFromBuffer, NULL, freeLine},
+        {"updateBuffer", prepareLine, opUpdateBuffer, NULL, freeLine},
+        {"updateStatus", prepareLine, opUpdateStatus, NULL, freeLine},
+        {"zeroTabs", prepareLine, opZeroTabs, NULL, freeLine},
+    };
+    struct microBench documentBenches[] = {
+        {"insertNewLine", buildDocument, opInsertNewLine, restoreInsertNewLine, freeDocument},
+        {"deleteRow", buildDocument, opDeleteRow, restoreDeleteRow, freeDocument},
+        {"prepareToString", buildDocument, opPrepareToString, NULL, freeDocument},
+        {"openFile", prepareFile, opOpenFile, restoreOpenFile, cleanupFile},
+    };
+    int lengths[] = {16, 80, 400, 4000};
+    int densities[] = {0, 5, 25};
+    int documents[] = {1000, 100000};
+
+    fprintf(out, "{\n  \"benchmark\": \"editor-micro\",\n  \"compiler\": \"%s\",\n  \"results\": [", __VERSION__);
+    for (unsigned int b = 0; b < sizeof(lineBenches) / sizeof(lineBenches[0]); b++)
+        for (unsigned int l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++)
+            for (unsigned int d = 0; d < sizeof(densities) / sizeof(densities[0]); d++){
+                struct microParams p = {lengths[l], densities[d], 0};
+                runBench(&lineBenches[b], &p);
+            }
+    for (unsigned int b = 0; b < sizeof(documentBenches) / sizeof(documentBenches[0]); b++)
+        for (unsigned int n = 0; n < sizeof(documents) / sizeof(documents[0]); n++)
+            for (unsigned int l = 0; l < 3; l++){ // the longest lines would make huge documents
+                struct microParams p = {lengths[l], densities[1], documents[n]};
+                runBench(&documentBenches[b], &p);
+            }
+    fprintf(out, "\n  ]\n}\n");
+    if (out != stdout)
+        fclose(out);
+    memFree(mem_misc, filename);
+    return 0;
+}
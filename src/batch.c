@@ -0,0 +1,191 @@
+#include "editor.h"
+
+#include <limits.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+// Batch editing: 'bin/main.o --batch script file...' runs the commands of the script on each file and saves it, without a terminal
+// a line of the script is either 'replace /text/with/' (any character which is in neither text can stand for '/')
+// or a line command as ctrl+e takes it ('sort', '10,200 uniq', 'grep -v text'...), empty lines and lines from '#' are left out
+// the files are shared out to worker processes, one a core, which each take the next file as they are done with one:
+// the editor keeps one document in its globals, a process has its own. The lines are neither highlighted nor logged for undo
+// each file is reported on a line of the standard output, the exit status is 1 when any file could not be edited or saved
+
+#define BATCH_WORKERS_MAX 64
+
+int batchMode = 0;
+
+struct batchCommand {
+    char* line; // of the script
+    const char* query; // the text to replace, in line
+    const char* with; // the text to replace it with, NULL for a line command
+};
+
+static struct batchCommand* commands = NULL;
+static int commandCount = 0;
+
+// Reads the script, returns 0 with a message when a line is not a command
+static int readScript(const char* path){
+    FILE* f = fopen(path, "r");
+    if (!f){
+        fprintf(stderr, "Could not open the script %s: %s\n", path, strerror(errno));
+        return 0;
+    }
+    char* line = NULL;
+    size_t size = 0;
+    int readCount;
+    int number = 0;
+    int valid = 1;
+    while (valid && (readCount = getline(&line, &size, f)) != -1){
+        number++;
+        while (readCount > 0 && (line[readCount - 1] == '\n' || line[readCount - 1] == '\r'))
+            line[--readCount] = '\0';
+        char* text = line;
+        while (*text == ' ' || *text == '\t')
+            text++;
+        if (*text == '\0' || *text == '#')
+            continue;
+        struct batchCommand* grown = memRealloc(mem_misc, commands, sizeof(struct batchCommand) * (commandCount + 1));
+        if (!grown)
+            failExit("Could not read the script");
+        commands = grown;
+        struct batchCommand* command = &commands[commandCount++];
+        command->line = memStrdup(mem_misc, text);
+        command->query = NULL;
+        command->with = NULL;
+        if (!command->line)
+            failExit("Could not read the script");
+        if (strncmp(text, "replace ", 8) == 0){ // split on the character after 'replace '
+            char* query = command->line + 8;
+            char delimiter = *query++;
+            char* middle = delimiter ? strchr(query, delimiter) : NULL;
+            char* end = middle ? strchr(middle + 1, delimiter) : NULL;
+            valid = end && end[1] == '\0' && middle > query;
+            if (valid){
+                *middle = *end = '\0';
+                command->query = query;
+                command->with = middle + 1;
+            }
+        }
+        else { // a line command, after the lines it works on
+            const char* name = text;
+            while (isdigit((unsigned char) *name) || *name == ',')
+                name++;
+            while (*name == ' ')
+                name++;
+            valid = !strcmp(name, "sort") || !strcmp(name, "sort -r") || !strcmp(name, "uniq") || !strcmp(name, "reverse")
+                    || (!strncmp(name, "grep ", 5) && name[5]);
+        }
+        if (!valid)
+            fprintf(stderr, "%s:%d: not a command: %s\n", path, number, text);
+    }
+    free(line);
+    fclose(f);
+    return valid;
+}
+
+// Writes a line of the report at once, so that the lines of the workers do not mix
+static void report(int fd, const char* fmt, ...){
+    char out[PATH_MAX + 128];
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(out, sizeof(out) - 1, fmt, args);
+    va_end(args);
+    if (len < 0)
+        return;
+    if (len > (int) sizeof(out) - 2)
+        len = sizeof(out) - 2;
+    out[len++] = '\n';
+    if (write(fd, out, len) != len)
+        return;
+}
+
+// Runs the script on the file and saves it, returns 0 when it could not be done
+static int editFile(char* file){
+    struct stat st;
+    if (stat(file, &st) != 0 || !S_ISREG(st.st_mode) || access(file, R_OK | W_OK) != 0){
+        report(STDERR_FILENO, "%s: cannot be edited", file);
+        return 0;
+    }
+    openFile(file);
+    int replaced = 0;
+    int ok = 1;
+    for (int c = 0; c < commandCount && ok; c++){
+        if (commands[c].with)
+            replaced += replaceText(commands[c].query, commands[c].with);
+        else if (openedFileLines > 0)
+            ok = runLineCommand(commands[c].line) >= 0;
+    }
+    int lines = openedFileLines;
+    if (!ok)
+        report(STDERR_FILENO, "%s: %s", file, statusmsg);
+    else if (fileModified){
+        saveFile();
+        ok = !fileModified;
+        if (ok)
+            report(STDOUT_FILENO, "%s: %d replaced, %d lines, saved", file, replaced, lines);
+        else
+            report(STDERR_FILENO, "%s: %s", file, statusmsg);
+    }
+    else
+        report(STDOUT_FILENO, "%s: unchanged", file);
+    closeDocument();
+    memFree(mem_misc, filename);
+    filename = NULL;
+    return ok;
+}
+
+// Takes the index of the next file from the queue until it is empty, exits with 1 when any file failed
+static void work(int queue, char** files){
+    int failed = 0;
+    int next;
+    while (read(queue, &next, sizeof(next)) == sizeof(next)) // a write of an int to a pipe is never split
+        failed |= !editFile(files[next]);
+    _exit(failed);
+}
+
+// Runs the script on every file, returns the exit status of the editor
+int batchRun(const char* script, char** files, int count){
+    batchMode = 1;
+    undoRecording = 0;
+    if (!readScript(script))
+        return 2;
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int workers = cores < 1 ? 1 : cores > BATCH_WORKERS_MAX ? BATCH_WORKERS_MAX : cores;
+    if (workers > count)
+        workers = count;
+    int queue[2];
+    if (pipe(queue) != 0)
+        failExit("Could not share out the files");
+    fflush(NULL);
+    pid_t pids[BATCH_WORKERS_MAX];
+    int started = 0;
+    for (int w = 0; w < workers; w++){
+        pid_t pid = fork();
+        if (pid == 0){
+            close(queue[1]);
+            work(queue[0], files);
+        }
+        if (pid > 0)
+            pids[started++] = pid;
+    }
+    close(queue[0]);
+    int failed = 0;
+    if (started == 0){ // no process to be had, done here
+        close(queue[1]);
+        for (int i = 0; i < count; i++)
+            failed |= !editFile(files[i]);
+        return failed;
+    }
+    signal(SIGPIPE, SIG_IGN); // the workers may all be gone, their status tells of it
+    for (int i = 0; i < count; i++) // the workers take them as they are written
+        if (write(queue[1], &i, sizeof(i)) != sizeof(i))
+            break;
+    close(queue[1]);
+    for (int w = 0; w < started; w++){
+        int status;
+        if (waitpid(pids[w], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            failed = 1;
+    }
+    return failed;
+}
@@ -0,0 +1,179 @@
+#include "editor.h"
+
+#include <limits.h>
+
+// Open cache: with EDITOR_CACHE=dir, a file closed without unsaved changes leaves in dir what it takes to show it again:
+// the state each of its lines ends in for the highlighter, the offsets of its lines (see jump.c) and the view
+// a file opened again unchanged (same size, time of modification and hash of its content) is loaded without being highlighted,
+// each line is highlighted when it is first drawn, from the state the line above it is known to end in
+// a file found to have changed once it is read is highlighted in full, as without the cache
+
+#define CACHE_VERSION 1 // to be raised whenever the highlighter colors differently
+
+struct cacheHeader {
+    char magic[8];
+    int version;
+    int lines;
+    long long size;
+    long long modified;
+    long long inode;
+    unsigned long long hash; // of the content, see fileIdentity()
+    int indexStep;
+    int indexCount;
+    int cursorX;
+    int cursorY;
+    int rowOffset;
+    int colOffset;
+};
+
+static const char cacheMagic[8] = "edcache";
+static struct cacheHeader cached;
+static unsigned char* cachedExits = NULL; // enum exit_state of each line, while the file is being loaded
+static long long* cachedOffsets = NULL;
+
+// Works out the cache file of a file: the hash of its full path in the cache directory, returns 0 without a cache
+// batch mode has no cache: its lines are not highlighted, the states they end in are not known (see batch.c)
+static int cachePath(const char* file, char* path, size_t size){
+    const char* dir = getenv("EDITOR_CACHE");
+    if (dir == NULL || *dir == '\0' || batchMode)
+        return 0;
+    char full[PATH_MAX];
+    if (realpath(file, full) == NULL)
+        return 0;
+    unsigned long long hash = FNV_OFFSET;
+    for (const char* c = full; *c; c++)
+        hash = (hash ^ (unsigned char) *c) * FNV_PRIME;
+    return snprintf(path, size, "%s/%016llx.cache", dir, hash) < (int) size;
+}
+
+static int readFully(int fd, void* buf, size_t size){
+    char* at = buf;
+    ssize_t count;
+    while (size > 0 && (count = read(fd, at, size)) > 0){
+        at += count;
+        size -= count;
+    }
+    return size == 0;
+}
+
+static int writeFully(int fd, const void* buf, size_t size){
+    const char* at = buf;
+    ssize_t count;
+    while (size > 0 && (count = write(fd, at, size)) > 0){
+        at += count;
+        size -= count;
+    }
+    return size == 0;
+}
+
+static void cacheDrop(){
+    memFree(mem_misc, cachedExits);
+    memFree(mem_misc, cachedOffsets);
+    cachedExits = NULL;
+    cachedOffsets = NULL;
+}
+
+// Looks for what was kept of the file, before it is loaded
+void cacheLoad(const char* file){
+    cacheDrop();
+    char path[PATH_MAX + 32];
+    struct stat st;
+    if (!cachePath(file, path, sizeof(path)) || stat(file, &st) != 0)
+        return;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return;
+    struct cacheHeader header;
+    if (readFully(fd, &header, sizeof(header)) && !memcmp(header.magic, cacheMagic, sizeof(cacheMagic))
+            && header.version == CACHE_VERSION && header.size == st.st_size && header.inode == (long long) st.st_ino
+            && header.modified == fileModifiedAt(&st) && header.lines > 0 && header.indexCount >= 0){
+        cachedExits = memAlloc(mem_misc, header.lines);
+        cachedOffsets = memAlloc(mem_misc, sizeof(long long) * (header.indexCount + 1));
+        if (cachedExits && cachedOffsets && readFully(fd, cachedExits, header.lines)
+                && readFully(fd, cachedOffsets, sizeof(long long) * header.indexCount))
+            cached = header;
+        else
+            cacheDrop();
+    }
+    close(fd);
+}
+
+// The state the line at ends in, while a file is being loaded with its cache, returns 0 when it is not known
+int cachedExitState(int at, unsigned char* exit){
+    if (cachedExits == NULL || at < 0 || at >= cached.lines)
+        return 0;
+    *exit = cachedExits[at];
+    return 1;
+}
+
+// The file has been loaded, the cache is kept to if the file holds what it held, and the view is put back
+void cacheApply(){
+    if (cachedExits == NULL)
+        return;
+    struct stat st;
+    unsigned long long hash;
+    int unchanged = openedFileLines == cached.lines && fileIdentity(&st, &hash) && hash == cached.hash;
+    memFree(mem_misc, cachedExits);
+    cachedExits = NULL;
+    if (!unchanged){
+        updateAllStatus(); // the states the lines were taken to end in are not to be trusted
+        cacheDrop();
+        return;
+    }
+    lineIndexRestore(cachedOffsets, cached.indexCount, cached.indexStep);
+    cacheDrop();
+    if (cached.rowOffset >= 0 && cached.cursorY >= 1 && cached.rowOffset + cached.cursorY <= openedFileLines){
+        rowOffset = cached.rowOffset;
+        cursorPos.y = cached.cursorY;
+        cursorPos.x = cached.cursorX > 0 ? cached.cursorX : 1;
+        colOffset = cached.colOffset > 0 ? cached.colOffset : 0;
+    }
+}
+
+// Keeps what it takes to show the document again, when it holds what its file holds
+void cacheSave(){
+    char path[PATH_MAX + 32];
+    struct stat st;
+    unsigned long long hash;
+    if (fileModified || streamFd >= 0 || filename == NULL || openedFileLines == 0
+            || !fileIdentity(&st, &hash) || !cachePath(filename, path, sizeof(path)))
+        return;
+    mkdir(getenv("EDITOR_CACHE"), 0755);
+
+    struct cacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+    header.version = CACHE_VERSION;
+    header.lines = openedFileLines;
+    header.size = st.st_size;
+    header.modified = fileModifiedAt(&st);
+    header.inode = st.st_ino;
+    header.hash = hash;
+    const long long* offsets;
+    header.indexCount = lineIndexAll(&offsets, &header.indexStep);
+    header.cursorX = cursorPos.x;
+    header.cursorY = cursorPos.y;
+    header.rowOffset = rowOffset;
+    header.colOffset = colOffset;
+    unsigned char* exits = memAlloc(mem_misc, openedFileLines);
+    if (!exits)
+        return;
+    for (int i = 0; i < openedFileLines; i++){
+        struct highlightState hs;
+        lineExitState(i, &hs);
+        exits[i] = exitState(&hs);
+    }
+
+    // written beside the cache and moved over it, so that a cache is never read half written
+    char temporary[PATH_MAX + 40];
+    snprintf(temporary, sizeof(temporary), "%s.%d", path, (int) getpid());
+    int fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0){
+        int written = writeFully(fd, &header, sizeof(header)) && writeFully(fd, exits, openedFileLines)
+                      && writeFully(fd, offsets, sizeof(long long) * header.indexCount);
+        close(fd);
+        if (!written || rename(temporary, path) != 0)
+            unlink(temporary);
+    }
+    memFree(mem_misc, exits);
+}
@@ -0,0 +1,456 @@
+#include "editor.h"
+
+// Documents and panes
+// ctrl+b opens a file in a document of its own, ctrl+n shows the next document in the pane,
+// ctrl+x splits the pane in two, ctrl+v goes to the next pane and ctrl+d closes it
+//
+// the editor works on one document at a time, through its globals and those of each module which belong to a document
+// (its lines, slabs, undo history, line index, folds, wrapped rows, watch and stream). They are registered here,
+// and a document which is not in use keeps a copy of them until it is used again
+// a pane shows a document with a cursor and offsets of its own, the panes showing one document share its lines,
+// their rendering and highlighting. The panes are stacked, each over its status row, the message row is below them all
+// a pane is only composed again when it may have changed: when it shows the document being edited,
+// or has been moved or left. Otherwise its rows are kept as the terminal shows them
+// the documents which are not shown give back their memory when the editor holds more than its budget (see spill.c)
+
+#define DOCUMENT_FIELDS 64 // variables registered with keepDocumentState()
+#define PANES_MAX 16
+#define PANE_MIN_ROWS 2 // rows of text of the smallest pane
+
+struct documentField {
+    void* state;
+    size_t size;
+};
+
+struct view {
+    struct pos cursor;
+    int rowOffset, colOffset;
+    int lastFrameRowOffset, lastFrameColOffset;
+};
+
+struct document {
+    char* state; // the registered variables while another document is in use
+    struct view view; // where it was shown last
+    const char* name; // its filename and whether it has been modified, as they were when it was left
+    int modified;
+    unsigned long used; // when it was last left, the documents left longest ago give back their memory first
+    int spilled; // has given back memory since it was last used
+};
+
+struct pane {
+    int document;
+    struct view view; // while another pane is in use
+    int top; // the first row of the screen it takes
+    int height; // rows of text, without its status row
+    int drawn; // composed since it was moved or left, the terminal shows it as it is
+    int drawnWrap; // softWrap when it was composed
+};
+
+int paneCount = 0;
+
+static struct documentField fields[DOCUMENT_FIELDS];
+static int fieldCount = 0;
+static size_t stateSize = 0;
+static char* blankState = NULL; // the variables before any file was opened, where a new document begins from
+
+static struct document* documents = NULL;
+static int documentCount = 0;
+static int activeDocument = 0;
+static unsigned long useCount = 0;
+
+static struct pane panes[PANES_MAX];
+static int activePane = 0;
+
+// Registers a variable which belongs to the document in use
+void keepDocumentState(void* state, size_t size){
+    if (fieldCount == DOCUMENT_FIELDS)
+        failExit("Too many document variables");
+    fields[fieldCount].state = state;
+    fields[fieldCount].size = size;
+    fieldCount++;
+    stateSize += size;
+}
+
+static void storeFields(char* state){
+    for (int i = 0; i < fieldCount; i++){
+        memcpy(state, fields[i].state, fields[i].size);
+        state += fields[i].size;
+    }
+}
+
+static void loadFields(const char* state){
+    for (int i = 0; i < fieldCount; i++){
+        memcpy(fields[i].state, state, fields[i].size);
+        state += fields[i].size;
+    }
+}
+
+static char* newState(){
+    char* state = memAlloc(mem_misc, stateSize);
+    if (!state)
+        failExit("Could not open a document");
+    return state;
+}
+
+static void storeView(struct view* view){
+    view->cursor = cursorPos;
+    view->rowOffset = rowOffset;
+    view->colOffset = colOffset;
+    view->lastFrameRowOffset = lastFrameRowOffset;
+    view->lastFrameColOffset = lastFrameColOffset;
+}
+
+static void loadView(const struct view* view){
+    cursorPos = view->cursor;
+    rowOffset = view->rowOffset;
+    colOffset = view->colOffset;
+    lastFrameRowOffset = view->lastFrameRowOffset;
+    lastFrameColOffset = view->lastFrameColOffset;
+}
+
+// Registers what belongs to a document, the editor is then on its first document in a single pane
+// the variables are registered once, editorInit() may run again to start over from an empty editor (see bench/latency.c)
+void documentInit(){
+    static int registered = 0;
+    if (!registered){
+        keepDocumentState(&fromOpenedFile, sizeof(fromOpenedFile));
+        keepDocumentState(&toRenderToScreen, sizeof(toRenderToScreen));
+        keepDocumentState(&openedFileLines, sizeof(openedFileLines));
+        keepDocumentState(&openedFileCapacity, sizeof(openedFileCapacity));
+        keepDocumentState(&openedFileFlags, sizeof(openedFileFlags));
+        keepDocumentState(&filename, sizeof(filename));
+        keepDocumentState(&fileModified, sizeof(fileModified));
+        keepDocumentState(&searchMatch, sizeof(searchMatch));
+        slabKeepState();
+        undoKeepState();
+        lineIndexKeepState();
+        foldKeepState();
+        wrapKeepState();
+        watchKeepState();
+        streamKeepState();
+        spillKeepState();
+        blankState = newState();
+        storeFields(blankState);
+        registered = 1;
+    }
+    for (int d = 0; d < documentCount; d++) // of the editor started over
+        memFree(mem_misc, documents[d].state);
+    memFree(mem_misc, documents);
+
+    documents = memAlloc(mem_misc, sizeof(struct document));
+    if (!documents)
+        failExit("Could not open a document");
+    documents[0] = (struct document) {newState(), {{1, 1}, 0, 0, -1, 0}, NULL, 0, 0, 0};
+    documentCount = 1;
+    activeDocument = 0;
+    panes[0] = (struct pane) {0, {{1, 1}, 0, 0, -1, 0}, 0, screenrows, 0, 0};
+    paneCount = 1;
+    activePane = 0;
+}
+
+// Swaps the variables of the document in use for those of the document
+static void switchDocument(int d){
+    if (d == activeDocument)
+        return;
+    struct document* left = &documents[activeDocument];
+    storeFields(left->state);
+    left->name = filename;
+    left->modified = fileModified;
+    loadFields(documents[d].state);
+    activeDocument = d;
+}
+
+// Makes the document the one the editor works on, with what it gave back of its memory
+// returns 1 when its file has changed while its text was let go of, and has been read again
+static int useDocument(int d){
+    if (d == activeDocument)
+        return 0;
+    documents[activeDocument].used = ++useCount;
+    switchDocument(d);
+    documents[d].spilled = 0;
+    return spillRestore();
+}
+
+// Keeps the view within the document, which may have been edited from another pane
+static void clampView(){
+    if (rowOffset > openedFileLines - 1)
+        rowOffset = openedFileLines > 0 ? openedFileLines - 1 : 0;
+    if (cursorPos.y + rowOffset > openedFileLines)
+        cursorPos.y = openedFileLines - rowOffset;
+    if (cursorPos.y < 1)
+        cursorPos.y = 1;
+}
+
+// Makes the pane the one the editor works on and draws in, its view is the one of the globals until it is left
+static void enterPane(int p){
+    useDocument(panes[p].document);
+    loadView(&panes[p].view);
+    screenrows = panes[p].height;
+    screenOrigin = panes[p].top;
+    clampView();
+}
+
+static void leavePane(int p){
+    storeView(&panes[p].view);
+}
+
+// The panes have been moved on the screen, each is composed again
+static void panesMoved(){
+    for (int p = 0; p < paneCount; p++){
+        panes[p].drawn = 0;
+        panes[p].view.lastFrameRowOffset = -1;
+    }
+}
+
+// Composes the panes other than the one in use, which refresh() composes
+void loadPanes(){
+    if (paneCount == 1)
+        return;
+    leavePane(activePane);
+    for (int p = 0; p < paneCount; p++){
+        struct pane* pane = &panes[p];
+        if (p == activePane)
+            continue;
+        screenOrigin = pane->top;
+        if (pane->drawn && pane->document != activeDocument && pane->drawnWrap == softWrap
+            && screenKeep(0, pane->height + 1))
+            continue;
+        enterPane(p);
+        loadRows(0);
+        loadStatusBar();
+        lastFrameRowOffset = rowOffset;
+        lastFrameColOffset = colOffset;
+        leavePane(p);
+        pane->drawn = 1;
+        pane->drawnWrap = softWrap;
+    }
+    enterPane(activePane);
+}
+
+// Shows the document in the pane in use, where it was shown last
+static void showDocument(int d){
+    storeView(&documents[activeDocument].view);
+    int reread = useDocument(d);
+    loadView(&documents[d].view);
+    lastFrameRowOffset = -1;
+    panes[activePane].document = d;
+    clampView();
+    if (!reread) // the message tells of it
+        loadStatusMessage("%.40s (%d of %d)", filename ? filename : "[Unsaved File]", d + 1, documentCount);
+}
+
+// Opens the file in a document of its own in the pane in use, or shows the document it is already open in
+void documentOpen(char* file){
+    for (int d = 0; d < documentCount; d++){
+        const char* name = d == activeDocument ? filename : documents[d].name;
+        if (name && !strcmp(name, file)){
+            if (d != activeDocument)
+                showDocument(d);
+            return;
+        }
+    }
+    if (access(file, R_OK) != 0){
+        loadStatusMessage("Could not open %.60s", file);
+        return;
+    }
+    if (openedFileLines == 0 && !filename && !fileModified && streamFd < 0 && activeDocument != findDocument){
+        openFile(file); // in the empty document the editor began with
+        return;
+    }
+    documentCreate();
+    openFile(file);
+    documentsKeepBudget();
+}
+
+// Adds an empty document, without a file, and shows it in the pane in use, returns its index
+int documentCreate(){
+    struct document* grown = memRealloc(mem_misc, documents, sizeof(struct document) * (documentCount + 1));
+    if (!grown)
+        failExit("Could not open a document");
+    documents = grown;
+    int d = documentCount++;
+    documents[d] = (struct document) {newState(), {{1, 1}, 0, 0, -1, 0}, NULL, 0, 0, 0};
+    memcpy(documents[d].state, blankState, stateSize);
+    storeView(&documents[activeDocument].view);
+    useDocument(d);
+    loadView(&documents[d].view);
+    panes[activePane].document = d;
+    return d;
+}
+
+// Shows the document in the pane in use
+void documentShow(int d){
+    if (d != activeDocument && d >= 0 && d < documentCount)
+        showDocument(d);
+}
+
+// The document the editor works on
+int documentInUse(){
+    return activeDocument;
+}
+
+// Makes the document the one the editor works on, for work on it while it may not be shown
+// returns the document to be given back to documentReturn(), the view is left as it is
+int documentVisit(int d){
+    int previous = activeDocument;
+    useDocument(d);
+    return previous;
+}
+
+// Goes back to the document in use before documentVisit(), the panes showing the one visited are composed again
+void documentReturn(int previous){
+    for (int p = 0; p < paneCount; p++)
+        if (panes[p].document == activeDocument)
+            panes[p].drawn = 0;
+    useDocument(previous);
+}
+
+// Asks for a file to open
+void documentPrompt(){
+    char* input = userPrompt("Open: %s (ESC to cancel)", NULL);
+    if (input == NULL)
+        return;
+    documentOpen(input);
+    memFree(mem_misc, input);
+}
+
+// Shows the next document in the pane in use
+void documentNext(){
+    if (documentCount == 1){
+        loadStatusMessage("No other document is open, ctrl+b opens one");
+        return;
+    }
+    showDocument((activeDocument + 1) % documentCount);
+}
+
+// Number of documents with unsaved changes
+int documentsModified(){
+    int modified = 0;
+    for (int d = 0; d < documentCount; d++)
+        if (d == activeDocument ? fileModified : documents[d].modified)
+            modified++;
+    return modified;
+}
+
+// Lets go of every document, each leaves the view it is shown in to the open cache
+void closeDocuments(){
+    leavePane(activePane);
+    for (int d = 0; d < documentCount; d++){
+        switchDocument(d);
+        spillClose();
+        const struct view* view = &documents[d].view;
+        for (int p = 0; p < paneCount; p++)
+            if (panes[p].document == d)
+                view = &panes[p].view;
+        loadView(view);
+        closeDocument();
+        memFree(mem_misc, filename);
+        filename = NULL;
+    }
+}
+
+// Whether the document is shown in a pane
+static int documentShown(int d){
+    for (int p = 0; p < paneCount; p++)
+        if (panes[p].document == d)
+            return 1;
+    return d == activeDocument;
+}
+
+// Lets the documents which are not shown give back their memory, until the editor holds no more than its budget
+// every document gives back its rendering before any gives back its text, those left longest ago first
+void documentsKeepBudget(){
+    if (documentCount == 1 || memoryInUse() <= memoryBudget())
+        return;
+    int* order = memAlloc(mem_misc, sizeof(int) * documentCount);
+    if (!order)
+        return;
+    int count = 0;
+    for (int d = 0; d < documentCount; d++){
+        if (documentShown(d))
+            continue;
+        int i = count++;
+        for (; i > 0 && documents[order[i - 1]].used > documents[d].used; i--)
+            order[i] = order[i - 1];
+        order[i] = d;
+    }
+    int active = activeDocument;
+    for (int level = spill_render; level <= spill_swapped && memoryInUse() > memoryBudget(); level++)
+        for (int i = 0; i < count && memoryInUse() > memoryBudget(); i++){
+            switchDocument(order[i]);
+            while (memoryInUse() > memoryBudget() && spillDocument(level))
+                documents[order[i]].spilled = 1;
+        }
+    switchDocument(active);
+    memFree(mem_misc, order);
+}
+
+// The memory held against the budget, and the documents which have given back theirs, 0 with a single document
+int documentsStatusString(char* str, int size){
+    if (documentCount == 1)
+        return 0;
+    int spilled = 0;
+    for (int d = 0; d < documentCount; d++)
+        spilled += documents[d].spilled;
+    int len = snprintf(str, size, "mem ");
+    len += memSizeString(&str[len], size - len, memoryInUse());
+    if (len < size)
+        len += snprintf(&str[len], size - len, "/");
+    if (len < size)
+        len += memSizeString(&str[len], size - len, memoryBudget());
+    if (spilled && len < size)
+        len += snprintf(&str[len], size - len, " (%d aside)", spilled);
+    return len < size ? len : size - 1;
+}
+
+// Splits the pane in use in two, both showing its document
+void paneSplit(){
+    struct pane* pane = &panes[activePane];
+    int upper = (pane->height - 1) / 2; // the row left is the status row of the upper pane
+    int lower = pane->height - 1 - upper;
+    if (paneCount == PANES_MAX || upper < PANE_MIN_ROWS || lower < PANE_MIN_ROWS){
+        loadStatusMessage("No room for another pane");
+        return;
+    }
+    leavePane(activePane);
+    memmove(&panes[activePane + 2], &panes[activePane + 1], sizeof(struct pane) * (paneCount - activePane - 1));
+    paneCount++;
+    panes[activePane + 1] = *pane;
+    pane->height = upper;
+    panes[activePane + 1].top = pane->top + upper + 1;
+    panes[activePane + 1].height = lower;
+    panesMoved();
+    enterPane(activePane);
+}
+
+// Goes to the pane below, from the last one to the first
+void paneNext(){
+    if (paneCount == 1)
+        return;
+    leavePane(activePane);
+    panes[activePane].drawn = 0;
+    activePane = (activePane + 1) % paneCount;
+    enterPane(activePane);
+}
+
+// Closes the pane in use, its rows go to the pane above it (below it for the first one)
+void paneClose(){
+    if (paneCount == 1){
+        loadStatusMessage("This is the only pane");
+        return;
+    }
+    storeView(&documents[activeDocument].view);
+    int rows = panes[activePane].height + 1;
+    int next = activePane > 0 ? activePane - 1 : 0;
+    if (activePane > 0)
+        panes[activePane - 1].height += rows;
+    else {
+        panes[1].top = 0;
+        panes[1].height += rows;
+    }
+    memmove(&panes[activePane], &panes[activePane + 1], sizeof(struct pane) * (paneCount - activePane - 1));
+    paneCount--;
+    activePane = next;
+    panesMoved();
+    enterPane(activePane);
+}
@@ -1,5 +1,30 @@
 #include "editor.h"
 
+// editor state (declared in editor.h)
+struct pos cursorPos;
+int screenrows;
+int screencols;
+int rowOffset;
+int colOffset;
+
+int openedFileLines;
+int openedFileCapacity;
+struct outputBuffer* fromOpenedFile, * toRenderToScreen;
+struct editorFlags* openedFileFlags;
+char *filename;
+
+int fileModified;
+int awaitingArrow;
+int lastArrow;
+
+char statusmsg[80];
+time_t statusmsg_time;
+
+struct searchMatch searchMatch;
+
+int lastFrameRowOffset;
+int lastFrameColOffset;
+
 // internal types to recognize
 char * c_fam[] = {".c", ".h", ".cpp", NULL};
 char * c_keyw[] = {"switch", "if", "while", "do", "for", "break", "continue", "return", "else", "enum", "struct", "union", "typedef", "register", "extern" ,"static", "class", "case", "volatile", "default",  "goto", "const|", "int|", "long|", "double|", "float|", "char|", "unsigned|", "signed|",
@@ -31,72 +56,58 @@ void failExit(const char *s) {
 
 // Terminal is adjusted to a custom state
 void turnOfFlags() {
-    struct termios rawFlags;
-    int res;
-    res = tcgetattr(STDIN_FILENO, &rawFlags);
-    if (res == -1)
-        failExit("Could not retreive flags");
-    // Save original flags to restore them before exiting
-    copyFlags = rawFlags;
+    terminal->enableRaw();
     atexit(reset);
-    
-    // c_lflag: “local flags"  // c_iflag: "input flags"
-    // c_oflag: "output flags" // c_cflag: "control flags"
-    rawFlags.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
-    // ~ECHO echo mode off
-    // ~ICANON canonical mode off - reads byte by byte, not line by line
-    // ~ISIG - reads ctr + c not as (SIGINT) and ctr + z not as (SIGTSTP) and ctr + y not to suspend to background
-    // ~IEXTEN - ctr + v not to have the terminal wait for you to type another character
-    //         - ctr + o not to discard the control character
-    rawFlags.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
-    // ~BRKINT (old, usually not important) not have a break condition cause a SIGINT signal
-    // ~ICRNL - not to have the terminal helpfully translating any carriage returns into newlines (10, '\n').
-    // ~INPCK (old, usually not important) disables parity checking, which doesn’t seem to                  ly to modern terminal emulators.
-    // ~ISTRIP (old, usually turned off already) not to strip 8th bits of each input byte.
-    // ~IXON - reads ctr + s and ctrl + q, usually they toggling data from being/not being transmitted to the terminal, for XON and XOFF of transmissions.
-    
-    
-    rawFlags.c_oflag &= ~(OPOST);
-    //  ~OPOST - not to translate "\n" to "\r\n". terminal requires both of these characters in order to start a new line of text.
-    
-    rawFlags.c_cflag |= (CS8);
-    // |CS8 (a mask) sets the character size to 8 bits per byte. It is usually already set that way.
-    
-    // c_cc: control characters
-    rawFlags.c_cc[VMIN] = 0; // minimum number of bytes needed before read() can return
-    rawFlags.c_cc[VTIME] = 1; // maximum amount of time to wait before read() returns.  1/10th of a second
-    res = tcsetattr(STDIN_FILENO, TCSAFLUSH, &rawFlags);
-    // TCSAFLUSH argument specifies when to apply the change: it waits for all pending output to be written to the terminal, and also discards any input that hasn’t been read.
-    if (res == -1)
-        failExit("Could not set flags (raw mode)");
 }
 
 // Terminal is reset to it's natural state
 void reset(){
-    int res = tcsetattr(STDIN_FILENO, TCSAFLUSH, &copyFlags);
-    if (res == -1)
-        failExit("Could not reset flags");
+    terminal->disableRaw();
 }
 
-// updates the screen. Rewrites the output from the output buffer
+// updates the screen. Composes the frame and writes out only what has changed since the last one
 void refresh(){
-    struct outputBuffer oBuf = {NULL, 0, NULL};
+    TRACE_BEGIN(trace_refresh);
+    struct outputBuffer oBuf = {NULL, 0, 0, NULL};
     appendToBuffer(&oBuf, HIDE_CURSOR);
-    appendToBuffer(&oBuf, CL_SCREEN_ALL);
-    appendToBuffer(&oBuf, REPOS_CURSOR_TOP_LEFT);
-    if (openedFileLines == 0) {
-        loadTitle(&oBuf); // 1 row
+    screenClear();
+    if (openedFileLines == 0 && paneCount == 1) {
+        loadTitle(); // 1 row
         cursorPos.y = 2;
         cursorPos.x = 2;
-        loadRows(&oBuf, -1); // - 1 for title row
+        PERF_BEGIN(perf_rows);
+        loadRows(1); // below the title row
+        PERF_END(perf_rows);
+        lastFrameRowOffset = -1; // title screen can not be scrolled
     }
-    else loadRows(&oBuf, 0); // for an empty bottom row
+    else {
+        PERF_BEGIN(perf_rows);
+        loadPanes(); // the other panes, when the screen is split
+        loadRows(0);
+        PERF_END(perf_rows);
+        // If the viewport has only moved, let the terminal shift the rows it already shows
+        // leaving only the rows which have been exposed to be written out
+        int shift = rowOffset - lastFrameRowOffset;
+        if (rowsMapped() && lastFrameRowOffset >= 0)
+            shift = wrapRowOf(rowOffset) - wrapRowOf(lastFrameRowOffset);
+        if (lastFrameRowOffset >= 0 && colOffset == lastFrameColOffset)
+            screenScroll(&oBuf, screenOrigin + 1, screenOrigin + screenrows, shift);
+        lastFrameRowOffset = rowOffset;
+    }
+    lastFrameColOffset = colOffset;
     
-    loadStatusBar(&oBuf);
-    appendreposCursorSequence(&oBuf, cursorPos.x, cursorPos.y);
+    loadStatusBar();
+    screenFlush(&oBuf);
+    struct pos cursor = cursorPos;
+    if (rowsMapped())
+        wrapCursor(&cursor.x, &cursor.y);
+    screenMoveCursor(&oBuf, cursor.x, screenOrigin + cursor.y);
     appendToBuffer(&oBuf, SHOW_CURSOR);
     terminalOut(oBuf.buf, oBuf.size);
-    free(oBuf.buf);
+    lastFrameBytes = oBuf.size;
+    memFree(mem_frames, oBuf.buf);
+    perfFrame();
+    TRACE_END(trace_refresh);
 }
 
 // Initializes the editor with default values
@@ -112,6 +123,7 @@ void editorInit() {
     rowOffset = 0; // represents an offset from to the top of 0
     colOffset = 0; // represents an offset from the left of 0
     openedFileLines = 0;
+    openedFileCapacity = 0;
     fromOpenedFile = NULL;
     toRenderToScreen = NULL;
     
@@ -122,51 +134,20 @@ void editorInit() {
     
     statusmsg[0] = '\0';
     statusmsg_time = 0;
+    searchMatch.line = -1;
     
+    lastFrameRowOffset = -1;
+    lastFrameColOffset = 0;
+    fullRedraw = getenv("EDITOR_FULL_REDRAW") != NULL; // to compare against the optimized output
+    screenInit(screenrows + 2, screencols);
+    documentInit();
 }
 
 /*
  * Retreives the size of the terminal's width and height
  */
 int getWindowSize(int *rows, int *cols) {
-    struct winsize ws;
-    // ??maybe stands for: Terminal Input/Output Control) Get WINdow SiZe.)
-    int res = ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws);
-    if (res == -1 || ws.ws_col == 0){
-        // ioctl failed, try alternative method to get height and width
-        struct outputBuffer oBuf = {NULL, 0, NULL};
-        appendToBuffer(&oBuf, REPOS_CURSOR_BOTTOM_RIGHT);
-        appendToBuffer(&oBuf, QUERRY_CURSOR_POS);
-        terminalOut(oBuf.buf, oBuf.size);
-        free(oBuf.buf);
-        printf("\r\n");
-        char buf[32];
-        unsigned int i = 0;
-        while (i < sizeof(buf) - 1) {
-            if (read(STDIN_FILENO, &buf[i], 1) != 1)
-                break; // error
-            if (buf[i] == 'R') {
-                buf[i] = '\0';
-                break; // terminate input once R is reached
-            }
-            i++;
-        }
-        if (buf[0] != '\x1b' || buf[1] != '[')
-            // Alternative method failed
-            return -1;
-        
-        int res = sscanf(&buf[2], "%d;%d", rows, cols);
-        if ( res != 2) // need to read both integers or
-            // or else Alternative method fails
-            return -1;
-        
-        return 0;
-    }
-    else {
-        *cols = ws.ws_col;
-        *rows = ws.ws_row;
-    }
-    return 0;
+    return terminal->getSize(rows, cols);
 }
 
 
@@ -179,7 +160,7 @@ void appendToBuffer(struct outputBuffer* out, const char* str, int len) {
         return;
 
     // Allocate memory
-    char* ptr = realloc(out->buf, out->size + len );
+    char* ptr = memRealloc(mem_frames, out->buf, out->size + len );
     if (ptr == NULL)
       return; // failed to reallocate
     
@@ -232,12 +213,32 @@ void appendreposCursorSequence(struct outputBuffer* out, int x, int y) {
     appendToBuffer(out, temp, strlen(temp));
 }
 
+// Helper function to scroll the rows between top and bottom (1 based, inclusive)
+// lines > 0 moves the text up (scroll forward), lines < 0 moves it down
+void appendScrollSequence(struct outputBuffer* out, int top, int bottom, int lines) {
+    char temp[48];
+    snprintf(temp, sizeof(temp), "\x1b[%d;%dr\x1b[%d%c", top, bottom,
+             lines > 0 ? lines : -lines, lines > 0 ? 'S' : 'T');
+    appendToBuffer(out, temp, strlen(temp));
+    appendToBuffer(out, RESET_SCROLL_REGION);
+}
+
 /* termial
  * Makes it easeir to write to the terminal
  *   appends characters and escape sequences to the buffer
  */
  int terminalOut(const char *sequence, int count){
-    return write(STDOUT_FILENO, sequence, count);
+    totalOutputBytes += count;
+    PERF_BEGIN(perf_output);
+    int res = terminal->write(sequence, count);
+    PERF_END(perf_output);
+    return res;
+}
+
+// Reads a single byte of input from the terminal
+// returns 1 when a byte has been read, 0 if none arrived in time and -1 on error
+int terminalIn(char *c){
+    return terminal->read(c);
 }
 
 
@@ -246,20 +247,30 @@ char readCharacter(){
     // read character
     char c = '\0';
     int res;
-    while ((res = read( STDIN_FILENO, &c, 1)) != 1) { // read one byte at a time
+    while ((res = terminalIn(&c)) != 1) { // read one byte at a time
         if (res == -1 && errno != EAGAIN) // EAGAIN : no data available now, try again
             failExit("Unable to read input");
+        if (streamFd >= 0 && streamRead()) // more of the document has arrived
+            refresh();
+        if (findWakeFd >= 0 && findDrain()) // more files have been searched
+            refresh();
+        if (fileWatchFd >= 0 && fileWatchRead()) // the file has been changed by another process
+            refresh();
+        else if (lineIndexPending()) // the time between keys goes to indexing the offsets of the lines
+            lineIndexBuild();
     }
+    PERF_BEGIN(perf_input);
 
     // Handle special keys
     if (c == '\x1b') {
         char seq[3];
-        res = read(STDIN_FILENO, &seq[0], 1);
+        res = terminalIn(&seq[0]);
         if (res != 1) // if fails
             return c; // Assume key = ESC
-        res = read(STDIN_FILENO, &seq[1], 1);
+        res = terminalIn(&seq[1]);
         if (res != 1) // if fails
             return c; // Assume key = ESC
+        PERF_END(perf_input);
         if (seq[0] == 'O') {
             switch (seq[1]) {
                 case 'H':// Home key
@@ -278,7 +289,7 @@ char readCharacter(){
         if (seq[0] == '[') {
             if (seq[1] >= '0' && seq[1] <= '9') {
                 // Check for longer sequence, needs one more char
-                res = read(STDIN_FILENO, &seq[2], 1);
+                res = terminalIn(&seq[2]);
                 if (res != 1) // if fails
                     return c; // Assume key = ESC
                 if (seq[2] == '~') {
@@ -288,7 +299,7 @@ char readCharacter(){
                             break;
                         case '4': case '8': // End key
                             if (cursorPos.y + rowOffset < openedFileLines && fromOpenedFile)
-                                cursorPos.x = toRenderToScreen[cursorPos.y + rowOffset -1].size;
+                                cursorPos.x = lineWidth(&toRenderToScreen[cursorPos.y + rowOffset -1]);
                             break;
                             
                         case '3': // Delete
@@ -296,11 +307,19 @@ char readCharacter(){
                             break;
  
                         case '5': // Page up
+                            if (rowsMapped()){ // a page of rows, which may hold fewer or more lines
+                                wrapPage(-1);
+                                break;
+                            }
                             rowOffset -= screenrows;
                             if (rowOffset < 0)
                                 rowOffset = 0;
                             break;
                         case '6': // Page down
+                            if (rowsMapped()){
+                                wrapPage(1);
+                                break;
+                            }
                             rowOffset += screenrows - 1;
                             if (rowOffset + cursorPos.y > openedFileLines)
                                 rowOffset = openedFileLines - cursorPos.y;
@@ -312,7 +331,7 @@ char readCharacter(){
                     
                     // Snap to end of line
                     if (cursorPos.y < screenrows + 1 && fromOpenedFile) {
-                      int currentRowEnd = toRenderToScreen[cursorPos.y - 1 + rowOffset].size + 1;
+                      int currentRowEnd = lineWidth(&toRenderToScreen[cursorPos.y - 1 + rowOffset]) + 1;
                       if (cursorPos.x + colOffset > currentRowEnd){
                           cursorPos.x = currentRowEnd ;
                           colOffset = 0;
@@ -329,7 +348,11 @@ char readCharacter(){
                     lastArrow = 3;
                     break;
                 }
-                if (cursorPos.y > 0) { // can never pass 0, allow overscreen by 1
+                if (rowsMapped()){ // over a folded block, the screen follows in scroll()
+                    int line = cursorPos.y + rowOffset - 1;
+                    cursorPos.y -= line - foldPrevious(line);
+                }
+                else if (cursorPos.y > 0) { // can never pass 0, allow overscreen by 1
                     cursorPos.y--;
                 }
                 break;
@@ -338,7 +361,12 @@ char readCharacter(){
                     lastArrow = 4;
                     break;
                 }
-                if (cursorPos.y <= screenrows && rowOffset + cursorPos.y < openedFileLines ){ // can never pass max, allow overscreen by 1
+                if (rowsMapped()){
+                    int line = cursorPos.y + rowOffset - 1;
+                    if (foldNext(line) < openedFileLines)
+                        cursorPos.y += foldNext(line) - line;
+                }
+                else if (cursorPos.y <= screenrows && rowOffset + cursorPos.y < openedFileLines ){ // can never pass max, allow overscreen by 1
                     if (cursorPos.y == screenrows)
                         rowOffset++;
                     else
@@ -352,15 +380,15 @@ char readCharacter(){
                 }
                 if (cursorPos.y <= screenrows
                     && fromOpenedFile){
-                    if (cursorPos.x + colOffset < toRenderToScreen[cursorPos.y + rowOffset - 1].size + 1){
-                        if (cursorPos.x < screencols)
+                    if (cursorPos.x + colOffset < lineWidth(&toRenderToScreen[cursorPos.y + rowOffset - 1]) + 1){
+                        if (cursorPos.x < screencols || softWrap) // a wrapped line goes on in the row below
                             cursorPos.x++;
                         else
                             colOffset++;
                     }
-                    else if (cursorPos.y < screenrows &&
-                    cursorPos.x + colOffset >= toRenderToScreen[cursorPos.y + rowOffset -1].size + 1){
-                        cursorPos.y++;
+                    else if ((rowsMapped() ? foldNext(cursorPos.y + rowOffset - 1) < openedFileLines : cursorPos.y < screenrows) &&
+                    cursorPos.x + colOffset >= lineWidth(&toRenderToScreen[cursorPos.y + rowOffset -1]) + 1){
+                        cursorPos.y += foldNext(cursorPos.y + rowOffset - 1) - (cursorPos.y + rowOffset - 1);
                         cursorPos.x = 1;
                         colOffset = 0;
                     }
@@ -372,19 +400,21 @@ char readCharacter(){
                     break;
                 }
                 if (cursorPos.x > 1){
-                    // Consider tabs
+                    // Consider tabs and characters of several bytes, the cursor goes to the column of the character before
                     struct outputBuffer* line = &fromOpenedFile[cursorPos.y + rowOffset - 1];
-                    cursorPos.x = subtractTabs(line, cursorPos.x);
-                    cursorPos.x--;
-                    cursorPos.x = addTabs(line, cursorPos.x);
-                    if (cursorPos.x >= screencols)
+                    int index = subtractTabs(line, cursorPos.x) - 1;
+                    if (index > 0)
+                        index = isLongLine(line) ? index - 1 : utf8Previous(line->buf, index);
+                    cursorPos.x = lineColumn(line, index) + 1;
+                    if (cursorPos.x >= screencols && !softWrap)
                         cursorPos.x = screencols - 1; // return cursorPos to within screen range
                 }
-                else if (cursorPos.y > 1 && fromOpenedFile) { // move up to the end of the previous line
-                    cursorPos.y--;
-                    if (cursorPos.y > screenrows)
+                else if ((rowsMapped() ? cursorPos.y + rowOffset > 1 : cursorPos.y > 1) && fromOpenedFile) { // move up to the end of the previous line
+                    int at = cursorPos.y + rowOffset - 1;
+                    cursorPos.y -= at - foldPrevious(at);
+                    if (cursorPos.y > screenrows && !rowsMapped())
                         cursorPos.y = screenrows-1; // return cursorPos to within screen range
-                    cursorPos.x = toRenderToScreen[cursorPos.y + rowOffset -1].size + 1;
+                    cursorPos.x = lineWidth(&toRenderToScreen[cursorPos.y + rowOffset -1]) + 1;
                     // Consider tabs
                     struct outputBuffer* line = &fromOpenedFile[cursorPos.y + rowOffset - 1];
                     cursorPos.x = addTabs(line, cursorPos.x);
@@ -400,7 +430,7 @@ char readCharacter(){
                 break;
               case 'F': // End
                     if (cursorPos.y < openedFileLines && fromOpenedFile)
-                        cursorPos.x = toRenderToScreen[cursorPos.y + rowOffset -1].size + 1;
+                        cursorPos.x = lineWidth(&toRenderToScreen[cursorPos.y + rowOffset -1]) + 1;
                   break;
 
             }
@@ -408,7 +438,7 @@ char readCharacter(){
         
         // Snap to end of line
         if (cursorPos.y > 0 && cursorPos.y <= screenrows +1 && fromOpenedFile && cursorPos.y + rowOffset < openedFileLines) {
-          int currentRowEnd = toRenderToScreen[cursorPos.y + rowOffset -1].size  + 1;
+          int currentRowEnd = lineWidth(&toRenderToScreen[cursorPos.y + rowOffset -1])  + 1;
             if (cursorPos.x + colOffset > currentRowEnd){
               cursorPos.x = currentRowEnd ;
               colOffset = 0;
@@ -420,44 +450,44 @@ char readCharacter(){
         else
             return readCharacter();
     }
+    PERF_END(perf_input);
     return c;
 }
 
 // Updates the location of the blinking cursor
 void repositionCursor(){
-    struct outputBuffer oBuf = {NULL, 0, NULL};
+    struct outputBuffer oBuf = {NULL, 0, 0, NULL};
     appendToBuffer(&oBuf, HIDE_CURSOR);
-    appendreposCursorSequence(&oBuf, cursorPos.x, cursorPos.y);
+    struct pos cursor = cursorPos;
+    if (rowsMapped())
+        wrapCursor(&cursor.x, &cursor.y);
+    screenMoveCursor(&oBuf, cursor.x, screenOrigin + cursor.y);
     appendToBuffer(&oBuf, SHOW_CURSOR);
     terminalOut(oBuf.buf, oBuf.size);
-    free(oBuf.buf);
+    memFree(mem_frames, oBuf.buf);
 }
 
 // Processes the input keys (key press event handler)
 void processKey(){
     static int quit_conf = 1;
     char c = readCharacter(); // input character
+    TRACE_BEGIN(trace_processKey);
+    PERF_BEGIN(perf_edit);
     switch (c) {
         case controlKey('q'): // quit
-            if (fileModified && quit_conf > 0){
-                loadStatusMessage("Alert!!! There are unsaved changes. "
+            if (documentsModified() && quit_conf > 0){
+                loadStatusMessage("Alert!!! There are unsaved changes in %d document(s). "
                                   "Save using ctrl+s "
-                                  "or quit with ctrl+q again");
+                                  "or quit with ctrl+q again", documentsModified());
                 quit_conf--;
+                TRACE_END(trace_processKey);
                 return; // allow for a confirmation message. Repeat the action again to quit
             }
             // Begin clean up
             terminalOut(CL_SCREEN_ALL);
             terminalOut(REPOS_CURSOR_TOP_LEFT);
-            for (int i = 0; i < openedFileLines; i++ ){
-                free(fromOpenedFile[i].buf);
-                free(toRenderToScreen[i].buf);
-                free(toRenderToScreen[i].state);
-            }
-            free(fromOpenedFile);
-            free(toRenderToScreen);
-            
-            free(filename);
+            findStop();
+            closeDocuments();
             exit(0); // return will not exit the application
             break;
         
@@ -468,9 +498,38 @@ void processKey(){
         case controlKey('f'): // find
             search();
             break;
+
+        case controlKey('g'): // go to a line
+            goToLine();
+            break;
+
+        case controlKey('r'): // replace
+            replaceAll();
+            break;
+
+        case controlKey('e'): // sort, deduplicate, reverse or filter lines
+            lineCommand();
+            break;
+
+        case controlKey('a'): // find in the files under the current directory
+            findInFiles();
+            break;
+
+        case controlKey('z'): // undo
+            undo();
+            break;
+
+        case controlKey('y'): // redo
+            redo();
+            break;
+
+        case controlKey('p'): // performance overlay
+            perfOverlay = !perfOverlay;
+            loadStatusMessage(""); // make room for the overlay
+            break;
             
         case '\r': // Enter key
-            if (awaitingArrow == 0)
+            if (awaitingArrow == 0 && !findOpenResult()) // in the results of find in files, opens the one at the cursor
                 insertLine();
             break;
             
@@ -479,8 +538,46 @@ void processKey(){
             deleteChar();
             break;
             
+        case controlKey('t'): // memory overlay
+            memOverlay = !memOverlay;
+            loadStatusMessage(""); // make room for the overlay
+            break;
+            
+        case controlKey('w'): // soft wrap
+            wrapToggle();
+            break;
+            
+        case controlKey('k'): // fold or open the block at the cursor
+            foldToggle();
+            break;
+            
+        case controlKey('o'): // fold every block, or open every fold
+            foldAll();
+            break;
+            
+        case controlKey('b'): // open a file in a document of its own
+            documentPrompt();
+            break;
+            
+        case controlKey('n'): // the next document
+            documentNext();
+            break;
+            
+        case controlKey('x'): // split the pane
+            paneSplit();
+            break;
+            
+        case controlKey('v'): // the next pane
+            paneNext();
+            break;
+            
+        case controlKey('d'): // close the pane
+            paneClose();
+            break;
+            
         case controlKey('l'):   // traditionally used to refresh the screen
-            // Do nothing
+            screenInvalidate();
+            break;
         case '\x1b':            // Escape key
             // Do nothing
             break;
@@ -492,56 +589,156 @@ void processKey(){
             insertChar(c);
             break;
     };
+    PERF_END(perf_edit);
+    TRACE_END(trace_processKey);
     quit_conf = 1;
 }
 
 // Creates a welcome title to display when there is no file loaded
-void loadTitle(struct outputBuffer* oBuf){
+void loadTitle(){
     const char* title = "Welcome. feel free to type."
-                  " Press \"ctr+q\" to quit\r\n";
-    int len = (strlen(title) > screencols) ? screencols : strlen(title);
+                  " Press \"ctr+q\" to quit";
+    int len = ((int) strlen(title) > screencols) ? screencols : (int) strlen(title);
     int paddingLen = (screencols - len ) / 2;
-    char padding [paddingLen];
-    for (int i = 0; i < paddingLen; i++)
-        padding[i] = ' ';
-    appendToBuffer(oBuf, padding, paddingLen);
-    appendToBuffer(oBuf, title, len);
+    screenPut(0, paddingLen, title, NULL, len, attr_none);
+}
+
+// composes a row of a line holding characters outside of ASCII, whose bytes are not its columns
+// the characters from column 'first' are written, then the spans are colored at the columns of their bytes
+static void loadWideRow(int y, struct outputBuffer* line, int first, int pos){
+    static int* cols = NULL; // column of each byte on the screen, and of the byte after them
+    static int colsSize = 0;
+    int i = 0;
+    int col = 0;
+    while (i < line->size && col < first){ // a wide character cut by the left edge is left out
+        int codepoint;
+        int length = utf8Decode(&line->buf[i], line->size - i, &codepoint);
+        col += utf8Width(codepoint);
+        i += length;
+    }
+    int start = i;
+    int startCol = col;
+    for (int pass = 0; pass < 2; pass++){ // measures, then maps the bytes to their columns
+        i = start;
+        col = startCol;
+        while (i < line->size && col < first + screencols){
+            int codepoint;
+            int length = utf8Decode(&line->buf[i], line->size - i, &codepoint);
+            for (int k = 0; pass && k < length; k++)
+                cols[i - start + k] = col;
+            col += utf8Width(codepoint);
+            i += length;
+        }
+        if (pass == 0 && i - start + 1 > colsSize){
+            int* grown = memRealloc(mem_render, cols, sizeof(int) * (i - start + 1));
+            if (!grown)
+                failExit("Could not render a line");
+            cols = grown;
+            colsSize = i - start + 1;
+        }
+    }
+    int end = i;
+    cols[end - start] = col;
+    if (end == start)
+        return;
+    screenPut(y, startCol - first, line->buf + start, NULL, end - start, attr_none);
+    for (struct highlightSpan* span = line->spans; span && span->length; span++){
+        int from = span->start > start ? span->start : start;
+        int to = span->start + span->length < end ? span->start + span->length : end;
+        if (from < to)
+            screenSetState(y, cols[from - start] - first, cols[to - start] - cols[from - start], span->state);
+    }
+    if (searchMatch.line == pos){
+        int from = searchMatch.start > start ? searchMatch.start : start;
+        int to = searchMatch.start + searchMatch.length < end ? searchMatch.start + searchMatch.length : end;
+        if (from < to)
+            screenSetState(y, cols[from - start] - first, cols[to - start] - cols[from - start], highlight_match);
+    }
+}
+
+// composes a single screen row (0 based) showing the given line of the file from column 'first'
+// the text is written first, then colored by the line's highlight spans and the search match
+static void loadLine(int y, int pos, int first){
+    if (pos < openedFileLines) { // display file contents within the available space
+        struct outputBuffer* line = &toRenderToScreen[pos];
+        if (isPendingLine(line))
+            updateStatus(line); // loaded with the open cache, the line is highlighted now that it is seen
+        if (isLongLine(&fromOpenedFile[pos])){ // only the columns on the screen are rendered
+            line = longLineWindow(longLineOf(&fromOpenedFile[pos]), first, screencols);
+            first = 0;
+            if (!utf8IsAscii(line->buf, line->size)) // a long line is shown a byte a column
+                for (int i = 0; i < line->size; i++)
+                    if (line->buf[i] & 0x80)
+                        line->buf[i] = '?';
+        }
+        else if (!utf8IsAscii(line->buf, line->size)){
+            loadWideRow(y, line, first, pos);
+            return;
+        }
+        int len = (line->size  - first > screencols)
+                    ? (screencols)  :  (line->size - first);
+        if (len > 0){
+            screenPut(y, 0, line->buf + first, NULL, len, attr_none);
+            for (struct highlightSpan* span = line->spans; span && span->length; span++)
+                if (span->start + span->length > first && span->start < first + len)
+                    screenSetState(y, span->start - first, span->length, span->state);
+            if (searchMatch.line == pos)
+                screenSetState(y, searchMatch.start - first, searchMatch.length, highlight_match);
+        }
+    }
+    else //  no file (left) to load
+        screenPut(y, 0, "~", NULL, 1, attr_none);
 }
 
-// appends the contents of a file or the lack of file to the output buffer
+// composes a single screen row (0 based) showing the given line of the file, scrolled by colOffset
+void loadRow(int y, int pos){
+    loadLine(y, pos, colOffset);
+}
+
+// composes the contents of a file or the lack of file from screen row 'top' downwards
 // This is required every time we refresh the screen
-void loadRows(struct outputBuffer* oBuf, int delta){
+void loadRows(int top){
+    TRACE_BEGIN(trace_loadRows);
     scroll(); // updates the cursor position to where it needs to be
-    for (int y = 0; y <= screenrows + delta - 1; y++) // load only the size of the screen and ...
-        if (y + rowOffset < openedFileLines) { // display file contents within the available space
-            int pos = y + rowOffset;
-            int len = (fromOpenedFile[pos].size  - colOffset > screencols)
-                        ? (screencols)  :  (fromOpenedFile[pos].size - colOffset);
-            
-            if (len > 0){
-                char *line = fromOpenedFile[pos].buf + colOffset;
-                unsigned char* lineStatus = &toRenderToScreen[pos].state[colOffset];
-                for (int i = 0; i < len; i++)
-                    appendWithColor(oBuf, &line[i], 1, lineStatus[i]);
-                // after printing the line to the buffer
-                appendToBuffer(oBuf, CL_DEFAULT_COLOR); // Reset to the default colors
+    if (rowsMapped() && openedFileLines > 0){ // each line over as many rows as it takes, none when folded
+        int line = rowOffset;
+        int first = softWrap ? 0 : colOffset;
+        for (int y = top; y < screenrows; y++){
+            loadLine(y, line, first);
+            if (line >= openedFileLines){
+                line++;
+                continue;
             }
-
-            appendToBuffer(oBuf, "\r\n", 2);
-             
-        }
-        else { //  no file (left) to load
-            if (y < screenrows + delta){
-                appendToBuffer(oBuf, "~", 1);
-                appendToBuffer(oBuf, "\r\n", 2);
+            int width = lineWidth(&toRenderToScreen[line]);
+            if (softWrap && first + screencols < width){
+                first += screencols;
+                continue;
+            }
+            if (foldCount && foldHidden(line)){ // after the text of the line the fold begins on
+                char marker[32];
+                int length = snprintf(marker, sizeof(marker), " ... %d line%s", foldHidden(line), foldHidden(line) > 1 ? "s" : "");
+                int x = width - first + 1;
+                if (x < 0)
+                    x = 0;
+                if (x + length > screencols)
+                    length = screencols - x;
+                if (length > 0)
+                    screenPut(y, x, marker, NULL, length, attr_invert);
             }
+            line = foldNext(line);
+            first = softWrap ? 0 : colOffset;
         }
+        TRACE_END(trace_loadRows);
+        return;
+    }
+    for (int y = top; y < screenrows; y++) // load only the size of the screen
+        loadRow(y, y - top + rowOffset);
+    TRACE_END(trace_loadRows);
 }
 
-// Prepares to render a stutus bar which is appended to the end of the output buffer
+// Prepares to render a stutus bar which is composed below the rows of the file
 // this will be at the bottom two lines of the screen
-void loadStatusBar(struct outputBuffer* oBuf){
-    appendToBuffer(oBuf, CL_INVERT_COLOR);
+void loadStatusBar(){
     char status[80], rstatus[80];
     const char* modifiedStatus = fileModified ? "*modified" : "";
     int width = snprintf(status, sizeof(status),
@@ -554,28 +751,39 @@ void loadStatusBar(struct outputBuffer* oBuf){
                           (openedFileFlags) ? openedFileFlags->filetype : "(unknown filetype)",
                           cursorPos.y + rowOffset,
                           openedFileLines);
+    char budget[40], withBudget[sizeof(budget) + sizeof(rstatus)];
+    int budgetWidth = documentsStatusString(budget, sizeof(budget)); // with several documents, when there is room (see spill.c)
+    if (budgetWidth && width + budgetWidth + 3 + rwidth <= screencols){
+        rwidth = snprintf(withBudget, sizeof(withBudget), "%s | %s", budget, rstatus);
+        memcpy(rstatus, withBudget, sizeof(rstatus));
+        if (rwidth >= (int) sizeof(rstatus))
+            rwidth = sizeof(rstatus) - 1;
+    }
     if (width > screencols)
         width = screencols;
-    appendToBuffer(oBuf, status, width);
-    for (; width < screencols; width++){
-        if (screencols - width == rwidth) {
-            appendToBuffer(oBuf, rstatus, rwidth);
-            break;
-        }
-        else // add space so as to align rstatus to the right
-            appendToBuffer(oBuf, " ", 1);
-    }
-    appendToBuffer(oBuf, CL_FMT_CLEAR);
-    appendToBuffer(oBuf, "\r\n", 2);
+    screenFill(screenrows, 0, attr_invert);
+    screenPut(screenrows, 0, status, NULL, width, attr_invert);
+    if (width + rwidth <= screencols) // align rstatus to the right
+        screenPut(screenrows, screencols - rwidth, rstatus, NULL, rwidth, attr_invert);
     
     // Next Line
-    // status message
-    appendToBuffer(oBuf, CL_LINE_RIGHT_OF_CURSOR); // clear previous status message
+    // status message, on the last row of the screen below every pane
+    int message = screenHeight - 1 - screenOrigin;
     int msgSize = strlen(statusmsg);
     if (msgSize > screencols)
         msgSize = screencols;
     if (msgSize && time(NULL) - statusmsg_time < 7)// display message (for 7 seconds)
-        appendToBuffer(oBuf, statusmsg, msgSize);
+        screenPut(message, 0, statusmsg, NULL, msgSize, attr_none);
+    else if (memOverlay){
+        char overlay[320];
+        int len = memOverlayString(overlay, sizeof(overlay));
+        screenPut(message, 0, overlay, NULL, len, attr_none);
+    }
+    else if (perfOverlay){
+        char overlay[160];
+        int len = perfOverlayString(overlay, sizeof(overlay));
+        screenPut(message, 0, overlay, NULL, len, attr_none);
+    }
 }
 
 // process a status message and prepares it for output
@@ -591,7 +799,7 @@ void loadStatusMessage(const char *fmt, ...){
 // during this process, this will run a function that has been passed as a parameter
 char* userPrompt(char* message, void (*func)(char* str, int key)){
     size_t inputSize = 128;
-    char* input = malloc(inputSize);
+    char* input = memAlloc(mem_misc, inputSize);
     input[0] = '\0';
     size_t len = 0;
     
@@ -607,12 +815,12 @@ char* userPrompt(char* message, void (*func)(char* str, int key)){
             loadStatusMessage("");
             if (func)
                 func(input, charIn);
-            free(input);
+            memFree(mem_misc, input);
             return NULL;
         }
         else if ( charIn == (controlKey('h') )|| charIn == 127){ // Backspace
             if (len != 0){
-                len--;
+                len = utf8Previous(input, len);
                 input[len] = '\0';
             }
         }
@@ -625,10 +833,10 @@ char* userPrompt(char* message, void (*func)(char* str, int key)){
                 return input;
             }
         }
-        else if (!iscntrl(charIn) && charIn < 128){
+        else if (!iscntrl((unsigned char) charIn) && charIn != 0){ // the bytes of a UTF-8 character come one at a time
             if (len == inputSize - 1){
                 inputSize *= 2;
-                input = realloc(input, inputSize);
+                input = memRealloc(mem_misc, input, inputSize);
             }
             input[len++] = charIn;
             input[len] = '\0';
@@ -646,17 +854,24 @@ void scroll() {
     // rowOffset = top of screen
     // screenrows = size of screen
     
-    // Up
-    if (cursorPos.y < rowOffset && cursorPos.y == 0) {
-        --rowOffset; // cursor is above window, need to scroll up
+    // rows are not lines one for one, the screen follows the cursor in wrapScroll() below
+    if (rowsMapped()){
+        if (cursorPos.y + rowOffset < 1)
+            cursorPos.y = 1 - rowOffset;
     }
-    if (cursorPos.y <= 1)
-        cursorPos.y = 1; // return cursorPos to within screen range, deliberately skip 1 for visual smoothness of scrolling
-    
-    // Down
-    else if (cursorPos.y > screenrows ){ // cursor is below window,  need to scroll down
-        rowOffset = cursorPos.y - screenrows;
-        cursorPos.y = screenrows; // return cursorPos to within screen range
+    else {
+        // Up
+        if (cursorPos.y < rowOffset && cursorPos.y == 0) {
+            --rowOffset; // cursor is above window, need to scroll up
+        }
+        if (cursorPos.y <= 1)
+            cursorPos.y = 1; // return cursorPos to within screen range, deliberately skip 1 for visual smoothness of scrolling
+        
+        // Down
+        else if (cursorPos.y > screenrows ){ // cursor is below window,  need to scroll down
+            rowOffset = cursorPos.y - screenrows;
+            cursorPos.y = screenrows; // return cursorPos to within screen range
+        }
     }
     
     // HORIZONTAL SCROLLING
@@ -670,28 +885,44 @@ void scroll() {
     // Consider tabs
     struct outputBuffer* line = &fromOpenedFile[cursorPos.y + rowOffset - 1];
     cursorPos.x = addTabs(line, cursorPos.x);
-    
-    repositionCursor();
+    if (rowsMapped())
+        wrapScroll(); // the rows of the lines above may push the cursor off the screen
 }
 
 // the output buffer and the render to screen buffer are not equal
 // tab keys are converted to spaces in the screen buffer
 // this function interprets an index without any conversions from the original output buffer
+// a position past the end of the line is taken as the end of the line
+// a position within a tab or a wide character is taken as the character after it
 int zeroTabs(struct outputBuffer* line, int* xPos){
+    if (isLongLine(line))
+        return longLineZeroTabs(longLineOf(line), xPos);
     int i = 0;
     
     int idx = 0;
-    while ( idx < *xPos - 1) {
+    while ( idx < *xPos - 1 && i < line->size) {
         if (line->buf[i] == '\t') {
             idx++;
             while (idx % TAB_SPACES != 0)
                 idx++;
         }
+        else if (line->buf[i] & 0x80) { // a UTF-8 sequence, the index stays on the first byte of a character
+            int codepoint;
+            i += utf8Decode(&line->buf[i], line->size - i, &codepoint) - 1;
+            idx += utf8Width(codepoint);
+        }
         else
             idx++;
         // End of loop
         i++; // increment
     }
+    while (i < line->size && (line->buf[i] & 0x80)) { // characters drawn over the one before
+        int codepoint;
+        int length = utf8Decode(&line->buf[i], line->size - i, &codepoint);
+        if (utf8Width(codepoint) != 0)
+            break;
+        i += length;
+    }
 
     *xPos = i + 1;
     return idx + 1;;
@@ -715,10 +946,54 @@ int subtractTabs(struct outputBuffer* line, int xPos){
     return xPos;
 }
 
-// opens a file
+// Returns the rendered column (0 based) of the character at index pos of the line
+int lineColumn(struct outputBuffer* line, int pos){
+    if (pos > line->size)
+        pos = line->size;
+    if (isLongLine(line))
+        return longLineColumn(longLineOf(line), pos);
+    int col = 0;
+    for (int i = 0; i < pos; ){
+        if (line->buf[i] == '\t'){
+            col++;
+            while (col % TAB_SPACES != 0)
+                col++;
+            i++;
+        }
+        else if (line->buf[i] & 0x80){
+            int codepoint;
+            i += utf8Decode(&line->buf[i], line->size - i, &codepoint);
+            col += utf8Width(codepoint);
+        }
+        else {
+            col++;
+            i++;
+        }
+    }
+    return col;
+}
+
+// opens a file, '-' reads the standard input
 void openFile(char* file) {
-    free(filename);
-    filename = strdup(file);
+    TRACE_BEGIN(trace_openFile);
+    memFree(mem_misc, filename);
+    filename = NULL;
+    struct stat st;
+    if (!strcmp(file, "-") || (stat(file, &st) == 0 && S_ISFIFO(st.st_mode))){
+        // a pipe is read as it is written to and has no name to be saved to
+        int descriptor = strcmp(file, "-") ? open(file, O_RDONLY) : STDIN_FILENO;
+        if (descriptor == -1)
+            failExit("Could not open file");
+        detectFileType();
+        openStream(descriptor, NULL);
+        lastArrow = 0;
+        awaitingArrow = 0;
+        TRACE_END(trace_openFile);
+        return;
+    }
+    filename = memStrdup(mem_misc, file);
+    unwatchFile();
+    cacheLoad(file);
     FILE* f = fopen(file, "r");
     if (!f)
         failExit("Could not open file");
@@ -727,18 +1002,89 @@ void openFile(char* file) {
     char *line = NULL;
     size_t size = 0;
     int readCount;
+    int recording = undoRecording;
+    undoRecording = 0; // what the file holds is not an edit
     while ((readCount = getline(&line, &size, f))!= -1) {
+        int rawCount = readCount;
         while (readCount > 0 && (line[readCount - 1] == '\n'
                 || line[readCount - 1] == '\r') )
             readCount--;
                
         insertNewLine(openedFileLines,  line, readCount);
+        diskLine(line, readCount, rawCount);
     }
     free(line);
     fclose(f);
+    undoRecording = recording;
+    watchFile(file);
+    cacheApply();
+    trimLineTables();
     fileModified = 0;
+    undoClear();
     lastArrow = 0;
     awaitingArrow = 0;
+    TRACE_END(trace_openFile);
+}
+
+// opens a file and keeps adding the lines appended to it, as 'tail -f' does
+void followFile(char* file){
+    TRACE_BEGIN(trace_openFile);
+    memFree(mem_misc, filename);
+    filename = memStrdup(mem_misc, file);
+    int descriptor = open(file, O_RDONLY);
+    if (descriptor == -1)
+        failExit("Could not open file");
+    detectFileType();
+    openStream(descriptor, file);
+    lastArrow = 0;
+    awaitingArrow = 0;
+    TRACE_END(trace_openFile);
+}
+
+// the document is loaded, give back the room the line tables grew into
+void trimLineTables(){
+    if (openedFileLines > 0 && openedFileLines < openedFileCapacity){
+        struct outputBuffer* from = memRealloc(mem_tables, fromOpenedFile, sizeof(struct outputBuffer) * openedFileLines);
+        struct outputBuffer* render = memRealloc(mem_tables, toRenderToScreen, sizeof(struct outputBuffer) * openedFileLines);
+        if (from && render){
+            fromOpenedFile = from;
+            toRenderToScreen = render;
+            openedFileCapacity = openedFileLines;
+        }
+    }
+}
+
+// Lets go of every line of the document
+void closeDocument(){
+    cacheSave();
+    closeStream();
+    unwatchFile();
+    lineIndexFree();
+    wrapFree();
+    foldFree();
+    undoClear();
+    freeLines();
+}
+
+// Lets go of the text and the rendering of every line, and of the line tables
+// only the lines of large blocks are freed one by one, the slabs holding the rest are freed whole
+void freeLines(){
+    for (int i = 0; i < openedFileLines; i++ ){
+        if (isLongLine(&fromOpenedFile[i]))
+            longLineFree(longLineOf(&fromOpenedFile[i]));
+        else if (fromOpenedFile[i].capacity > SLAB_MAX)
+            lineFree(mem_lines, fromOpenedFile[i].buf, fromOpenedFile[i].capacity);
+        if (toRenderToScreen[i].capacity > SLAB_MAX)
+            lineFree(mem_render, toRenderToScreen[i].buf, toRenderToScreen[i].capacity);
+    }
+    lineFreeAll(mem_lines);
+    lineFreeAll(mem_render);
+    memFree(mem_tables, fromOpenedFile);
+    memFree(mem_tables, toRenderToScreen);
+    fromOpenedFile = NULL;
+    toRenderToScreen = NULL;
+    openedFileLines = 0;
+    openedFileCapacity = 0;
 }
 
 // Detects the file type of the file which has been openeed
@@ -762,25 +1108,67 @@ void detectFileType(){
     }
 }
 
-// Adds any live changes by the user to the output buffer
-void updateBuffer(struct outputBuffer* dest, struct outputBuffer* src){
+// Keeps a line of LONG_LINE_MIN characters or more in chunks
+// and gives a long line which has shrunk to well below that a single block again
+static void settleLine(struct outputBuffer* line){
+    if (!isLongLine(line) && line->size >= LONG_LINE_MIN){
+        struct longLine* ll = longLineCreate(line->buf, line->size);
+        lineFree(mem_lines, line->buf, line->capacity);
+        line->buf = (char*) ll;
+        line->capacity = LONG_LINE;
+    }
+    else if (isLongLine(line) && line->size < LONG_LINE_MIN / 2){
+        struct longLine* ll = longLineOf(line);
+        line->buf = NULL;
+        line->capacity = 0;
+        lineReserve(mem_lines, line, line->size + 1);
+        longLineCopy(ll, line->buf);
+        line->buf[line->size] = '\0';
+        longLineFree(ll);
+    }
+}
+
+// the rendered line's block holds its text, the columns it takes on the screen, then its spans, aligned for their ints
+#define widthOffset(size) (((size) + sizeof(int)) / sizeof(int) * sizeof(int))
+#define spanOffset(size) (widthOffset(size) + sizeof(int))
+
+// Columns the rendered line takes on the screen, as many as its bytes unless it holds characters outside of ASCII
+int lineWidth(const struct outputBuffer* line){
+    if (line->buf == NULL) // a long line's, which keeps its width as its size
+        return line->size;
+    return *(const int*) &line->buf[widthOffset(line->size)];
+}
+
+// Renders the text of a line which is not a long line: tabs to spaces, followed by the columns it takes
+// an ASCII line is copied a byte a column, any other is decoded to count the columns of its characters
+static void renderText(struct outputBuffer* dest, struct outputBuffer* src){
     // Searching for tabs
     int tabs = 0;
     for (int i = 0; i < src->size; i++)
         if (src->buf[i] == '\t')
             tabs++;
     
-    // allocate extra space
-    free(dest->buf);
-    dest->buf = malloc(src->size + tabs * (TAB_SPACES - 1) + 1); // + 1 is to make space for null
+    // allocate extra space, updateStatus() makes room for the highlight spans after the text and its width
+    int size = spanOffset(src->size + tabs * (TAB_SPACES - 1));
+    if (size > dest->capacity){
+        lineFree(mem_render, dest->buf, dest->capacity);
+        dest->capacity = lineCapacity(size);
+        dest->buf = lineAlloc(mem_render, dest->capacity);
+        if (!dest->buf)
+            failExit("Could not allocate a line");
+    }
+    dest->spans = NULL;
     
     // Append
-    if (tabs == 0){
+    int width;
+    int ascii = utf8IsAscii(src->buf, src->size);
+    if (tabs == 0 && ascii){
         memcpy( dest->buf, src->buf, src->size); // no tabs to render
         dest->buf[src->size] = '\0';
         dest->size = src->size;
+        width = src->size;
     }
-    else {
+    else if (ascii){
         int idx = 0;
         for (int i = 0; i < src->size; i++) {
             if (src->buf[i] == '\t') {
@@ -792,55 +1180,163 @@ void updateBuffer(struct outputBuffer* dest, struct outputBuffer* src){
         }
         dest->buf[idx] = '\0';
         dest->size = idx;
-        
+        width = idx;
+    }
+    else {
+        int idx = 0;
+        width = 0;
+        for (int i = 0; i < src->size; ) {
+            if (src->buf[i] == '\t') { // up to the next tab stop in columns
+                dest->buf[idx++] = ' ';
+                width++;
+                while (width % TAB_SPACES != 0){
+                    dest->buf[idx++] = ' ';
+                    width++;
+                }
+                i++;
+                continue;
+            }
+            int codepoint;
+            int length = utf8Decode(&src->buf[i], src->size - i, &codepoint);
+            memcpy(&dest->buf[idx], &src->buf[i], length);
+            idx += length;
+            i += length;
+            width += utf8Width(codepoint);
+        }
+        dest->buf[idx] = '\0';
+        dest->size = idx;
+    }
+    *(int*) &dest->buf[widthOffset(dest->size)] = width;
+}
+
+// Adds any live changes by the user to the output buffer
+// a long line is not rendered here, only the columns on the screen are when they are drawn (see loadRow())
+void updateBuffer(struct outputBuffer* dest, struct outputBuffer* src){
+    lineIndexFrom(src - fromOpenedFile);
+    settleLine(src);
+    if (isLongLine(src)){
+        lineFree(mem_render, dest->buf, dest->capacity);
+        dest->buf = NULL;
+        dest->capacity = 0;
+        dest->spans = NULL;
+        dest->size = longLineOf(src)->width;
+        wrapLineChanged(src - fromOpenedFile);
+        PERF_BEGIN(perf_highlight);
+        updateStatus(dest);
+        PERF_END(perf_highlight);
+        return;
     }
+    renderText(dest, src);
+    wrapLineChanged(src - fromOpenedFile);
+    PERF_BEGIN(perf_highlight);
     updateStatus(dest);
+    PERF_END(perf_highlight);
+}
+
+
+// Re-highlights every line of the document
+// the document has changed, so the search match is let go of
+void updateAllStatus(){
+    searchMatch.line = -1;
+    PERF_BEGIN(perf_highlight);
+    for(int i = 0; i < openedFileLines; i++)
+        updateStatus(&toRenderToScreen[i]);
+    PERF_END(perf_highlight);
 }
 
 #define isWhiteSpace(c) ( isspace(c) || c == '\0' || strchr(",.()+-/*=~%<>[];", c) != NULL)
-// Updates the state of the editor flags for each and every character of the current line passed as a parameter - this adjust the flags to the appropriate mode of output
-// Purpose is to allow the outputed text or the backgound to be changed to a custom color
-void updateStatus(struct outputBuffer* line){
-    line->state = realloc(line->state, line->size);
-    memset(line->state,  normal, line->size);
+
+// Returns the end of the run of equal states which begins at i
+static int runEnd(const unsigned char* state, int size, int i){
+    int end = i + 1;
+    while (end < size && state[end] == state[i] && end - i < SPAN_MAX_LENGTH)
+        end++;
+    return end;
+}
+
+// Stores the runs of highlighted characters in state as the spans of the line
+// the span ending the list holds what carries over to the next line (see exitState())
+void storeSpans(struct outputBuffer* line, const unsigned char* state, unsigned char exit){
+    int count = 0;
+    for (int i = 0; i < line->size; i = runEnd(state, line->size, i))
+        if (state[i] != normal)
+            count++;
+    line->spans = NULL;
+    if (count == 0 && exit == normal)
+        return;
     
+    int offset = spanOffset(line->size);
+    lineReserve(mem_render, line, offset + (count + 1) * sizeof(struct highlightSpan));
+    struct highlightSpan* span = (struct highlightSpan*) &line->buf[offset];
+    line->spans = span;
+    for (int i = 0; i < line->size; i = runEnd(state, line->size, i)){
+        if (state[i] != normal){
+            span->start = i;
+            span->length = runEnd(state, line->size, i) - i;
+            span->state = state[i];
+            span++;
+        }
+    }
+    span->start = line->size;
+    span->length = 0;
+    span->state = exit;
+}
+
+// Keeps only the state the line ends in, known from the open cache, the line is highlighted once it is drawn (see loadRow())
+static void storePending(struct outputBuffer* line, unsigned char exit){
+    int offset = spanOffset(line->size);
+    lineReserve(mem_render, line, offset + sizeof(struct highlightSpan));
+    line->spans = (struct highlightSpan*) &line->buf[offset];
+    line->spans->start = line->size;
+    line->spans->length = 0;
+    line->spans->state = exit | exit_pending;
+}
+
+// Works out the highlight state of each of the 'size' characters of text, starting from the state in hs
+// text can be read up to 'limit' characters (limit >= size), which is where a keyword or a comment
+// which begins in the first 'size' characters may end. state must have room for 'limit' characters.
+// On return hs holds the state after the text, carry counts the characters past 'size' which have already been colored
+void highlightText(const char* text, int size, int limit, struct highlightState* hs, unsigned char* state){
+    memset(state,  normal, limit);
     if (openedFileFlags == NULL)
         return;
+    if (hs->lineComment){
+        memset(state, highlight_comment, size);
+        return;
+    }
     
-    int i = 0;
-    static int isQuote = 0; // boolean, flags a change the color of quoted text
-    static int isComment = 0; // 33for changing the color of comments
-    int prev_whiteSp = 1; // for recognizing the beginning and end of a non white space char
+    int i = hs->carry; // characters already colored at the end of the previous text
+    memset(state, hs->carryState, i);
+    int isQuote = hs->quote; // flags a change the color of quoted text, holds the quote character
+    int isComment = hs->comment; // for changing the color of comments
+    int prev_whiteSp = hs->prevWhite; // for recognizing the beginning and end of a non white space char
     
-    if (&toRenderToScreen[0] == line){ // Each render of the first line requires that we
-        isQuote = 0; // Requires a reset of the
-        isComment = 0; // and isComment
-    }
-    while ( i < line->size){
+    while ( i < size){
         
         // Check for comments and shade comments appropriately
         if (openedFileFlags->flags & highlight_comment){
-            if (!isQuote && !strncmp( &line->buf[i], "//", 2 )){
-                memset(&line->state[i], highlight_comment, line->size);
-                i = line->size -1;
+            if (!isQuote && !strncmp( &text[i], "//", 2 )){
+                memset(&state[i], highlight_comment, size - i);
+                hs->lineComment = 1;
+                i = size;
                 break;
             }
             if (isComment && !isQuote){
-                if (!strncmp( &line->buf[i], "*/", 2 )){
-                    memset(&line->state[i], highlight_comment, 2);
+                if (!strncmp( &text[i], "*/", 2 )){
+                    memset(&state[i], highlight_comment, 2);
                     i += 2;
                     isComment = 0;
                     prev_whiteSp = 1;
                     continue;
                 }
                 else {
-                    line->state[i] = highlight_comment;
+                    state[i] = highlight_comment;
                     i++;
                     continue;
                 }
             }
-            if (!isComment && !isQuote && !strncmp( &line->buf[i], "/*", 2)){
-                memset(&line->state[i], highlight_comment, 2);
+            if (!isComment && !isQuote && !strncmp( &text[i], "/*", 2)){
+                memset(&state[i], highlight_comment, 2);
                 i += 2;
                 isComment = 1;
                 continue;
@@ -848,11 +1344,11 @@ void updateStatus(struct outputBuffer* line){
         }
         // Check for string literals and shade them appropriately
         if (openedFileFlags->flags & highlight_string){
-            char c = line->buf[i];
+            char c = text[i];
             if (isQuote){
-                line->state[i] = highlight_string;
-                if (c == '\\' && i + 1 < line->size) {
-                    line->state[i + 1] = highlight_string;
+                state[i] = highlight_string;
+                if (c == '\\' && i + 1 < limit) {
+                    state[i + 1] = highlight_string;
                     i += 2;
                     continue;
                 }
@@ -863,7 +1359,7 @@ void updateStatus(struct outputBuffer* line){
             }
             else if (c == '"' || c == '\''){
                 isQuote = c;
-                line->state[i] = highlight_string;
+                state[i] = highlight_string;
                 i++;
                 continue;
             }
@@ -871,11 +1367,11 @@ void updateStatus(struct outputBuffer* line){
         }
         // Check for numerical literals and shade them appropriately
         if (openedFileFlags->flags & highlight_num)
-            if (isdigit(line->buf[i]))
-                line->state[i] = highlight_num;
+            if (isdigit(text[i]))
+                state[i] = highlight_num;
         
         // Check for keywords and shade them appropriately
-        if (prev_whiteSp){
+        if (prev_whiteSp && openedFileFlags->recognisedKeywords){
             int idx;
             for (idx = 0; openedFileFlags->recognisedKeywords[idx]; idx++) {
                 const char* key = openedFileFlags->recognisedKeywords[idx];
@@ -884,10 +1380,9 @@ void updateStatus(struct outputBuffer* line){
                 int key_regular = (key[length - 1] == '|');
                 if (key_regular)
                     length--;
-                char c = line->buf[i + length];
-                if ( !strncmp(&line->buf[i], key, length)
-                     &&  isWhiteSpace(c) )  {
-                    memset(&line->state[i], key_regular ? highlight_keyword_regular : highlight_keyword_strong, length);
+                if ( !strncmp(&text[i], key, length)
+                     &&  isWhiteSpace(text[i + length]) )  {
+                    memset(&state[i], key_regular ? highlight_keyword_regular : highlight_keyword_strong, length);
                     i += length;
                     break;
                 }
@@ -897,9 +1392,194 @@ void updateStatus(struct outputBuffer* line){
                     continue;
             }
         }
-        prev_whiteSp = isWhiteSpace(line->buf[i]);
+        prev_whiteSp = isWhiteSpace(text[i]);
         i++;
     }
+    hs->quote = isQuote;
+    hs->comment = isComment;
+    hs->prevWhite = prev_whiteSp;
+    hs->carry = i - size;
+    hs->carryState = hs->carry ? state[size] : normal;
+}
+
+// Returns the highlight state at the end of the given line, which is where the next line begins
+void lineExitState(int at, struct highlightState* hs){
+    memset(hs, 0, sizeof(*hs));
+    hs->prevWhite = 1;
+    if (at < 0 || at >= openedFileLines)
+        return;
+    unsigned char exit = normal;
+    if (isLongLine(&fromOpenedFile[at]))
+        exit = longLineOf(&fromOpenedFile[at])->exit;
+    else if (toRenderToScreen[at].spans){
+        struct highlightSpan* span = toRenderToScreen[at].spans;
+        while (span->length)
+            span++;
+        exit = span->state;
+    }
+    hs->comment = (exit & exit_comment) != 0;
+    hs->quote = (exit & exit_double_quote) ? '"' : (exit & exit_single_quote) ? '\'' : 0;
+}
+
+// Packs what carries over to the next line from the state at the end of a line
+unsigned char exitState(const struct highlightState* hs){
+    return (hs->comment ? exit_comment : 0) | (hs->quote == '"' ? exit_double_quote : 0)
+           | (hs->quote == '\'' ? exit_single_quote : 0);
+}
+
+// Updates the state of the editor flags for each and every character of the current line passed as a parameter - this adjust the flags to the appropriate mode of output
+// Purpose is to allow the outputed text or the backgound to be changed to a custom color
+// the line carries on from the state the previous line ended in (a line outside of the document starts afresh)
+// the states are worked out a character at a time in a scratch array shared by every line,
+// the line only keeps them as spans
+void updateStatus(struct outputBuffer* line){
+    int at = (toRenderToScreen && line >= toRenderToScreen && line < toRenderToScreen + openedFileLines)
+             ? line - toRenderToScreen : -1;
+    unsigned char cached;
+    if (batchMode){ // nothing is shown
+        if (!(at >= 0 && isLongLine(&fromOpenedFile[at])))
+            line->spans = NULL;
+        return;
+    }
+    if (at >= 0 && !isLongLine(&fromOpenedFile[at]) && cachedExitState(at, &cached)){
+        storePending(line, cached);
+        return;
+    }
+    TRACE_BEGIN(trace_updateStatus);
+    perfHighlightedLines++;
+    struct highlightState hs;
+    lineExitState(at - 1, &hs);
+    if (at >= 0 && isLongLine(&fromOpenedFile[at])){
+        longLineHighlight(longLineOf(&fromOpenedFile[at]), &hs);
+        TRACE_END(trace_updateStatus);
+        return;
+    }
+    
+    static unsigned char* state = NULL;
+    static int stateSize = 0;
+    if (line->size > stateSize){
+        unsigned char* grown = memRealloc(mem_render, state, line->size);
+        if (!grown)
+            failExit("Could not highlight the line");
+        state = grown;
+        stateSize = line->size;
+    }
+    highlightText(line->buf, line->size, line->size, &hs, state);
+    storeSpans(line, state, exitState(&hs));
+    TRACE_END(trace_updateStatus);
+}
+
+// Re-highlights the lines from 'at' onwards for as long as the state they begin in has changed
+// called after a line has been edited with the line below it
+void updateFollowingStatus(int at){
+    searchMatch.line = -1;
+    PERF_BEGIN(perf_highlight);
+    for (int i = at < 0 ? 0 : at; i < openedFileLines; i++){
+        struct highlightState before, after;
+        lineExitState(i, &before);
+        updateStatus(&toRenderToScreen[i]);
+        lineExitState(i, &after);
+        if (before.quote == after.quote && before.comment == after.comment)
+            break;
+    }
+    PERF_END(perf_highlight);
+}
+
+// Grows the line tables to hold at least the given number of lines
+// by half at a time so that loading a file moves them only a few times
+static void reserveRows(int lines){
+    if (lines <= openedFileCapacity)
+        return;
+    int capacity = openedFileCapacity ? openedFileCapacity + openedFileCapacity / 2 : 64;
+    if (capacity < lines)
+        capacity = lines;
+    struct outputBuffer* from = memRealloc(mem_tables, fromOpenedFile, sizeof(struct outputBuffer) * capacity);
+    struct outputBuffer* render = memRealloc(mem_tables, toRenderToScreen, sizeof(struct outputBuffer) * capacity);
+    if (from)
+        fromOpenedFile = from;
+    if (render)
+        toRenderToScreen = render;
+    if (!from || !render)
+        failExit("Could not allocate the lines");
+    openedFileCapacity = capacity;
+}
+
+// Fills the free slot at in the line tables, the lines above it must already be set
+static void setRow(int at, const char* stringLine, int readCount){
+    fromOpenedFile[at].buf = NULL;
+    fromOpenedFile[at].capacity = 0;
+    fromOpenedFile[at].spans = NULL; // leave blank
+    lineReserve(mem_lines, &fromOpenedFile[at], readCount + 1);
+    fromOpenedFile[at].size = readCount;
+    memcpy(fromOpenedFile[at].buf, stringLine, readCount);
+    fromOpenedFile[at].buf[readCount] = '\0';
+    
+    // Render tabs properly
+    toRenderToScreen[at].size = 0;
+    toRenderToScreen[at].capacity = 0;
+    toRenderToScreen[at].buf = NULL;
+    toRenderToScreen[at].spans = NULL;
+    updateBuffer(&toRenderToScreen[at], &fromOpenedFile[at]); // highlighted from the state the line above ends in
+}
+
+// Gives back the memory of a line, leaving its slot in the line tables
+static void freeRow(int at){
+    if (isLongLine(&fromOpenedFile[at]))
+        longLineFree(longLineOf(&fromOpenedFile[at]));
+    else
+        lineFree(mem_lines, fromOpenedFile[at].buf, fromOpenedFile[at].capacity);
+    lineFree(mem_render, toRenderToScreen[at].buf, toRenderToScreen[at].capacity);
+}
+
+// Lets go of the rendering of every line, keeping their text (see spill.c)
+// the window of a long line is rendered again when it is drawn
+void dropRendering(){
+    for (int i = 0; i < openedFileLines; i++){
+        if (isLongLine(&fromOpenedFile[i])){
+            struct longLine* ll = longLineOf(&fromOpenedFile[i]);
+            lineFree(mem_render, ll->window.buf, ll->window.capacity);
+            ll->window = (struct outputBuffer) {NULL, 0, 0, NULL};
+            ll->windowCol = -1;
+            continue;
+        }
+        if (toRenderToScreen[i].capacity > SLAB_MAX)
+            lineFree(mem_render, toRenderToScreen[i].buf, toRenderToScreen[i].capacity);
+        toRenderToScreen[i] = (struct outputBuffer) {NULL, 0, 0, NULL};
+    }
+    lineFreeAll(mem_render);
+}
+
+// Renders every line again after dropRendering(), each ends in the state in exits and is highlighted once it is drawn
+void restoreRendering(const unsigned char* exits){
+    for (int i = 0; i < openedFileLines; i++){
+        if (isLongLine(&fromOpenedFile[i]))
+            continue;
+        renderText(&toRenderToScreen[i], &fromOpenedFile[i]);
+        storePending(&toRenderToScreen[i], exits[i]);
+    }
+}
+
+// Adds back a line of a document whose lines have been let go of (see spill.c), at its end
+// it is not an edit, it ends in the state exit and is highlighted once it is drawn
+void restoreLine(const char* text, int size, unsigned char exit){
+    reserveRows(openedFileLines + 1);
+    int at = openedFileLines++;
+    struct outputBuffer* line = &fromOpenedFile[at];
+    *line = (struct outputBuffer) {NULL, 0, 0, NULL};
+    lineReserve(mem_lines, line, size + 1);
+    memcpy(line->buf, text, size);
+    line->buf[size] = '\0';
+    line->size = size;
+    settleLine(line);
+    toRenderToScreen[at] = (struct outputBuffer) {NULL, 0, 0, NULL};
+    if (isLongLine(line)){ // highlights itself from the line above
+        toRenderToScreen[at].size = longLineOf(line)->width;
+        updateStatus(&toRenderToScreen[at]);
+    }
+    else {
+        renderText(&toRenderToScreen[at], line);
+        storePending(&toRenderToScreen[at], exit);
+    }
 }
 
 // Appends a string to the end of the output buffer on a new line
@@ -908,34 +1588,156 @@ void insertNewLine(int at, char* stringLine, int readCount){
     if (at < 0 || at > openedFileLines)
         return;
     
-    // Reallocate memory to allow for enough space
-    fromOpenedFile = realloc(fromOpenedFile, sizeof(struct outputBuffer) * (openedFileLines + 1));
+    reserveRows(openedFileLines + 1);
     // shift contents to make room for insertion
-    if (at +1 < openedFileLines){
+    if (at < openedFileLines){
         memmove(&fromOpenedFile[at+1], &fromOpenedFile[at],
                 sizeof(struct outputBuffer) * (openedFileLines - at));
+        memmove(&toRenderToScreen[at+1], &toRenderToScreen[at],
+                sizeof(struct outputBuffer) * (openedFileLines - at));
     }
+    openedFileLines += 1;
+    foldLinesReplaced(at, 0, 1);
+    wrapLinesReplaced(at, 0, 1);
+    setRow(at, stringLine, readCount);
+    undoInsertedLine(at);
     
-    fromOpenedFile[at].size = readCount;
-    fromOpenedFile[at].buf = malloc(readCount + 1);
-    fromOpenedFile[at].state = NULL; // leave blank
-    memcpy(fromOpenedFile[at].buf, stringLine, readCount);
-    fromOpenedFile[at].buf[readCount] = '\0';
+    fileModified += 1;
+}
+
+// Replaces count lines from at with the lines of text, which are separated by '\n' as in a file
+// the line tables are moved once however many lines there are
+void replaceRows(int at, int count, const char* text, size_t size){
+    if (at < 0 || count < 0 || at + count > openedFileLines)
+        return;
     
-    // Render tabs properly
-    toRenderToScreen = realloc(toRenderToScreen, sizeof(struct outputBuffer) * (openedFileLines + 1));
-    toRenderToScreen[at].size = 0;
-    toRenderToScreen[at].buf = NULL;
-    toRenderToScreen[at].state = NULL;
-    updateBuffer(&toRenderToScreen[at], &fromOpenedFile[at]);
+    int lines = 0;
+    const char* end = text + size;
+    for (const char* newline = text; (newline = memchr(newline, '\n', end - newline)); newline++)
+        lines++;
+    if (size > 0 && text[size - 1] != '\n')
+        lines++; // the last line of a file may have no line ending
     
-    openedFileLines += 1;
+    for (int i = at; i < at + count; i++)
+        freeRow(i);
+    reserveRows(openedFileLines - count + lines);
+    memmove(&fromOpenedFile[at + lines], &fromOpenedFile[at + count],
+            sizeof(struct outputBuffer) * (openedFileLines - at - count));
+    memmove(&toRenderToScreen[at + lines], &toRenderToScreen[at + count],
+            sizeof(struct outputBuffer) * (openedFileLines - at - count));
+    openedFileLines += lines - count;
+    foldLinesReplaced(at, count, lines);
+    wrapLinesReplaced(at, count, lines);
+    
+    const char* line = text;
+    for (int i = at; i < at + lines; i++){
+        const char* newline = memchr(line, '\n', end - line);
+        int readCount = newline ? newline - line : end - line;
+        int next = readCount + 1;
+        while (readCount > 0 && line[readCount - 1] == '\r')
+            readCount--;
+        setRow(i, line, readCount);
+        line += next;
+    }
+    updateFollowingStatus(at + lines);
+    fileModified += 1;
+}
+
+// Highlights the lines from 'from' up to 'to' once each, then the following ones for as long as the state they begin in has changed
+static void highlightRows(int from, int to){
+    if (to > openedFileLines)
+        to = openedFileLines;
+    PERF_BEGIN(perf_highlight);
+    for (int i = from; i < to; i++)
+        updateStatus(&toRenderToScreen[i]);
+    PERF_END(perf_highlight);
+    updateFollowingStatus(to);
+}
+
+// Puts the count lines from at in another order, the line at + i being the one which was at at + order[i]
+// only the rows move, the text of the lines and their rendered copies stay where they are
+void moveRows(int at, int count, const int* order){
+    if (at < 0 || count <= 0 || at + count > openedFileLines)
+        return;
+    struct outputBuffer* from = memAlloc(mem_misc, sizeof(struct outputBuffer) * count);
+    struct outputBuffer* render = memAlloc(mem_misc, sizeof(struct outputBuffer) * count);
+    if (!from || !render)
+        failExit("Could not move the lines");
+    memcpy(from, &fromOpenedFile[at], sizeof(struct outputBuffer) * count);
+    memcpy(render, &toRenderToScreen[at], sizeof(struct outputBuffer) * count);
+    for (int i = 0; i < count; i++){
+        fromOpenedFile[at + i] = from[order[i]];
+        toRenderToScreen[at + i] = render[order[i]];
+    }
+    memFree(mem_misc, from);
+    memFree(mem_misc, render);
+    undoMovedRows(at, count, order);
+    lineIndexFrom(at);
+    foldLinesReplaced(at, count, count);
+    wrapLinesChanged(at, at + count);
+    highlightRows(at, at + count);
+    fileModified += 1;
+}
+
+// Deletes the count lines given in increasing order, the rows which stay are moved up once
+void deleteRows(const int* lines, int count){
+    if (count <= 0 || lines[0] < 0 || lines[count - 1] >= openedFileLines)
+        return;
+    undoDeletedRows(lines, count);
+    int to = lines[0];
+    int next = 0;
+    for (int i = lines[0]; i < openedFileLines; i++){
+        if (next < count && lines[next] == i){
+            freeRow(i);
+            next++;
+            continue;
+        }
+        fromOpenedFile[to] = fromOpenedFile[i];
+        toRenderToScreen[to] = toRenderToScreen[i];
+        to++;
+    }
+    foldLinesReplaced(lines[0], openedFileLines - lines[0], to - lines[0]); // the folds below are opened
+    openedFileLines = to;
+    lineIndexFrom(lines[0]);
+    wrapRowsDeleted(lines, count);
+    highlightRows(lines[0], lines[count - 1] - count + 2); // up to the line which followed the last one deleted
+    fileModified += 1;
+}
+
+// Inserts count lines so that they end up at the given lines, in increasing order
+// their texts follow one another in texts, the rows already there are moved down once
+void insertRows(const int* lines, int count, const char* texts, const int* sizes){
+    if (count <= 0 || lines[0] < 0 || lines[count - 1] >= openedFileLines + count)
+        return;
+    reserveRows(openedFileLines + count);
+    int next = count - 1;
+    int from = openedFileLines - 1;
+    for (int i = openedFileLines + count - 1; i >= lines[0]; i--){
+        if (next >= 0 && lines[next] == i)
+            next--;
+        else {
+            fromOpenedFile[i] = fromOpenedFile[from];
+            toRenderToScreen[i] = toRenderToScreen[from];
+            from--;
+        }
+    }
+    openedFileLines += count;
+    foldLinesReplaced(lines[0], openedFileLines - count - lines[0], openedFileLines - lines[0]); // the folds below are opened
+    wrapRowsInserted(lines, count);
+    for (int k = 0; k < count; k++){ // from the top, so the line above each is set when it is highlighted
+        setRow(lines[k], texts, sizes[k]);
+        texts += sizes[k];
+    }
+    undoInsertedRows(lines, count);
+    lineIndexFrom(lines[0]);
+    highlightRows(lines[0], lines[count - 1] + 1);
     fileModified += 1;
 }
 
 // Appends a string to the output buffer on a new line
 void appendString(struct outputBuffer* source, int line, char* string, size_t len){
-    source[line].buf = realloc(source[line].buf, source[line].size + len +1);
+    undoInserted(line, source[line].size, len, 0);
+    lineReserve(mem_lines, &source[line], source[line].size + len + 1);
     memcpy(&source[line].buf[source[line].size], string, len);
     source[line].size += len;
     source[line].buf[source[line].size] = '\0';
@@ -944,13 +1746,20 @@ void appendString(struct outputBuffer* source, int line, char* string, size_t le
 }
 
 
-// Inserts a string to the the output buffer
-void insertIntoBuffer(struct outputBuffer* dest, int pos, int c){
+// Inserts a string to the the output buffer, which holds the text of the line 'line' for the undo history
+void insertIntoBuffer(struct outputBuffer* dest, int line, int pos, int c){
     if (pos < 0 || pos > dest->size)
         pos = dest->size; // if not within the bounds of the existing line
+    undoInserted(line, pos, 1, 1);
+    if (isLongLine(dest)){
+        longLineInsert(longLineOf(dest), pos, c);
+        dest->size = longLineOf(dest)->size;
+        fileModified += 1;
+        return;
+    }
     
-    // alocate memory for two more characters
-    dest->buf = realloc(dest->buf, dest->size + 2);
+    // make room for one more character and the null
+    lineReserve(mem_lines, dest, dest->size + 2);
     // move substring to make room for a single character
     if (dest->size) // line not empty
         memmove(&dest->buf[pos + 1], &dest->buf[pos], (dest->size) - pos  );
@@ -962,7 +1771,18 @@ void insertIntoBuffer(struct outputBuffer* dest, int pos, int c){
 }
 
 // Inserts a character into the output buffer
+// a byte beginning a UTF-8 sequence is followed by the rest of the character, which is inserted whole
 void insertChar(int character) {
+    undoBoundary();
+    char sequence[4] = {character};
+    int length = utf8Length(character);
+    for (int i = 1; i < length; i++){
+        sequence[i] = readCharacter();
+        if ((sequence[i] & 0xc0) != 0x80){ // not the rest of a character after all
+            length = i;
+            break;
+        }
+    }
     int yPos = cursorPos.y + rowOffset - 1;
     int xPos = subtractTabs(&fromOpenedFile[yPos],cursorPos.x + colOffset) -1 ;
     
@@ -978,25 +1798,47 @@ void insertChar(int character) {
     else if ( yPos == openedFileLines) {
         insertNewLine(openedFileLines, "", 0);
     }
-    insertIntoBuffer(&fromOpenedFile[yPos], xPos, character);
+    for (int i = 0; i < length; i++)
+        insertIntoBuffer(&fromOpenedFile[yPos], yPos, xPos + i, sequence[i]);
     updateBuffer(&toRenderToScreen[yPos], &fromOpenedFile[yPos]);
-    cursorPos.x++;
-    for(int i = 0; i < openedFileLines; i++)
-        updateStatus(&toRenderToScreen[i]);
+    if (isLongLine(&fromOpenedFile[yPos]))
+        cursorPos.x += length;
+    else {
+        int codepoint;
+        utf8Decode(sequence, length, &codepoint);
+        cursorPos.x += utf8Width(codepoint);
+    }
+    updateFollowingStatus(yPos + 1);
 }
 
 // Inserts a new line into the output buffer
 void insertLine(){
     // when pressing enter
+    undoBoundary();
     int yPos = cursorPos.y + rowOffset - 1;
     int xPos = subtractTabs(&fromOpenedFile[yPos],cursorPos.x + colOffset) - 1;
     
     if (xPos == 0){ // Add an empty line
         insertNewLine(yPos, "", 0);
     }
+    else if (isLongLine(&fromOpenedFile[yPos])){ // the chunks after the cursor are moved to the new line
+        struct longLine* tail = longLineSplit(longLineOf(&fromOpenedFile[yPos]), xPos);
+        insertNewLine(yPos + 1, "", 0);
+        struct outputBuffer *ref = &fromOpenedFile[yPos + 1];
+        lineFree(mem_lines, ref->buf, ref->capacity);
+        ref->buf = (char*) tail;
+        ref->capacity = LONG_LINE;
+        ref->size = tail->size;
+        undoInserted(yPos + 1, 0, tail->size, 0);
+        undoCut(yPos, xPos, yPos + 1);
+        fromOpenedFile[yPos].size = xPos;
+        updateBuffer(&toRenderToScreen[yPos], &fromOpenedFile[yPos]);
+        updateBuffer(&toRenderToScreen[yPos + 1], &fromOpenedFile[yPos + 1]);
+    }
     else{
         struct outputBuffer *ref = &fromOpenedFile[yPos];
         insertNewLine(yPos + 1, &ref->buf[xPos], ref->size - xPos);
+        undoCut(yPos, xPos, yPos + 1);
         
         ref = &fromOpenedFile[yPos];
         ref->size = xPos;
@@ -1004,22 +1846,53 @@ void insertLine(){
 
         updateBuffer(&toRenderToScreen[yPos], &fromOpenedFile[yPos]);
     }
+    updateFollowingStatus(yPos + 1);
     cursorPos.y++;
     cursorPos.x = 1;
 }
 
-// Deletes from the output buffer
-void deleteFromBuffer(struct outputBuffer* dest, int at){
-    if (at < 0 || at > dest->size)
+// Deletes from the output buffer, which holds the text of the line 'line' for the undo history
+void deleteFromBuffer(struct outputBuffer* dest, int line, int at){
+    if (at < 0 || at >= dest->size)
         return; // if not within the bounds of the existing line
+    char deleted = isLongLine(dest) ? longLineChar(longLineOf(dest), at) : dest->buf[at];
+    undoDeleted(line, at, &deleted, 1, 1);
+    if (isLongLine(dest)){
+        longLineDelete(longLineOf(dest), at);
+        dest->size = longLineOf(dest)->size;
+        fileModified += 1;
+        return;
+    }
     
     memmove(&dest->buf[at], &dest->buf[at +1], dest->size - at);
     dest->size--;
     fileModified += 1;
 }
 
+// Appends the line after 'at' to it, when either is a long line
+// the chunks of the line below are moved over, a short line is cut into chunks first
+static void joinLongLines(int at){
+    for (int i = at; i <= at + 1; i++)
+        if (!isLongLine(&fromOpenedFile[i])){
+            struct longLine* ll = longLineCreate(fromOpenedFile[i].buf, fromOpenedFile[i].size);
+            lineFree(mem_lines, fromOpenedFile[i].buf, fromOpenedFile[i].capacity);
+            fromOpenedFile[i].buf = (char*) ll;
+            fromOpenedFile[i].capacity = LONG_LINE;
+        }
+    undoInserted(at, fromOpenedFile[at].size, fromOpenedFile[at + 1].size, 0);
+    undoCut(at + 1, 0, at + 1);
+    longLineJoin(longLineOf(&fromOpenedFile[at]), longLineOf(&fromOpenedFile[at + 1]));
+    fromOpenedFile[at].size = longLineOf(&fromOpenedFile[at])->size;
+    fromOpenedFile[at + 1].buf = NULL; // now held by the line above
+    fromOpenedFile[at + 1].capacity = 0;
+    fromOpenedFile[at + 1].size = 0;
+    updateBuffer(&toRenderToScreen[at], &fromOpenedFile[at]);
+    fileModified += 1;
+}
+
 // Deletes a character from the output buffer
 void deleteChar(){
+    undoBoundary();
     if (!fromOpenedFile){
         return;
     }
@@ -1029,21 +1902,26 @@ void deleteChar(){
         
         int yPos = cursorPos.y + rowOffset - 1;
         int xPos = cursorPos.x + colOffset - 1;
-        if (xPos > 0){
-            deleteFromBuffer(&fromOpenedFile[yPos], xPos -1);
-            cursorPos.x--;
+        struct outputBuffer* line = &fromOpenedFile[yPos];
+        if (xPos > 0){ // the whole character before the cursor goes
+            int from = isLongLine(line) ? xPos - 1 : utf8Previous(line->buf, xPos);
+            for (int i = from; i < xPos; i++)
+                deleteFromBuffer(line, yPos, from);
+            cursorPos.x = lineColumn(line, from) + 1;
             updateBuffer(&toRenderToScreen[yPos], &fromOpenedFile[yPos]);
         }
         else if (xPos == 0 && yPos > 0){
-            cursorPos.x = fromOpenedFile[yPos - 1].size + 1;
+            cursorPos.x = lineColumn(&fromOpenedFile[yPos - 1], fromOpenedFile[yPos - 1].size) + 1;
             cursorPos.y--;
-            appendString(fromOpenedFile, yPos - 1, fromOpenedFile[yPos].buf, fromOpenedFile[yPos].size);
+            if (isLongLine(&fromOpenedFile[yPos - 1]) || isLongLine(&fromOpenedFile[yPos]))
+                joinLongLines(yPos - 1);
+            else
+                appendString(fromOpenedFile, yPos - 1, fromOpenedFile[yPos].buf, fromOpenedFile[yPos].size);
             deleteRow(yPos);
         }
         cursorPos.x = addTabs(&fromOpenedFile[cursorPos.y + rowOffset - 1], cursorPos.x );
+        updateFollowingStatus(cursorPos.y + rowOffset);
     }
-    for(int i = 0; i < openedFileLines; i++)
-        updateStatus(&toRenderToScreen[i]);
 }
 
 // Deletes a line from the output buffer
@@ -1051,9 +1929,11 @@ void deleteRow(int at){
     if (at < 0 || at >= openedFileLines)
         return;
     
-    free(fromOpenedFile[at].buf);
-    free(toRenderToScreen[at].buf);
-    free (toRenderToScreen[at].state);
+    undoDeletedLine(at);
+    freeRow(at);
+    lineIndexFrom(at);
+    foldLinesReplaced(at, 1, 0);
+    wrapLinesReplaced(at, 1, 0);
     
     memmove(&fromOpenedFile[at], &fromOpenedFile[at + 1], sizeof(struct outputBuffer) * (openedFileLines - at -1) );
     memmove(&toRenderToScreen[at], &toRenderToScreen[at + 1], sizeof(struct outputBuffer) * (openedFileLines - at -1) );
@@ -1069,10 +1949,13 @@ char* prepareToString(int *bufferLength){
         stringLength += fromOpenedFile[i].size + 1; // add one to make room for the new line character
     *bufferLength = stringLength;
     
-    char* preparedString = (char*) malloc(stringLength);
+    char* preparedString = (char*) memAlloc(mem_misc, stringLength);
     char* iter = preparedString;
     for (int i = 0; i < openedFileLines; i++){
-        memcpy(iter, fromOpenedFile[i].buf, fromOpenedFile[i].size);
+        if (isLongLine(&fromOpenedFile[i]))
+            longLineCopy(longLineOf(&fromOpenedFile[i]), iter);
+        else
+            memcpy(iter, fromOpenedFile[i].buf, fromOpenedFile[i].size);
         iter += fromOpenedFile[i].size;
         *iter = '\n';
         iter++;
@@ -1092,6 +1975,15 @@ void saveFile(){
         detectFileType();
     }
     
+    // the changes made to the file by another process are taken in first, unless the document has been edited in the same places
+    fileReload();
+    int conflicts = fileConflicts();
+    if (conflicts){
+        loadStatusMessage("Changed on disk where edited (%d places), save again to overwrite", conflicts);
+        return;
+    }
+    
+    TRACE_BEGIN(trace_saveFile);
     int len;
     char *string = prepareToString(&len);
     int descriptor = open(filename , O_RDWR | O_CREAT, 0644); // Owner permission read + write, others only read
@@ -1101,18 +1993,22 @@ void saveFile(){
             res = write(descriptor, string, len);
             if (res == len){
                 close(descriptor);
-                free(string);
+                fileSaved(filename, string, len);
+                memFree(mem_misc, string);
                 fileModified = 0;
+                undoSaved();
+                streamSaved();
                 loadStatusMessage("Saved! %d bytes written to disk", len);
-                for(int i = 0; i < openedFileLines; i++)
-                    updateStatus(&toRenderToScreen[i]);
+                updateAllStatus();
+                TRACE_END(trace_saveFile);
                 return;
             }
         }
         close(descriptor);
     }
-    free(string);
+    memFree(mem_misc, string);
     loadStatusMessage("Error! Cannot save - I/O error details: %s", strerror(errno));
+    TRACE_END(trace_saveFile);
 }
 
 // Searches the document for any occurence of the queried string inputed by the user
@@ -1122,7 +2018,7 @@ void search(){
     awaitingArrow = 0;
     if (query == NULL)
         return;
-    free(query);
+    memFree(mem_misc, query);
 }
 
 // Callback function that is to be called to search the document
@@ -1132,20 +2028,16 @@ void onSearch (char *string, int key){
     static int next = 0;
     static int direction = 1; // positive or forward search
     
-    static int saved_line_nr;
-    static char* saved_line = NULL;
+    TRACE_BEGIN(trace_onSearch);
     
-    // Restore state of previously highlighted text
-    if (saved_line){
-        memcpy(toRenderToScreen[saved_line_nr].state, saved_line, toRenderToScreen[saved_line_nr].size);
-        free(saved_line);
-        saved_line = NULL;
-    }
+    // Remove the highlight of the previous match
+    searchMatch.line = -1;
     
     if ( key == '\x1b') {// Entered key == Esc
         last = -1; // reset
         next = 0;
         direction =1;
+        TRACE_END(trace_onSearch);
         return; // and exit search
     }
     else if ( lastArrow==2 || lastArrow ==4 || key == '\r'){ // down, right and enter
@@ -1179,29 +2071,44 @@ void onSearch (char *string, int key){
             current = 0;
         
         
-        struct outputBuffer* line = &toRenderToScreen[current];
-        char* match = strstr(line->buf + next, string);
+        int found = -1; // rendered column of the match
+        if (isLongLine(&fromOpenedFile[current]))
+            found = longLineFind(longLineOf(&fromOpenedFile[current]), string, next);
+        else {
+            struct outputBuffer* line = &toRenderToScreen[current];
+            char* match = strstr(line->buf + next, string);
+            if (match)
+                found = match - line->buf;
+        }
     
-        if (match){
+        if (found >= 0){
             last = current;
-            next = match - line->buf;
+            next = found;
             
             cursorPos.y = current+1;
-            cursorPos.x = match - line->buf +1;
+            if (isLongLine(&fromOpenedFile[current]))
+                cursorPos.x = found + 1;
+            else { // the column of the match
+                struct outputBuffer* line = &toRenderToScreen[current];
+                cursorPos.x = 1;
+                for (int i = 0; i < found; ){
+                    int codepoint;
+                    i += utf8Decode(&line->buf[i], found - i, &codepoint);
+                    cursorPos.x += utf8Width(codepoint);
+                }
+            }
             
             
             rowOffset = 0;
-            // Save state of buffer for later restoration
-            saved_line_nr = current;
-            saved_line = malloc(line->size);
-            memcpy(saved_line, line->state, line->size);
-
-            // change state to Highilight the found text
-            memset(&line->state[match - line->buf ], highlight_match, strlen(string));
+            // Highilight the found text on top of the line's own highlighting
+            searchMatch.line = current;
+            searchMatch.start = found;
+            searchMatch.length = strlen(string);
             break;
         }
         else
             next = 0;
     }
+    TRACE_END(trace_onSearch);
 }
 
@@ -1,6 +1,11 @@
 #ifndef EDITOR_H
 #define EDITOR_H
 
+// feature test macros, getline(), strdup() and ftruncate() are not part of c99
+#define _DEFAULT_SOURCE
+#define _BSD_SOURCE
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <ctype.h> // iscntrl()
 
@@ -17,6 +22,8 @@
 #include <stdarg.h>
 
 #include <fcntl.h> // to write to disk, need certain functions and constants
+#include <poll.h> // wait for keys and the stream being opened at once
+#include <sys/stat.h> // tell a FIFO from a file
 
 // ctr + char maps to ASCII byte between 1 and 26
 #define controlKey(c) c & 0x1f
@@ -61,6 +68,8 @@
 #define REPOS_CURSOR_BOTTOM_RIGHT "\x1b[999C\x1b[999B", 12
 #define QUERRY_CURSOR_POS      "\x1b[6n", 4
 
+#define RESET_SCROLL_REGION "\x1b[r", 3
+
 #define HIDE_CURSOR "\x1b[?25l", 6
 #define SHOW_CURSOR "\x1b[?25h", 6
 // end of V100 escape sequences
@@ -89,31 +98,334 @@ struct editorFlags {
 
 struct pos {
     int x, y;
-}cursorPos; // x, y elements begin from 1:n (not zero based)
-struct termios copyFlags;
-int screenrows;
-int screencols;
-int rowOffset; // to update pos as user scrolls up or down
-int colOffset; // to update pos as user scrolls left or right
+};
+extern struct pos cursorPos; // x, y elements begin from 1:n (not zero based)
+extern int screenrows;
+extern int screencols;
+extern int rowOffset; // to update pos as user scrolls up or down
+extern int colOffset; // to update pos as user scrolls left or right
+
+
+// What the highlighter carries from one piece of text to the next
+struct highlightState {
+    int carry; // characters at the start which have already been colored, as carryState
+    unsigned char carryState;
+    unsigned char quote; // quote character of an open string literal, 0 if none
+    unsigned char comment; // inside a /* */ comment
+    unsigned char lineComment; // the rest of the line is a // comment
+    unsigned char prevWhite; // the last character separates words
+};
+
+// what carries over from the end of a line to the next one
+enum exit_state {
+    exit_comment = 1,
+    exit_double_quote = (1 << 1),
+    exit_single_quote = (1 << 2),
+    exit_pending = (1 << 3) // the line has not been highlighted yet, the rest is known from the open cache (see cache.c)
+};
 
+// A run of highlighted characters of a rendered line, characters outside of every span are normal
+// the span ending the list keeps the line's enum exit_state in its state
+#define SPAN_MAX_LENGTH 0xffff // longer runs are split
+struct highlightSpan {
+    int start;
+    unsigned short length; // 0 ends the list
+    unsigned char state; // enum text_state
+};
+#define isPendingLine(line) ((line)->spans && (line)->spans->length == 0 && ((line)->spans->state & exit_pending))
 
 struct outputBuffer {
     char *buf;
     int size;
-    unsigned char *state;
+    int capacity; // bytes allocated for buf by the line storage (spans included for rendered lines), 0 for other buffers
+    struct highlightSpan *spans; // rendered lines only, kept in buf after the text. NULL when nothing is highlighted
+};
+
+extern int openedFileLines;
+extern int openedFileCapacity; // lines allocated in fromOpenedFile and toRenderToScreen
+extern struct outputBuffer* fromOpenedFile, * toRenderToScreen;
+extern struct editorFlags* openedFileFlags;
+extern char *filename;
+
+extern int fileModified;
+extern int awaitingArrow;
+extern int lastArrow;
+
+extern char statusmsg[80];
+extern time_t statusmsg_time;
+
+// a place in the document, a match of a replacement (replace.c)
+struct textMatch {
+    int line;
+    int pos; // index of the character in the line
+};
+
+// the search result shown on top of the highlighting
+struct searchMatch {
+    int line; // -1 when there is none
+    int start; // in the rendered line
+    int length;
+};
+extern struct searchMatch searchMatch;
+
+// when only the viewport moves, the terminal is asked to scroll what it already shows
+extern int lastFrameRowOffset; // -1 when the last frame was not a file view
+extern int lastFrameColOffset;
+
+// Screen (screen.c)
+enum cell_attr {
+    attr_none = 0,
+    attr_invert = 1
 };
 
-int openedFileLines;
-struct outputBuffer* fromOpenedFile, * toRenderToScreen;
-struct editorFlags* openedFileFlags;
-char *filename;
+struct screenCell {
+    char c[4]; // the UTF-8 bytes of the character shown, '\0' padded. "" on the column covered by a wide character
+    unsigned char state; // enum text_state
+    unsigned char attr; // enum cell_attr
+};
 
-int fileModified;
-int awaitingArrow;
-int lastArrow;
+extern struct screenCell* screenFront, * screenBack; // what the terminal shows, what it should show
+extern int screenHeight;
+extern int screenWidth;
+extern struct pos screenCursor; // where the terminal cursor is, -1 if unknown
+extern unsigned long lastFrameBytes; // bytes written by the last refresh
+extern unsigned long totalOutputBytes; // bytes written to the terminal since startup
+extern int fullRedraw; // set by EDITOR_FULL_REDRAW, rewrites every cell on every refresh
+extern int screenOrigin; // the row composed rows are counted from, the top of the pane being composed (see document.c)
+
+// Terminal backends (terminal.c)
+struct terminalBackend {
+    int (*read)(char* c); // 1 if a byte was read, 0 if none arrived in time, -1 on error
+    int (*write)(const char* sequence, int count);
+    int (*getSize)(int* rows, int* cols); // -1 on failure
+    void (*enableRaw)();
+    void (*disableRaw)();
+};
 
-char statusmsg[80];
-time_t statusmsg_time;
+struct memoryTerminal {
+    char* input; // queued keystrokes
+    int inputSize;
+    int inputPos;
+    int rows, cols;
+    unsigned long bytesWritten;
+    unsigned long writes;
+    void (*onDrained)(); // called when the editor asks for input and there is none left
+};
+
+extern struct termios copyFlags;
+extern struct terminalBackend ttyBackend, memoryBackend;
+extern struct terminalBackend* terminal; // the backend in use, ttyBackend by default
+extern struct memoryTerminal memoryTerminal;
+
+// Performance overlay (perf.c)
+#define PERF_HISTORY 32 // frames in the rolling average
+enum perf_stage {
+    perf_input = 0, // decoding the key press
+    perf_edit, // acting on the key press
+    perf_highlight, // updateStatus passes
+    perf_rows, // composing the rows of the frame
+    perf_output, // writing the frame to the terminal
+    perf_stages
+};
+
+struct perfStat {
+    double start; // microseconds, 0 when not running
+    double current; // accumulated during this frame
+    double last; // accumulated during the last frame
+    double average;
+    double history[PERF_HISTORY];
+};
+
+#define PERF_BEGIN(stage) do { if (perfOverlay) perfBegin(stage); } while (0)
+#define PERF_END(stage) do { if (perfOverlay) perfEnd(stage); } while (0)
+
+extern int perfOverlay; // toggled with ctrl+p
+extern struct perfStat perfStats[perf_stages];
+extern unsigned long perfHighlightedLines; // lines highlighted since the last frame
+extern unsigned long perfLastHighlightedLines;
+
+// Tracing (trace.c)
+enum trace_span {
+    trace_processKey = 0,
+    trace_refresh,
+    trace_loadRows,
+    trace_updateStatus,
+    trace_saveFile,
+    trace_openFile,
+    trace_onSearch,
+    trace_reloadFile,
+    trace_replace,
+    trace_lines,
+    trace_spans
+};
+
+#define TRACE_BEGIN(span) double span##Start = traceEnabled ? perfNow() : 0
+#define TRACE_END(span) do { if (traceEnabled) traceEnd(span, span##Start); } while (0)
+
+extern int traceEnabled;
+
+// Memory accounting (memory.c)
+enum mem_subsystem {
+    mem_lines = 0, // text of the lines (fromOpenedFile)
+    mem_render, // rendered copies of the lines and their highlight spans (toRenderToScreen)
+    mem_tables, // the arrays of lines
+    mem_screen, // the screen grids
+    mem_frames, // escape sequences of a frame
+    mem_misc, // file name, prompts, search
+    mem_undo, // the undo and redo logs
+    mem_subsystems
+};
+
+struct memStat {
+    unsigned long bytes; // held from the allocator, headers included
+    unsigned long blocks;
+    unsigned long peak; // highest bytes so far
+};
+
+extern int memOverlay; // toggled with ctrl+t
+extern struct memStat memStats[mem_subsystems];
+
+// Line storage (slab.c)
+#define SLAB_MAX 1024 // larger blocks are not kept in slabs
+
+// Soft wrapping (wrap.c)
+extern int softWrap; // toggled with ctrl+w
+void wrapRowsFrom(int at);
+void wrapLinesChanged(int from, int to);
+void wrapLinesReplaced(int at, int count, int lines);
+void wrapRowsDeleted(const int* lines, int count);
+void wrapRowsInserted(const int* lines, int count);
+void wrapLineChanged(int at);
+void wrapFree();
+int wrapRowOf(int line);
+int wrapLineAt(int row);
+int wrapTop(int line, int above);
+void wrapScroll();
+void wrapCursor(int* x, int* y);
+void wrapPage(int direction);
+void wrapToggle();
+void wrapKeepState();
+
+// Code folding (fold.c)
+extern int foldCount; // folds hiding lines
+int foldHides(int line);
+int foldHidden(int line);
+int foldHiddenBefore(int line);
+int foldLineAt(int row);
+int foldShown(int line);
+int foldNext(int line);
+int foldPrevious(int line);
+void foldLinesReplaced(int at, int count, int lines);
+void foldOpen(int line);
+void foldFree();
+void foldToggle();
+void foldAll();
+void foldKeepState();
+
+// Documents and panes (document.c)
+// each document keeps the state of the modules while another one is in use, the panes are stacked one above the other
+extern int paneCount; // panes on the screen
+void keepDocumentState(void* state, size_t size);
+void documentInit();
+void documentOpen(char* file);
+void documentPrompt();
+void documentNext();
+int documentsModified();
+void closeDocuments();
+int documentCreate();
+void documentShow(int d);
+int documentInUse();
+int documentVisit(int d);
+void documentReturn(int previous);
+void documentsKeepBudget();
+int documentsStatusString(char* str, int size);
+void paneSplit();
+void paneNext();
+void paneClose();
+void loadPanes();
+
+// Memory budget (spill.c)
+// the documents which are not shown give back their memory once the editor holds more than its budget
+enum spill_level {
+    spill_none = 0,
+    spill_render, // the rendering of the lines is let go of
+    spill_clean, // and the text, to be read again from the file
+    spill_swapped // and the text, written to the swap file
+};
+unsigned long memoryInUse();
+unsigned long memoryBudget();
+int spillDocument(int level);
+int spillRestore();
+void spillClose();
+void spillKeepState();
+
+// Batch editing (batch.c)
+extern int batchMode; // without a terminal, the lines are not highlighted
+int batchRun(const char* script, char** files, int count);
+
+// Find in files (find.c)
+// the files under the current directory are searched on threads of their own, the matching lines stream into a document
+extern int findWakeFd; // readable when results are waiting, -1 before the first search
+extern int findDocument; // the document of the results, -1 before the first search
+void findInFiles();
+int findDrain();
+int findOpenResult();
+void findStop();
+
+// the screen rows are not the lines one for one: the lines are wrapped or folded (see wrap.c)
+#define rowsMapped() (softWrap || foldCount > 0)
+
+// UTF-8 (utf8.c)
+int utf8IsAscii(const char* text, int size);
+int utf8Decode(const char* text, int size, int* codepoint);
+int utf8Length(int lead);
+int utf8Previous(const char* text, int index);
+int utf8Width(int codepoint);
+
+// Long lines (longline.c)
+// a line of LONG_LINE_MIN characters or more is kept in chunks, so that editing it, mapping its columns
+// and rendering the columns on the screen do not walk the whole line
+// its buf holds a struct longLine and its capacity is LONG_LINE, its rendered line holds no text, only the width
+#define LONG_LINE_MIN (64 * 1024)
+#define LONG_LINE (-1)
+#define isLongLine(line) ((line)->capacity == LONG_LINE)
+#define longLineOf(line) ((struct longLine*) (line)->buf)
+
+struct lineChunk {
+    struct outputBuffer text; // spans unused
+    int start; // index of the first character in the line
+    int col; // rendered column of the first character
+    int width; // rendered columns
+    int tabs;
+    struct highlightState entry; // highlighter state at the first character
+};
+
+struct longLine {
+    struct lineChunk* chunks;
+    int count;
+    int capacity;
+    int size; // characters in the line
+    int width; // rendered columns
+    int highlightFrom; // first chunk edited since the last highlighting, count when none
+    int highlightTo; // last chunk edited, the following entry states may only be trusted past it
+    unsigned char exit; // enum exit_state at the end of the line
+    struct outputBuffer window; // the rendered columns shown on the screen, with their spans
+    int windowCol; // first column held by the window, -1 when it has to be rendered again
+    int windowWidth;
+};
+
+// Streaming open (stream.c)
+extern int streamFd; // the pipe, FIFO or followed file the document is being read from, -1 when there is none
+extern int streamWatchFd; // what tells that more can be read: the stream itself, or an inotify watch of the followed file
+
+// External changes (reload.c)
+extern int fileWatchFd; // an inotify watch of the opened file, -1 when there is none
+// FNV-1a, the hash of the lines and of the files (reload.c, lines.c, cache.c)
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+// Undo (undo.c)
+extern int undoRecording; // whether the edits are logged, off while the document is read from its file or stream
 
 //// Functions
 
@@ -128,17 +440,130 @@ int getWindowSize(int *rows, int *cols);
 void appendToBuffer(struct outputBuffer* out, const char* str, int len);
 void appendWithColor(struct outputBuffer* source, const char* str, int len, int value);
 void appendreposCursorSequence(struct outputBuffer* out, int x, int y);
+void appendScrollSequence(struct outputBuffer* out, int top, int bottom, int lines);
 int terminalOut(const char *sequence, int count);
+int terminalIn(char *c);
+void memoryTerminalInput(const char* input, int len);
 
 char readCharacter();
 void repositionCursor();
 void processKey();
 
-void loadTitle(struct outputBuffer* oBuf);
-void loadRows(struct outputBuffer* oBuf, int delta);
-void loadStatusBar(struct outputBuffer* oBuf);
+void loadTitle();
+void loadRows(int top);
+void loadRow(int y, int pos);
+void loadStatusBar();
 void loadStatusMessage(const char *fmt, ...);
 
+void screenInit(int rows, int cols);
+void screenInvalidate();
+void screenClear();
+int screenPut(int y, int x, const char* str, const unsigned char* state, int len, int attr);
+void screenFill(int y, int x, int attr);
+void screenSetState(int y, int x, int len, int state);
+int screenKeep(int y, int count);
+void screenScroll(struct outputBuffer* out, int top, int bottom, int lines);
+void screenMoveCursor(struct outputBuffer* out, int x, int y);
+void screenFlush(struct outputBuffer* out);
+
+double perfNow();
+void perfBegin(int stage);
+void perfEnd(int stage);
+void perfFrame();
+int perfOverlayString(char* str, int size);
+
+void* memAlloc(int subsystem, size_t size);
+void* memRealloc(int subsystem, void* ptr, size_t size);
+void memFree(int subsystem, void* ptr);
+char* memStrdup(int subsystem, const char* str);
+int memOverlayString(char* str, int size);
+int memSizeString(char* str, int size, double bytes);
+int memParseSize(const char* str, long long* bytes);
+
+int lineCapacity(int size);
+void* lineAlloc(int subsystem, int capacity);
+void lineFree(int subsystem, void* block, int capacity);
+void lineReserve(int subsystem, struct outputBuffer* line, int size);
+void lineFreeAll(int subsystem);
+void slabKeepState();
+
+struct longLine* longLineCreate(const char* text, int size);
+void longLineFree(struct longLine* ll);
+void longLineCopy(struct longLine* ll, char* dest);
+int longLineChar(struct longLine* ll, int pos);
+int longLineColumn(struct longLine* ll, int pos);
+void longLineInsert(struct longLine* ll, int pos, int c);
+void longLineDelete(struct longLine* ll, int pos);
+struct longLine* longLineSplit(struct longLine* ll, int pos);
+void longLineJoin(struct longLine* ll, struct longLine* tail);
+int longLineZeroTabs(struct longLine* ll, int* xPos);
+void longLineHighlight(struct longLine* ll, const struct highlightState* entry);
+struct outputBuffer* longLineWindow(struct longLine* ll, int col, int width);
+int longLineFind(struct longLine* ll, const char* query, int fromCol);
+
+void openStream(int fd, const char* followPath);
+void closeStream();
+void streamSaved();
+int streamRead();
+void streamKeepState();
+
+void diskLine(const char* text, int size, int rawSize);
+void watchFile(const char* path);
+void unwatchFile();
+void fileSaved(const char* path, const char* text, size_t size);
+int fileReload();
+int fileConflicts();
+int fileWatchRead();
+void watchKeepState();
+
+long long fileModifiedAt(const struct stat* st);
+int fileIdentity(struct stat* st, unsigned long long* hash);
+int fileUnchanged();
+
+void lineIndexFrom(int at);
+void lineIndexFree();
+int lineIndexPending();
+void lineIndexBuild();
+void lineIndexRestore(const long long* offsets, int count, int step);
+int lineIndexAll(const long long** offsets, int* step);
+void goToLine();
+void showPosition(int line, int pos);
+void lineIndexKeepState();
+
+void undoBoundary();
+void undoInserted(int line, int pos, int length, int typed);
+void undoDeleted(int line, int pos, const char* text, int length, int typed);
+void undoCut(int line, int pos, int holder);
+void undoInsertedLine(int at);
+void undoDeletedLine(int at);
+void undoReplaced(const struct textMatch* matches, int count, const char* inserted, int insertedLength,
+                  const char* removed, int removedLength);
+void undoMovedRows(int at, int count, const int* order);
+void undoDeletedRows(const int* lines, int count);
+void undoInsertedRows(const int* lines, int count);
+void undoSaved();
+void undoClear();
+void undo();
+void redo();
+void undoKeepState();
+
+void replaceMatches(const struct textMatch* matches, int count, const char* removed, int removedLength,
+                    const char* text, int textLength);
+int replaceText(const char* query, const char* with);
+void replaceAll();
+
+int runLineCommand(const char* input);
+void lineCommand();
+
+void cacheLoad(const char* file);
+int cachedExitState(int at, unsigned char* exit);
+void cacheApply();
+void cacheSave();
+
+void traceInit(const char* path);
+void traceEnd(int span, double start);
+void traceWrite();
+
 char* userPrompt(char* message, void (*func)(char* str, int key));
 
 
@@ -146,20 +571,39 @@ void scroll();
 int zeroTabs(struct outputBuffer* line, int* xPos);
 int addTabs(struct outputBuffer* line, int xPos);
 int subtractTabs(struct outputBuffer* line, int xPos);
+int lineColumn(struct outputBuffer* line, int pos);
 
 void openFile(char* file);
+void followFile(char* file);
+void trimLineTables();
+void closeDocument();
+void freeLines();
+void dropRendering();
+void restoreRendering(const unsigned char* exits);
+void restoreLine(const char* text, int size, unsigned char exit);
 void detectFileType();
 
 void updateBuffer(struct outputBuffer* dest, struct outputBuffer* src);
+int lineWidth(const struct outputBuffer* line);
+void highlightText(const char* text, int size, int limit, struct highlightState* hs, unsigned char* state);
+void lineExitState(int at, struct highlightState* hs);
+unsigned char exitState(const struct highlightState* hs);
+void storeSpans(struct outputBuffer* line, const unsigned char* state, unsigned char exit);
 void updateStatus(struct outputBuffer* line);
+void updateAllStatus();
+void updateFollowingStatus(int at);
 
 void insertNewLine(int at, char* stringLine, int readCount);
+void replaceRows(int at, int count, const char* text, size_t size);
+void moveRows(int at, int count, const int* order);
+void deleteRows(const int* lines, int count);
+void insertRows(const int* lines, int count, const char* texts, const int* sizes);
 void appendString(struct outputBuffer* source, int line, char* string, size_t len);
 
-void insertIntoBuffer(struct outputBuffer* dest, int pos, int c);
+void insertIntoBuffer(struct outputBuffer* dest, int line, int pos, int c);
 void insertChar(int character);
 void insertLine();
-void deleteFromBuffer(struct outputBuffer* dest, int at);
+void deleteFromBuffer(struct outputBuffer* dest, int line, int at);
 void deleteChar();
 void deleteRow(int at);
 
@@ -0,0 +1,414 @@
+#include "editor.h"
+
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
+
+// Find in files (ctrl+a): every file under the current directory is searched for a text, as ctrl+f searches the document
+// the matching lines are shown in a document of their own as 'path:line: text', Enter on one of them opens the file there
+//
+// the search runs on threads of its own while the editor goes on: they share a pool of paths, a thread takes the next one,
+// adds what a directory holds back to the pool and searches a file a window of it at a time, so that a file
+// shrinking under it does no harm and a search being stopped is noticed between two windows
+// the lines found are gathered in a buffer the editor takes them from when it waits for a key (see readCharacter()),
+// a pipe wakes it up as soon as there are some. Hidden files and directories, symbolic links and binary files are left out
+
+#define FIND_THREADS_MAX 16
+#define FIND_LINE_MAX 200 // characters of a matching line shown in the results
+#define FIND_BINARY_PROBE 8192 // a file with a '\0' in its first bytes is binary
+#define FIND_FLUSH 65536 // bytes of results a thread gathers before handing them over
+#define FIND_WINDOW (1 << 20) // bytes of a file read at once
+
+int findWakeFd = -1; // readable when results are waiting (see terminal.c)
+static int wakeWrite = -1;
+int findDocument = -1; // the document of the results
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t more = PTHREAD_COND_INITIALIZER; // paths have been added to the pool, or the search is over
+static pthread_t threads[FIND_THREADS_MAX];
+static int threadCount = 0; // started, 0 when no search is running
+static int threadsDone = 0;
+
+// shared by the threads, under lock
+static char** paths = NULL; // the pool: directories and files to be looked at
+static int pathCount = 0;
+static int pathCapacity = 0;
+static int busy = 0; // threads looking at a path, which may add more
+static int stopping = 0; // read without the lock while a file or directory is being looked at
+static struct outputBuffer results = {NULL, 0, 0, NULL}; // lines waiting to be added to the results
+static int matchCount = 0;
+static int fileCount = 0; // files holding a match
+
+static char* query = NULL;
+static int queryLength = 0;
+
+// Adds a path to the pool, the lock is held
+static void addPath(char* path){
+    if (pathCount == pathCapacity){
+        int capacity = pathCapacity ? pathCapacity * 2 : 256;
+        char** grown = memRealloc(mem_misc, paths, sizeof(char*) * capacity);
+        if (!grown){
+            memFree(mem_misc, path);
+            return;
+        }
+        paths = grown;
+        pathCapacity = capacity;
+    }
+    paths[pathCount++] = path;
+}
+
+static void appendText(struct outputBuffer* out, const char* text, int size){
+    if (out->size + size > out->capacity){
+        int capacity = out->capacity ? out->capacity * 2 : 4096;
+        while (capacity < out->size + size)
+            capacity *= 2;
+        char* grown = memRealloc(mem_misc, out->buf, capacity);
+        if (!grown)
+            return;
+        out->buf = grown;
+        out->capacity = capacity;
+    }
+    memcpy(&out->buf[out->size], text, size);
+    out->size += size;
+}
+
+// Hands the lines found over to the editor, which is woken up if it had none waiting
+static void handOver(struct outputBuffer* found, int matches, int files){
+    if (found->size == 0)
+        return;
+    pthread_mutex_lock(&lock);
+    int wake = results.size == 0;
+    appendText(&results, found->buf, found->size);
+    matchCount += matches;
+    fileCount += files;
+    pthread_mutex_unlock(&lock);
+    found->size = 0;
+    if (wake && write(wakeWrite, "", 1) < 0)
+        return; // already readable
+}
+
+// Adds the entries of the directory to the pool
+static void walkDirectory(const char* path){
+    DIR* dir = opendir(path);
+    if (!dir)
+        return;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) && !__atomic_load_n(&stopping, __ATOMIC_RELAXED)){
+        if (entry->d_name[0] == '.')
+            continue;
+        size_t size = strlen(path) + strlen(entry->d_name) + 2;
+        char* child = memAlloc(mem_misc, size);
+        if (!child)
+            break;
+        if (strcmp(path, "."))
+            snprintf(child, size, "%s/%s", path, entry->d_name);
+        else
+            snprintf(child, size, "%s", entry->d_name);
+        pthread_mutex_lock(&lock);
+        addPath(child);
+        pthread_cond_signal(&more);
+        pthread_mutex_unlock(&lock);
+    }
+    closedir(dir);
+}
+
+// Adds a line holding the query to the results
+static void addLine(struct outputBuffer* found, const char* path, int line, const char* text, long length){
+    while (length > 0 && text[length - 1] == '\r')
+        length--;
+    char prefix[32];
+    int prefixSize = snprintf(prefix, sizeof(prefix), ":%d: ", line);
+    appendText(found, path, strlen(path));
+    appendText(found, prefix, prefixSize);
+    appendText(found, text, length < FIND_LINE_MAX ? length : FIND_LINE_MAX);
+    appendText(found, "\n", 1);
+}
+
+// Searches the file for the query, a line is reported once however many times it holds the query
+// the file is read a window at a time, the lines a window ends in the middle of are carried over to the next one
+// unless they are too long for it: then only the start of the line is kept, to be shown, and as much of its end as
+// a query found across the two windows needs
+static void searchFile(const char* path, off_t size){
+    if (size < queryLength)
+        return;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return;
+    char* window = memAlloc(mem_misc, 2 * FIND_WINDOW + queryLength);
+    struct outputBuffer found = {NULL, 0, 0, NULL};
+    char head[FIND_LINE_MAX]; // the start of a line too long for a window
+    long headLength = 0;
+    int longLine = 0; // the window starts in the middle of the line in head
+    int lineReported = 0; // that line has been reported already
+    long kept = 0; // bytes carried over from the previous window
+    int line = 1;
+    int matches = 0;
+    int reported = 0; // the file has been counted in fileCount
+    int first = 1;
+    while (window && size > 0 && !__atomic_load_n(&stopping, __ATOMIC_RELAXED)){
+        ssize_t got = read(fd, window + kept, size < FIND_WINDOW ? size : FIND_WINDOW);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0){ // shrunk while it was read, what is left is searched as its last line
+            got = 0;
+            size = 0;
+        }
+        if (first && memchr(window, '\0', got < FIND_BINARY_PROBE ? got : FIND_BINARY_PROBE))
+            break;
+        first = 0;
+        size -= got;
+        const char* end = window + kept + got;
+        const char* at = window; // the start of the first line not searched yet
+        if (longLine){
+            const char* newline = memchr(window, '\n', end - window);
+            const char* stop = newline ? newline : end;
+            if (!lineReported && memmem(window, stop - window, query, queryLength)){
+                addLine(&found, path, line, head, headLength);
+                matches++;
+                lineReported = 1;
+            }
+            if (newline){
+                longLine = 0;
+                line++;
+                at = newline + 1;
+            } else if (size == 0)
+                at = end;
+        }
+        if (!longLine){
+            const char* done = end; // the lines before it are complete
+            if (size > 0){
+                done = memrchr(at, '\n', end - at);
+                done = done ? done + 1 : at;
+            }
+            const char* counted = at; // the lines before it have been counted
+            while (!__atomic_load_n(&stopping, __ATOMIC_RELAXED) && (at = memmem(at, done - at, query, queryLength))){
+                const char* newline;
+                while ((newline = memchr(counted, '\n', at - counted))){
+                    line++;
+                    counted = newline + 1;
+                }
+                const char* lineEnd = memchr(at, '\n', done - at);
+                if (!lineEnd)
+                    lineEnd = done;
+                addLine(&found, path, line, counted, lineEnd - counted);
+                matches++;
+                if (found.size >= FIND_FLUSH){
+                    handOver(&found, matches, !reported);
+                    matches = 0;
+                    reported = 1;
+                }
+                at = lineEnd;
+            }
+            while (counted < done && (counted = memchr(counted, '\n', done - counted))){
+                line++;
+                counted++;
+            }
+            at = done;
+            if (end - at >= FIND_WINDOW){ // a line too long to be carried over whole
+                headLength = FIND_LINE_MAX;
+                memcpy(head, at, headLength);
+                longLine = 1;
+                lineReported = 0;
+                if (memmem(at, end - at, query, queryLength)){
+                    addLine(&found, path, line, head, headLength);
+                    matches++;
+                    lineReported = 1;
+                }
+            }
+        }
+        if (longLine) // only what a query found across the windows needs
+            at = end - (end - window < queryLength - 1 ? end - window : queryLength - 1);
+        kept = end - at;
+        memmove(window, at, kept);
+        if (found.size >= FIND_FLUSH){
+            handOver(&found, matches, !reported);
+            matches = 0;
+            reported = 1;
+        }
+    }
+    handOver(&found, matches, !reported);
+    memFree(mem_misc, found.buf);
+    memFree(mem_misc, window);
+    close(fd);
+}
+
+// Takes paths from the pool until it is empty and no thread can add more
+static void* findWork(void* arg){
+    (void) arg;
+    pthread_mutex_lock(&lock);
+    while (1){
+        while (pathCount == 0 && busy > 0 && !stopping)
+            pthread_cond_wait(&more, &lock);
+        if (pathCount == 0 || stopping)
+            break;
+        char* path = paths[--pathCount];
+        busy++;
+        pthread_mutex_unlock(&lock);
+        struct stat st;
+        if (lstat(path, &st) == 0){
+            if (S_ISDIR(st.st_mode))
+                walkDirectory(path);
+            else if (S_ISREG(st.st_mode))
+                searchFile(path, st.st_size);
+        }
+        memFree(mem_misc, path);
+        pthread_mutex_lock(&lock);
+        busy--;
+    }
+    pthread_cond_broadcast(&more); // the others are done as well
+    int wake = ++threadsDone == threadCount;
+    pthread_mutex_unlock(&lock);
+    if (wake && write(wakeWrite, "", 1) < 0)
+        return NULL;
+    return NULL;
+}
+
+// Stops the search, if one is running, once its threads are done
+void findStop(){
+    if (threadCount == 0)
+        return;
+    pthread_mutex_lock(&lock);
+    __atomic_store_n(&stopping, 1, __ATOMIC_RELAXED);
+    pthread_cond_broadcast(&more);
+    pthread_mutex_unlock(&lock);
+    for (int t = 0; t < threadCount; t++)
+        pthread_join(threads[t], NULL);
+    threadCount = 0;
+    while (pathCount > 0)
+        memFree(mem_misc, paths[--pathCount]);
+    memFree(mem_misc, results.buf);
+    results = (struct outputBuffer) {NULL, 0, 0, NULL};
+}
+
+// Takes the lines found so far into the results, returns 1 when the screen is to be refreshed
+int findDrain(){
+    char wake[256];
+    while (read(findWakeFd, wake, sizeof(wake)) > 0)
+        ;
+    if (threadCount == 0)
+        return 0;
+    pthread_mutex_lock(&lock);
+    struct outputBuffer found = results;
+    results = (struct outputBuffer) {NULL, 0, 0, NULL};
+    int matches = matchCount;
+    int files = fileCount;
+    int done = threadsDone == threadCount;
+    pthread_mutex_unlock(&lock);
+
+    if (found.size){
+        int previous = documentVisit(findDocument);
+        int first = openedFileLines == 0;
+        int recording = undoRecording;
+        undoRecording = 0; // what is found is not an edit
+        replaceRows(openedFileLines, 0, found.buf, found.size);
+        undoRecording = recording;
+        fileModified = 0;
+        documentReturn(previous);
+        if (first && previous == findDocument) // off the title screen of the empty document
+            cursorPos = (struct pos) {1, 1};
+    }
+    memFree(mem_misc, found.buf);
+    if (done){
+        for (int t = 0; t < threadCount; t++)
+            pthread_join(threads[t], NULL);
+        threadCount = 0;
+        loadStatusMessage("%d lines found in %d files for %.30s", matches, files, query);
+    }
+    else if (found.size)
+        loadStatusMessage("Searching for %.30s: %d lines in %d files so far", query, matches, files);
+    return found.size > 0 || done;
+}
+
+// Asks for a text and searches the files under the current directory for it, the results are shown as they are found
+void findInFiles(){
+    char* input = userPrompt("Find in files: %s (ESC to cancel)", NULL);
+    if (input == NULL)
+        return;
+    if (*input == '\0'){
+        memFree(mem_misc, input);
+        return;
+    }
+    findStop();
+    memFree(mem_misc, query);
+    query = input;
+    queryLength = strlen(query);
+    if (findWakeFd < 0){
+        int wakePipe[2];
+        if (pipe(wakePipe) != 0){
+            loadStatusMessage("Could not search the files");
+            return;
+        }
+        fcntl(wakePipe[0], F_SETFL, O_NONBLOCK);
+        fcntl(wakePipe[1], F_SETFL, O_NONBLOCK);
+        findWakeFd = wakePipe[0];
+        wakeWrite = wakePipe[1];
+    }
+
+    // the results of the last search are let go of
+    if (findDocument < 0)
+        findDocument = documentCreate();
+    else {
+        documentShow(findDocument);
+        closeDocument();
+        cursorPos = (struct pos) {1, 1};
+        rowOffset = colOffset = 0;
+        lastFrameRowOffset = -1;
+    }
+
+    char* root = memStrdup(mem_misc, ".");
+    if (!root)
+        return;
+    addPath(root);
+    busy = 0;
+    stopping = 0;
+    threadsDone = 0;
+    matchCount = fileCount = 0;
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int count = cores < 1 ? 1 : cores > FIND_THREADS_MAX ? FIND_THREADS_MAX : cores;
+    pthread_mutex_lock(&lock); // the threads count themselves done against threadCount
+    for (int t = 0; t < count; t++)
+        if (pthread_create(&threads[threadCount], NULL, findWork, NULL) == 0)
+            threadCount++;
+    pthread_mutex_unlock(&lock);
+    if (threadCount == 0){
+        memFree(mem_misc, paths[--pathCount]);
+        loadStatusMessage("Could not search the files");
+        return;
+    }
+    loadStatusMessage("Searching for %.30s", query);
+}
+
+// Opens the file of the result on the line of the cursor at its line, returns 0 outside of the results
+int findOpenResult(){
+    if (findDocument < 0 || documentInUse() != findDocument || openedFileLines == 0)
+        return 0;
+    struct outputBuffer* result = &fromOpenedFile[cursorPos.y + rowOffset - 1];
+    if (isLongLine(result))
+        return 1;
+    // 'path:line: text', the path ends at a ':' followed by a number and ':', the first one naming a file (names may hold ':')
+    const char* end = result->buf + result->size;
+    for (const char* colon = memchr(result->buf, ':', result->size); colon; colon = memchr(colon + 1, ':', end - colon - 1)){
+        const char* digit = colon + 1;
+        long line = 0;
+        while (digit < end && isdigit((unsigned char) *digit) && line < INT_MAX / 10)
+            line = line * 10 + (*digit++ - '0');
+        if (digit == colon + 1 || digit == end || *digit != ':')
+            continue;
+        char* path = memAlloc(mem_misc, colon - result->buf + 1);
+        if (!path)
+            return 1;
+        memcpy(path, result->buf, colon - result->buf);
+        path[colon - result->buf] = '\0';
+        struct stat st;
+        int found = stat(path, &st) == 0 && S_ISREG(st.st_mode) && access(path, R_OK) == 0;
+        if (found){
+            documentOpen(path);
+            showPosition(line - 1, 0);
+        }
+        memFree(mem_misc, path);
+        if (found)
+            return 1;
+    }
+    loadStatusMessage("No file to open on this line");
+    return 1;
+}
@@ -0,0 +1,321 @@
+#include "editor.h"
+
+// Code folding (ctrl+k folds or opens the block at the cursor, ctrl+o every block at the top or none)
+// a fold keeps its first line on the screen and hides the lines after it, up to its last
+// the folds are kept in order in an array with, for each, the lines hidden by the folds before it:
+// the line shown on a screen row, or the row of a line, is a binary search whatever the number of lines hidden
+// the candidates are the { } blocks and the /* */ comments of several lines, as the highlighter sees them:
+// a brace in a comment or a string does not count, and a block keeps its closing line on the screen
+
+struct fold {
+    int start; // the line which stays on the screen
+    int end; // the last line hidden
+    int hiddenBefore; // lines hidden by the folds before this one
+};
+
+int foldCount = 0;
+static struct fold* folds = NULL;
+static int foldCapacity = 0;
+
+// The folds are those of the document in use (see document.c)
+void foldKeepState(){
+    keepDocumentState(&folds, sizeof(folds));
+    keepDocumentState(&foldCount, sizeof(foldCount));
+    keepDocumentState(&foldCapacity, sizeof(foldCapacity));
+}
+
+// Lines hidden by all the folds
+static int hiddenLines(){
+    return foldCount ? folds[foldCount - 1].hiddenBefore + folds[foldCount - 1].end - folds[foldCount - 1].start : 0;
+}
+
+static void countHidden(int from){
+    for (int i = from; i < foldCount; i++)
+        folds[i].hiddenBefore = i ? folds[i - 1].hiddenBefore + folds[i - 1].end - folds[i - 1].start : 0;
+}
+
+// Index of the last fold which starts before the line, -1 if none
+static int foldBefore(int line){
+    int low = 0, high = foldCount - 1, found = -1;
+    while (low <= high){
+        int mid = (low + high) / 2;
+        if (folds[mid].start < line){
+            found = mid;
+            low = mid + 1;
+        }
+        else
+            high = mid - 1;
+    }
+    return found;
+}
+
+// Index of the fold which starts on the line, -1 if none
+static int foldStartingAt(int line){
+    int i = foldBefore(line + 1);
+    return (i >= 0 && folds[i].start == line) ? i : -1;
+}
+
+// Returns 1 when the line is hidden in a fold
+int foldHides(int line){
+    int i = foldBefore(line);
+    return i >= 0 && line <= folds[i].end;
+}
+
+// Lines hidden by a fold starting on the line, 0 if none does
+int foldHidden(int line){
+    int i = foldStartingAt(line);
+    return i >= 0 ? folds[i].end - folds[i].start : 0;
+}
+
+// Lines hidden before the line
+int foldHiddenBefore(int line){
+    int i = foldBefore(line);
+    if (i < 0)
+        return 0;
+    int end = folds[i].end < line - 1 ? folds[i].end : line - 1;
+    return folds[i].hiddenBefore + end - folds[i].start;
+}
+
+// The line shown on the screen row, counted from the top of the document
+int foldLineAt(int row){
+    int low = 0, high = foldCount - 1, found = -1;
+    while (low <= high){ // the last fold whose first line is shown above the row
+        int mid = (low + high) / 2;
+        if (folds[mid].start - folds[mid].hiddenBefore < row){
+            found = mid;
+            low = mid + 1;
+        }
+        else
+            high = mid - 1;
+    }
+    if (found < 0)
+        return row;
+    return row + folds[found].hiddenBefore + folds[found].end - folds[found].start;
+}
+
+// The line shown for the line, the first of its fold when it is hidden
+int foldShown(int line){
+    int i = foldBefore(line);
+    return (i >= 0 && line <= folds[i].end) ? folds[i].start : line;
+}
+
+// The line shown after the line
+int foldNext(int line){
+    int i = foldStartingAt(line);
+    return i >= 0 ? folds[i].end + 1 : line + 1;
+}
+
+// The line shown before the line
+int foldPrevious(int line){
+    return line > 0 ? foldShown(line - 1) : 0;
+}
+
+static void removeFold(int i){
+    wrapLinesChanged(folds[i].start, folds[i].end + 1);
+    memmove(&folds[i], &folds[i + 1], sizeof(struct fold) * (foldCount - i - 1));
+    foldCount--;
+    countHidden(i);
+}
+
+// Hides the lines after start up to end, the folds within them are opened
+static void addFold(int start, int end){
+    int i = foldBefore(start + 1); // folds from i + 1 come after start
+    if (i >= 0 && folds[i].start == start)
+        i--;
+    int last = i;
+    while (last + 1 < foldCount && folds[last + 1].start <= end)
+        last++;
+    int removed = last - i;
+    if (removed == 0){
+        if (foldCount + 1 > foldCapacity){
+            int capacity = foldCapacity ? foldCapacity * 2 : 64;
+            struct fold* grown = memRealloc(mem_tables, folds, sizeof(struct fold) * capacity);
+            if (!grown)
+                failExit("Could not fold the lines");
+            folds = grown;
+            foldCapacity = capacity;
+        }
+        memmove(&folds[i + 2], &folds[i + 1], sizeof(struct fold) * (foldCount - i - 1));
+        foldCount++;
+    }
+    else if (removed > 1){
+        memmove(&folds[i + 2], &folds[last + 1], sizeof(struct fold) * (foldCount - last - 1));
+        foldCount -= removed - 1;
+    }
+    folds[i + 1].start = start;
+    folds[i + 1].end = end;
+    countHidden(i + 1);
+    wrapLinesChanged(start, end + 1);
+}
+
+// The count lines from at have been replaced by 'lines' lines: the folds which held any of them are opened
+// and the ones after them moved
+void foldLinesReplaced(int at, int count, int lines){
+    if (foldCount == 0)
+        return;
+    int first = foldBefore(at + count);
+    while (first >= 0 && folds[first].end >= at) // holds a line replaced, or the place of the lines inserted
+        removeFold(first--);
+    for (int i = first + 1; i < foldCount; i++){
+        folds[i].start += lines - count;
+        folds[i].end += lines - count;
+    }
+}
+
+// Opens every fold
+void foldFree(){
+    memFree(mem_tables, folds);
+    folds = NULL;
+    foldCount = foldCapacity = 0;
+    wrapRowsFrom(0);
+}
+
+// Opens the fold hiding the line, if any
+void foldOpen(int line){
+    int i = foldBefore(line);
+    if (i >= 0 && line <= folds[i].end)
+        removeFold(i);
+}
+
+// The highlight state the line ends in
+static unsigned char lineExit(int at){
+    if (at < 0 || at >= openedFileLines)
+        return normal;
+    struct highlightState hs;
+    lineExitState(at, &hs);
+    return exitState(&hs);
+}
+
+// Follows the braces of the line which are code, from a depth of 0: the depth the line ends at and the lowest it goes to
+static void lineBraces(int at, int* end, int* lowest){
+    *end = *lowest = 0;
+    struct outputBuffer* line = &toRenderToScreen[at];
+    if (isLongLine(&fromOpenedFile[at]))
+        return;
+    if (isPendingLine(line))
+        updateStatus(line);
+    struct highlightSpan* span = line->spans;
+    for (int i = 0; i < line->size; i++){
+        char c = line->buf[i];
+        if (c != '{' && c != '}')
+            continue;
+        while (span && span->length && span->start + span->length <= i)
+            span++;
+        if (span && span->length && span->start <= i
+            && (span->state == highlight_comment || span->state == highlight_string))
+            continue;
+        *end += c == '{' ? 1 : -1;
+        if (*end < *lowest)
+            *lowest = *end;
+    }
+}
+
+// The line holding the brace which closes the first brace the line leaves open, -1 when it leaves none or it is never closed
+static int blockEnd(int start){
+    int depth, lowest;
+    lineBraces(start, &depth, &lowest);
+    if (depth <= lowest)
+        return -1;
+    int closed = lowest; // the block is closed once the depth goes back down to that of its brace
+    for (int at = start + 1; at < openedFileLines; at++){
+        int end;
+        lineBraces(at, &end, &lowest);
+        if (depth + lowest <= closed)
+            return at;
+        depth += end;
+    }
+    return -1;
+}
+
+// The last line of the comment going on after the line, -1 when it does not or is never closed
+static int commentEnd(int start){
+    if (!(lineExit(start) & exit_comment))
+        return -1;
+    for (int at = start + 1; at < openedFileLines; at++)
+        if (!(lineExit(at) & exit_comment))
+            return at;
+    return -1;
+}
+
+// Finds the lines to fold around the line: the comment it is in, the block it begins or the block it is in
+// start stays on the screen and the lines after it are hidden up to end
+static int findBlock(int line, int* start, int* end){
+    if ((lineExit(line) & exit_comment) || (lineExit(line - 1) & exit_comment)){
+        *start = line;
+        while (lineExit(*start - 1) & exit_comment)
+            (*start)--;
+        *end = commentEnd(*start);
+        return *end > *start;
+    }
+    *start = line;
+    *end = blockEnd(line) - 1; // the closing line stays on the screen
+    if (*end > *start)
+        return 1;
+    int needed = 0; // braces closed between the line and the one going up, which are yet to be opened
+    for (int at = line - 1; at >= 0; at--){
+        int depth, lowest;
+        lineBraces(at, &depth, &lowest);
+        if (depth - lowest > needed){ // a brace left open around the line
+            *start = at;
+            *end = blockEnd(at) - 1;
+            return *end > *start && *end + 1 >= line;
+        }
+        needed += -lowest - (depth - lowest);
+    }
+    return 0;
+}
+
+// Folds the block or comment at the cursor, or opens the fold which begins there
+void foldToggle(){
+    if (openedFileLines == 0)
+        return;
+    int line = cursorPos.y + rowOffset - 1;
+    int i = foldStartingAt(line);
+    if (i >= 0){
+        loadStatusMessage("Opened %d lines", folds[i].end - folds[i].start);
+        removeFold(i);
+        return;
+    }
+    int start, end;
+    if (!findBlock(line, &start, &end)){
+        loadStatusMessage("Nothing to fold here");
+        return;
+    }
+    addFold(start, end);
+    cursorPos.y = start - rowOffset + 1; // its line is now hidden
+    loadStatusMessage("Folded %d lines", end - start);
+}
+
+// Folds every block and comment which is not in another one, or opens every fold
+void foldAll(){
+    if (foldCount){
+        foldFree();
+        loadStatusMessage("Opened every fold");
+        return;
+    }
+    int closing = 1; // once a brace is never closed, so are the ones after it, they are not followed again
+    for (int at = 0; at < openedFileLines; ){
+        int end = closing ? blockEnd(at) : -1;
+        int depth, lowest;
+        if (end < 0 && closing){
+            lineBraces(at, &depth, &lowest);
+            closing = depth <= lowest;
+        }
+        if (end > at + 1)
+            addFold(at, end - 1);
+        if (end > at){
+            at = end; // the closing line may open the next block
+            continue;
+        }
+        end = commentEnd(at);
+        if (end > at){
+            addFold(at, end);
+            at = end + 1;
+            continue;
+        }
+        at++;
+    }
+    int line = cursorPos.y + rowOffset - 1;
+    cursorPos.y = foldShown(line) - rowOffset + 1;
+    loadStatusMessage("Folded %d blocks, %d lines", foldCount, hiddenLines());
+}
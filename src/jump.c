@@ -0,0 +1,183 @@
+#include "editor.h"
+
+#include <limits.h>
+
+// Going to a line (ctrl+g): the prompt takes a line number, a percentage of the document ('50%')
+// or a byte offset ('@1048576', with k, m or g for KB, MB and GB)
+//
+// a line is found straight from the line tables, a byte offset through an index of the offset of every INDEX_STEP'th line
+// the index is built while the editor waits for a key, a batch at a time, and a jump past its end only walks the lines up to where it lands
+// an edit leaves the index up to date until the line edited
+
+#define INDEX_STEP 64 // lines between two offsets of the index
+#define INDEX_BATCH_TIME 5000 // microseconds of indexing each time the editor waits for a key
+
+static long long* indexOffsets = NULL; // offset in the document of the lines 0, INDEX_STEP, 2 * INDEX_STEP...
+static int indexCount = 0; // offsets which are up to date
+static int indexCapacity = 0;
+
+// The index is that of the document in use (see document.c)
+void lineIndexKeepState(){
+    keepDocumentState(&indexOffsets, sizeof(indexOffsets));
+    keepDocumentState(&indexCount, sizeof(indexCount));
+    keepDocumentState(&indexCapacity, sizeof(indexCapacity));
+}
+
+static int lineBytes(int at){
+    return fromOpenedFile[at].size + 1; // with its line ending, a '\n' as the document is saved: a '\r' openFile() dropped is not counted
+}
+
+// The lines from at have changed, the offsets past it are left to be worked out again
+void lineIndexFrom(int at){
+    int keep = at < 0 ? 0 : at / INDEX_STEP + 1;
+    if (indexCount > keep)
+        indexCount = keep;
+}
+
+void lineIndexFree(){
+    memFree(mem_tables, indexOffsets);
+    indexOffsets = NULL;
+    indexCount = indexCapacity = 0;
+}
+
+// Takes the offsets of the lines kept by the open cache, every step'th line
+void lineIndexRestore(const long long* offsets, int count, int step){
+    if (step != INDEX_STEP || count <= 0 || (long long) (count - 1) * INDEX_STEP > openedFileLines - 1)
+        return;
+    lineIndexFree();
+    indexOffsets = memAlloc(mem_tables, sizeof(long long) * count);
+    if (!indexOffsets)
+        return;
+    memcpy(indexOffsets, offsets, sizeof(long long) * count);
+    indexCount = indexCapacity = count;
+}
+
+// Whether there are lines left out of the index
+int lineIndexPending(){
+    return (long long) indexCount * INDEX_STEP <= openedFileLines - 1 || indexCount == 0;
+}
+
+// Adds offsets to the index until it holds one past offset, it reaches the last line or budget microseconds have passed (0 for no limit)
+static void extendIndex(long long offset, double budget){
+    double start = perfNow();
+    if (indexCount == 0){
+        if (indexCapacity == 0){
+            indexOffsets = memAlloc(mem_tables, sizeof(long long) * 64);
+            if (!indexOffsets)
+                failExit("Could not index the lines");
+            indexCapacity = 64;
+        }
+        indexOffsets[indexCount++] = 0;
+    }
+    while ((long long) indexCount * INDEX_STEP <= openedFileLines - 1 && indexOffsets[indexCount - 1] <= offset){
+        if (indexCount == indexCapacity){
+            long long* grown = memRealloc(mem_tables, indexOffsets, sizeof(long long) * indexCapacity * 2);
+            if (!grown)
+                failExit("Could not index the lines");
+            indexOffsets = grown;
+            indexCapacity *= 2;
+        }
+        long long next = indexOffsets[indexCount - 1];
+        for (int i = (indexCount - 1) * INDEX_STEP; i < indexCount * INDEX_STEP; i++)
+            next += lineBytes(i);
+        indexOffsets[indexCount++] = next;
+        if (budget && indexCount % 1024 == 0 && perfNow() - start > budget)
+            break;
+    }
+}
+
+// Indexes lines for a while, called when the editor waits for a key
+void lineIndexBuild(){
+    extendIndex(LLONG_MAX, INDEX_BATCH_TIME);
+}
+
+// Indexes every line, for the open cache to keep, returns the number of offsets
+int lineIndexAll(const long long** offsets, int* step){
+    extendIndex(LLONG_MAX, 0);
+    *offsets = indexOffsets;
+    *step = INDEX_STEP;
+    return indexCount;
+}
+
+// The line which holds the byte at offset, the last line when the document is shorter
+static int lineAtOffset(long long offset){
+    extendIndex(offset, 0);
+    int low = 0;
+    int high = indexCount - 1;
+    while (low < high){ // the last offset of the index not past offset
+        int mid = (low + high + 1) / 2;
+        if (indexOffsets[mid] <= offset)
+            low = mid;
+        else
+            high = mid - 1;
+    }
+    long long at = indexOffsets[low];
+    int line = low * INDEX_STEP;
+    while (line < openedFileLines - 1 && at + lineBytes(line) <= offset)
+        at += lineBytes(line++);
+    return line;
+}
+
+// Bytes in the whole document
+static long long documentBytes(){
+    if (openedFileLines == 0)
+        return 0;
+    extendIndex(LLONG_MAX, 0);
+    long long bytes = indexOffsets[indexCount - 1];
+    for (int i = (indexCount - 1) * INDEX_STEP; i < openedFileLines; i++)
+        bytes += lineBytes(i);
+    return bytes;
+}
+
+// Puts the cursor on the byte pos of the line, counted from 0, the line is brought to the middle of the screen
+// when it is not on it already
+void showPosition(int line, int pos){
+    if (line > openedFileLines - 1)
+        line = openedFileLines - 1;
+    if (line < 0){
+        rowOffset = colOffset = 0;
+        cursorPos.x = cursorPos.y = 1;
+        return;
+    }
+    int col = lineColumn(&fromOpenedFile[line], pos);
+    if (line < rowOffset || wrapRowOf(line) - wrapRowOf(rowOffset) >= screenrows){
+        rowOffset = line - screenrows / 2;
+        if (rowOffset > openedFileLines - screenrows)
+            rowOffset = openedFileLines - screenrows;
+        if (rowOffset < 0)
+            rowOffset = 0;
+        if (rowsMapped()) // half a screen of rows above it, not lines
+            rowOffset = wrapTop(line, screenrows / 2);
+    }
+    cursorPos.y = line - rowOffset + 1;
+    cursorPos.x = col + 1;
+    colOffset = 0;
+}
+
+// Asks where to go and moves the view there
+void goToLine(){
+    char* input = userPrompt("Go to: %s (line, N%% or @offset, lines ending in LF | ESC to cancel)", NULL);
+    if (input == NULL)
+        return;
+    if (input[0] == '@'){
+        long long offset;
+        if (!memParseSize(input + 1, &offset))
+            loadStatusMessage("Not an offset: %s", input + 1);
+        else
+            showPosition(lineAtOffset(offset), 0);
+    }
+    else {
+        char* end;
+        double value = strtod(input, &end);
+        if (end != input && !strcmp(end, "%") && value >= 0 && value <= 100)
+            showPosition(lineAtOffset(documentBytes() * value / 100), 0);
+        else if (end != input && *end == '\0' && value >= 1 && (value > INT_MAX || value == (int) value)){ // too large for an int: past the end
+            if (value > openedFileLines && streamFd >= 0)
+                loadStatusMessage("Line %.0f has not been read yet, %d lines so far", value, openedFileLines);
+            showPosition(value > openedFileLines ? openedFileLines - 1 : (int) value - 1, 0);
+        }
+        else
+            loadStatusMessage("Not a line, percentage or offset: %s", input);
+    }
+    memFree(mem_misc, input);
+}
@@ -0,0 +1,404 @@
+#include "editor.h"
+
+#include <pthread.h>
+
+// Line commands (ctrl+e): 'sort', 'sort -r', 'uniq', 'reverse', 'grep text' and 'grep -v text' work on whole lines,
+// of the document or of the lines written before the command ('10,200 sort')
+// in a large document the lines are compared, hashed and searched by several threads at once, then only the rows
+// of the line tables are moved (see moveRows() and deleteRows()), and the lines are highlighted again once
+// the threads only read the lines and write to arrays of their own, the memory they use is taken before they start
+
+#define PARALLEL_MIN 65536 // lines under which a command runs on a single thread
+#define THREADS_MAX 16
+
+static const struct outputBuffer* rangeLines; // the first line of the range, which the threads read
+static int descending;
+
+static int threadCount(int lines){
+    if (lines < PARALLEL_MIN)
+        return 1;
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return cores < 1 ? 1 : cores > THREADS_MAX ? THREADS_MAX : cores;
+}
+
+// Runs work on each of count arguments of size bytes, the first on this thread and the others on threads of their own
+static void runThreads(void* (*work)(void*), void* args, size_t size, int count){
+    pthread_t threads[THREADS_MAX];
+    int started[THREADS_MAX] = {0};
+    for (int t = 1; t < count; t++)
+        started[t] = pthread_create(&threads[t], NULL, work, (char*) args + t * size) == 0;
+    work(args);
+    for (int t = 1; t < count; t++){
+        if (started[t])
+            pthread_join(threads[t], NULL);
+        else
+            work((char*) args + t * size); // no thread to be had, done here
+    }
+}
+
+// Gives the text of a line a block at a time: the line itself, or the chunks of a long line, returns 0 past the last one
+static int nextBlock(const struct outputBuffer* line, int* next, const char** text, int* size){
+    if (!isLongLine(line)){
+        *text = line->buf;
+        *size = line->size;
+        return (*next)++ == 0;
+    }
+    struct longLine* ll = longLineOf(line);
+    if (*next >= ll->count)
+        return 0;
+    *text = ll->chunks[*next].text.buf;
+    *size = ll->chunks[*next].text.size;
+    (*next)++;
+    return 1;
+}
+
+// Compares the texts of two lines byte by byte, a line which begins the other comes first
+static int compareLines(const struct outputBuffer* a, const struct outputBuffer* b){
+    if (!isLongLine(a) && !isLongLine(b)){
+        int size = a->size < b->size ? a->size : b->size;
+        int diff = size ? memcmp(a->buf, b->buf, size) : 0;
+        return diff ? diff : a->size - b->size;
+    }
+    int nextA = 0, nextB = 0, sizeA = 0, sizeB = 0;
+    const char* textA = NULL;
+    const char* textB = NULL;
+    while (1){
+        while (sizeA == 0 && nextBlock(a, &nextA, &textA, &sizeA))
+            ;
+        while (sizeB == 0 && nextBlock(b, &nextB, &textB, &sizeB))
+            ;
+        if (sizeA == 0 || sizeB == 0)
+            return (sizeA != 0) - (sizeB != 0);
+        int size = sizeA < sizeB ? sizeA : sizeB;
+        int diff = memcmp(textA, textB, size);
+        if (diff)
+            return diff;
+        textA += size;
+        textB += size;
+        sizeA -= size;
+        sizeB -= size;
+    }
+}
+
+static unsigned long long hashLine(const struct outputBuffer* line){
+    unsigned long long hash = FNV_OFFSET;
+    int next = 0, size;
+    const char* text;
+    while (nextBlock(line, &next, &text, &size))
+        for (int i = 0; i < size; i++)
+            hash = (hash ^ (unsigned char) text[i]) * FNV_PRIME;
+    return hash ^ (hash >> 29);
+}
+
+// Orders the indexes of two lines of the range, lines with the same text keep their order
+static int compareIndexes(const void* x, const void* y){
+    int a = *(const int*) x, b = *(const int*) y;
+    int diff = compareLines(&rangeLines[a], &rangeLines[b]);
+    if (descending)
+        diff = -diff;
+    return diff ? diff : a - b;
+}
+
+struct sortPart {
+    int* index;
+    int count;
+    const int* right; // when merging, the part index is merged with
+    int rightCount;
+    int* out;
+};
+
+static void* sortPart(void* arg){
+    struct sortPart* part = arg;
+    qsort(part->index, part->count, sizeof(int), compareIndexes);
+    return NULL;
+}
+
+static void* mergePart(void* arg){
+    struct sortPart* part = arg;
+    int i = 0, j = 0, k = 0;
+    while (i < part->count && j < part->rightCount)
+        part->out[k++] = compareIndexes(&part->index[i], &part->right[j]) <= 0 ? part->index[i++] : part->right[j++];
+    while (i < part->count)
+        part->out[k++] = part->index[i++];
+    while (j < part->rightCount)
+        part->out[k++] = part->right[j++];
+    return NULL;
+}
+
+// Sorts the indexes of the count lines of the range: each thread sorts a part, then the parts are merged two by two
+// returns index or spare, whichever holds the sorted indexes
+static int* sortIndexes(int* index, int* spare, int count){
+    int threads = threadCount(count);
+    struct sortPart parts[THREADS_MAX];
+    int starts[THREADS_MAX + 1];
+    for (int t = 0; t <= threads; t++)
+        starts[t] = (long long) count * t / threads;
+    for (int t = 0; t < threads; t++)
+        parts[t] = (struct sortPart) {index + starts[t], starts[t + 1] - starts[t], NULL, 0, NULL};
+    runThreads(sortPart, parts, sizeof(struct sortPart), threads);
+
+    for (int width = 1; width < threads; width *= 2){
+        int merges = 0;
+        for (int t = 0; t < threads; t += 2 * width){
+            int middle = t + width < threads ? t + width : threads;
+            int end = t + 2 * width < threads ? t + 2 * width : threads;
+            parts[merges++] = (struct sortPart) {index + starts[t], starts[middle] - starts[t],
+                index + starts[middle], starts[end] - starts[middle], spare + starts[t]};
+        }
+        runThreads(mergePart, parts, sizeof(struct sortPart), merges);
+        int* swap = index;
+        index = spare;
+        spare = swap;
+    }
+    return index;
+}
+
+struct linePart {
+    int from;
+    int to;
+    unsigned long long* hashes;
+    char* drop; // 1 for each line to delete, 2 for a long line left to the caller
+    int* table; // the slots of this part, for the lines whose hash falls in it
+    unsigned long long mask;
+    int parts;
+    int part;
+    const char* query;
+    int queryLength;
+    int invert;
+};
+
+static void* hashPart(void* arg){
+    struct linePart* part = arg;
+    for (int i = part->from; i < part->to; i++)
+        part->hashes[i] = hashLine(&rangeLines[i]);
+    return NULL;
+}
+
+// Walks all the lines of the range and keeps the first of each text among those whose hash falls in the part
+static void* uniqPart(void* arg){
+    struct linePart* part = arg;
+    for (int i = 0; i < part->to; i++){
+        unsigned long long hash = part->hashes[i];
+        if (hash % part->parts != (unsigned long long) part->part)
+            continue;
+        unsigned long long slot = (hash / part->parts) & part->mask;
+        while (part->table[slot] >= 0){
+            int other = part->table[slot];
+            if (part->hashes[other] == hash && compareLines(&rangeLines[other], &rangeLines[i]) == 0)
+                break;
+            slot = (slot + 1) & part->mask;
+        }
+        if (part->table[slot] >= 0)
+            part->drop[i] = 1;
+        else
+            part->table[slot] = i;
+    }
+    return NULL;
+}
+
+static void* grepPart(void* arg){
+    struct linePart* part = arg;
+    for (int i = part->from; i < part->to; i++){
+        const struct outputBuffer* line = &rangeLines[i];
+        if (isLongLine(line)){
+            part->drop[i] = 2;
+            continue;
+        }
+        int found = line->size >= part->queryLength && memmem(line->buf, line->size, part->query, part->queryLength);
+        part->drop[i] = found == part->invert;
+    }
+    return NULL;
+}
+
+// Splits the count lines of the range between the threads and runs work on each part
+static void runParts(void* (*work)(void*), struct linePart* shared, int count){
+    int threads = threadCount(count);
+    struct linePart parts[THREADS_MAX];
+    for (int t = 0; t < threads; t++){
+        parts[t] = *shared;
+        parts[t].from = (long long) count * t / threads;
+        parts[t].to = (long long) count * (t + 1) / threads;
+    }
+    runThreads(work, parts, sizeof(struct linePart), threads);
+}
+
+// Fills drop with the lines of the range whose text an earlier line already has
+static void findDuplicates(char* drop, int count){
+    struct linePart shared = {0};
+    shared.hashes = memAlloc(mem_misc, sizeof(unsigned long long) * count);
+    if (!shared.hashes)
+        failExit("Could not compare the lines");
+    shared.drop = drop;
+    runParts(hashPart, &shared, count);
+
+    // each thread owns the hashes which fall in its part, and a table of twice as many slots as it holds lines
+    int parts = threadCount(count);
+    int sizes[THREADS_MAX] = {0};
+    for (int i = 0; i < count; i++)
+        sizes[shared.hashes[i] % parts]++;
+    size_t offsets[THREADS_MAX + 1] = {0};
+    unsigned long long masks[THREADS_MAX];
+    for (int t = 0; t < parts; t++){
+        unsigned long long slots = 16;
+        while (slots < 2ULL * sizes[t])
+            slots *= 2;
+        masks[t] = slots - 1;
+        offsets[t + 1] = offsets[t] + slots;
+    }
+    int* table = memAlloc(mem_misc, sizeof(int) * offsets[parts]);
+    if (!table)
+        failExit("Could not compare the lines");
+    memset(table, -1, sizeof(int) * offsets[parts]);
+
+    struct linePart part[THREADS_MAX];
+    for (int t = 0; t < parts; t++){
+        part[t] = shared;
+        part[t].to = count;
+        part[t].table = table + offsets[t];
+        part[t].mask = masks[t];
+        part[t].parts = parts;
+        part[t].part = t;
+    }
+    runThreads(uniqPart, part, sizeof(struct linePart), parts);
+    memFree(mem_misc, table);
+    memFree(mem_misc, shared.hashes);
+}
+
+// Fills drop with the lines of the range which hold the query, or which do not when invert is set
+static void findMatching(char* drop, int count, const char* query, int invert){
+    struct linePart shared = {0};
+    shared.drop = drop;
+    shared.query = query;
+    shared.queryLength = strlen(query);
+    shared.invert = invert;
+    runParts(grepPart, &shared, count);
+
+    char* flat = NULL; // long lines are rare, searched here in a copy
+    int flatSize = 0;
+    for (int i = 0; i < count; i++){
+        if (drop[i] != 2)
+            continue;
+        const struct outputBuffer* line = &rangeLines[i];
+        if (line->size + 1 > flatSize){
+            char* grown = memRealloc(mem_misc, flat, line->size + 1);
+            if (!grown)
+                failExit("Could not search the lines");
+            flat = grown;
+            flatSize = line->size + 1;
+        }
+        longLineCopy(longLineOf(line), flat);
+        int found = line->size >= shared.queryLength && memmem(flat, line->size, query, shared.queryLength);
+        drop[i] = found == invert;
+    }
+    memFree(mem_misc, flat);
+}
+
+// Deletes the lines of the range marked in drop, returns how many
+static int dropLines(int from, const char* drop, int count){
+    int dropped = 0;
+    for (int i = 0; i < count; i++)
+        dropped += drop[i];
+    if (dropped == 0)
+        return 0;
+    if (dropped == openedFileLines){
+        loadStatusMessage("No line would be left");
+        return -1;
+    }
+    int* lines = memAlloc(mem_misc, sizeof(int) * dropped);
+    if (!lines)
+        failExit("Could not delete the lines");
+    for (int i = 0, k = 0; i < count; i++)
+        if (drop[i])
+            lines[k++] = from + i;
+    deleteRows(lines, dropped);
+    memFree(mem_misc, lines);
+    return dropped;
+}
+
+// Runs a line command, with the lines to run it on before it, returns the first of those lines or -1 when it cannot be run
+int runLineCommand(const char* input){
+    if (openedFileLines == 0)
+        return -1;
+    int from = 0;
+    int to = openedFileLines - 1;
+    const char* command = input;
+    char* end;
+    if (isdigit((unsigned char) *command)){ // 'from,to command', counted from 1 and inclusive
+        from = strtol(command, &end, 10) - 1;
+        to = from;
+        if (*end == ','){
+            command = end + 1;
+            to = strtol(command, &end, 10) - 1;
+        }
+        command = end;
+        if (from < 0)
+            from = 0;
+        if (to > openedFileLines - 1)
+            to = openedFileLines - 1;
+    }
+    while (*command == ' ')
+        command++;
+    int count = to - from + 1;
+    if (count <= 0){
+        loadStatusMessage("No such lines");
+        return -1;
+    }
+    rangeLines = &fromOpenedFile[from];
+    TRACE_BEGIN(trace_lines);
+
+    if (strcmp(command, "sort") == 0 || strcmp(command, "sort -r") == 0 || strcmp(command, "reverse") == 0){
+        int* index = memAlloc(mem_misc, sizeof(int) * count);
+        int* spare = memAlloc(mem_misc, sizeof(int) * count);
+        if (!index || !spare)
+            failExit("Could not sort the lines");
+        int reverse = command[0] == 'r';
+        for (int i = 0; i < count; i++)
+            index[i] = reverse ? count - 1 - i : i;
+        int* order = index;
+        if (!reverse){
+            descending = command[4] != '\0';
+            order = sortIndexes(index, spare, count);
+        }
+        undoBoundary();
+        moveRows(from, count, order);
+        memFree(mem_misc, index);
+        memFree(mem_misc, spare);
+        loadStatusMessage("%s %d lines", reverse ? "Reversed" : "Sorted", count);
+    }
+    else if (strcmp(command, "uniq") == 0 || strncmp(command, "grep ", 5) == 0){
+        char* drop = memAlloc(mem_misc, count);
+        if (!drop)
+            failExit("Could not compare the lines");
+        memset(drop, 0, count);
+        if (command[0] == 'u')
+            findDuplicates(drop, count);
+        else {
+            int invert = strncmp(command + 5, "-v ", 3) == 0;
+            findMatching(drop, count, command + (invert ? 8 : 5), invert);
+        }
+        undoBoundary();
+        int dropped = dropLines(from, drop, count);
+        if (dropped >= 0)
+            loadStatusMessage("Deleted %d lines", dropped);
+        memFree(mem_misc, drop);
+    }
+    else {
+        loadStatusMessage("Not a line command: %s", command);
+        from = -1;
+    }
+    TRACE_END(trace_lines);
+    return from;
+}
+
+// Asks for a line command and runs it
+void lineCommand(){
+    if (openedFileLines == 0)
+        return;
+    char* input = userPrompt("Lines: %s (sort [-r], uniq, reverse, grep [-v] text)", NULL);
+    if (input == NULL)
+        return;
+    int from = runLineCommand(input);
+    if (from >= 0)
+        showPosition(from, 0);
+    memFree(mem_misc, input);
+}
@@ -0,0 +1,476 @@
+#include "editor.h"
+
+// Long lines, as found in minified code or a single line JSON
+// the line is kept in chunks of a few KB, each knowing the index of its first character, the column it is
+// rendered from and the highlighter state it begins in
+// an edit moves the characters of one chunk and shifts the starts and columns of the following chunks,
+// a column is found by a binary search over the chunks, and only the chunks under the screen are rendered
+// so the work done is linear in the number of chunks at worst, never in the number of characters
+
+#define CHUNK_SIZE 4096 // characters a line is cut into
+#define CHUNK_MAX (2 * CHUNK_SIZE) // a chunk which grows to this is split in two
+#define LOOKAHEAD 16 // characters past a chunk the highlighter may read, longer than any keyword
+
+// scratch room shared by every long line, a chunk is rendered and highlighted here
+static char* scratchText = NULL;
+static unsigned char* scratchState = NULL;
+static int scratchSize = 0;
+
+static void reserveScratch(int size){
+    if (size <= scratchSize)
+        return;
+    char* text = memRealloc(mem_render, scratchText, size);
+    if (text)
+        scratchText = text;
+    unsigned char* state = memRealloc(mem_render, scratchState, size);
+    if (state)
+        scratchState = state;
+    if (!text || !state)
+        failExit("Could not render a long line");
+    scratchSize = size;
+}
+
+static void reserveChunks(struct longLine* ll, int count){
+    if (count <= ll->capacity)
+        return;
+    int capacity = ll->capacity ? ll->capacity + ll->capacity / 2 : 16;
+    if (capacity < count)
+        capacity = count;
+    struct lineChunk* chunks = memRealloc(mem_lines, ll->chunks, sizeof(struct lineChunk) * capacity);
+    if (!chunks)
+        failExit("Could not allocate a long line");
+    ll->chunks = chunks;
+    ll->capacity = capacity;
+}
+
+// Returns the rendered columns of text starting at column 'col', counting its tabs
+static int textWidth(const char* text, int size, int col, int* tabs){
+    int idx = col;
+    *tabs = 0;
+    for (int i = 0; i < size; i++){
+        idx++;
+        if (text[i] == '\t'){
+            (*tabs)++;
+            while (idx % TAB_SPACES != 0)
+                idx++;
+        }
+    }
+    return idx - col;
+}
+
+static int sameState(const struct highlightState* a, const struct highlightState* b){
+    return a->carry == b->carry && a->carryState == b->carryState && a->quote == b->quote
+           && a->comment == b->comment && a->lineComment == b->lineComment && a->prevWhite == b->prevWhite;
+}
+
+// Index of the chunk holding the character at pos, the last chunk for the end of the line
+static int chunkAt(struct longLine* ll, int pos){
+    int low = 0, high = ll->count - 1;
+    while (low < high){
+        int mid = (low + high + 1) / 2;
+        if (ll->chunks[mid].start <= pos)
+            low = mid;
+        else
+            high = mid - 1;
+    }
+    return low;
+}
+
+// Index of the chunk holding the rendered column col
+static int chunkAtCol(struct longLine* ll, int col){
+    int low = 0, high = ll->count - 1;
+    while (low < high){
+        int mid = (low + high + 1) / 2;
+        if (ll->chunks[mid].col <= col)
+            low = mid;
+        else
+            high = mid - 1;
+    }
+    return low;
+}
+
+// Sets the columns of the chunks from 'from' onwards, each following the one before it
+// a chunk rendered from a column of another tab stop has to be measured again
+static void shiftColumns(struct longLine* ll, int from){
+    for (int c = from; c < ll->count; c++){
+        struct lineChunk* chunk = &ll->chunks[c];
+        int col = c ? ll->chunks[c - 1].col + ll->chunks[c - 1].width : 0;
+        int shift = col - chunk->col;
+        if (shift == 0 && c > from)
+            break; // the rest of the line is where it was
+        chunk->col = col;
+        if (chunk->tabs && shift % TAB_SPACES != 0)
+            chunk->width = textWidth(chunk->text.buf, chunk->text.size, chunk->col, &chunk->tabs);
+    }
+    struct lineChunk* last = &ll->chunks[ll->count - 1];
+    ll->width = last->col + last->width;
+}
+
+// The text of chunk c has changed: measures it again and marks it to be highlighted again
+static void chunkChanged(struct longLine* ll, int c){
+    struct lineChunk* chunk = &ll->chunks[c];
+    chunk->width = textWidth(chunk->text.buf, chunk->text.size, chunk->col, &chunk->tabs);
+    shiftColumns(ll, c + 1);
+    if (c < ll->highlightFrom)
+        ll->highlightFrom = c;
+    if (c > ll->highlightTo)
+        ll->highlightTo = c;
+    ll->windowCol = -1;
+}
+
+// Makes room for a chunk at index c, holding no text yet
+static void insertChunk(struct longLine* ll, int c){
+    reserveChunks(ll, ll->count + 1);
+    memmove(&ll->chunks[c + 1], &ll->chunks[c], sizeof(struct lineChunk) * (ll->count - c));
+    memset(&ll->chunks[c], 0, sizeof(struct lineChunk));
+    ll->count++;
+    if (ll->highlightFrom >= c)
+        ll->highlightFrom++;
+    if (ll->highlightTo >= c)
+        ll->highlightTo++;
+}
+
+// Cuts chunk c before its character 'at', the rest goes to a new chunk after it
+static void splitChunk(struct longLine* ll, int c, int at){
+    insertChunk(ll, c + 1);
+    struct lineChunk* chunk = &ll->chunks[c];
+    struct lineChunk* next = &ll->chunks[c + 1];
+    int size = chunk->text.size - at;
+    lineReserve(mem_lines, &next->text, size ? size : 1);
+    memcpy(next->text.buf, &chunk->text.buf[at], size);
+    next->text.size = size;
+    next->start = chunk->start + at;
+    next->entry = chunk->entry; // until it is highlighted
+    chunk->text.size = at;
+    chunk->width = textWidth(chunk->text.buf, chunk->text.size, chunk->col, &chunk->tabs);
+    next->col = chunk->col + chunk->width;
+    next->width = textWidth(next->text.buf, next->text.size, next->col, &next->tabs);
+    if (c < ll->highlightFrom)
+        ll->highlightFrom = c;
+    if (c + 1 > ll->highlightTo)
+        ll->highlightTo = c + 1;
+}
+
+// Keeps the given text in chunks of CHUNK_SIZE characters
+struct longLine* longLineCreate(const char* text, int size){
+    struct longLine* ll = memAlloc(mem_lines, sizeof(struct longLine));
+    if (!ll)
+        failExit("Could not allocate a long line");
+    memset(ll, 0, sizeof(struct longLine));
+    int count = size ? (size + CHUNK_SIZE - 1) / CHUNK_SIZE : 1;
+    reserveChunks(ll, count);
+    memset(ll->chunks, 0, sizeof(struct lineChunk) * count);
+    ll->count = count;
+    for (int c = 0; c < count; c++){
+        struct lineChunk* chunk = &ll->chunks[c];
+        chunk->start = c * CHUNK_SIZE;
+        chunk->text.size = (size - chunk->start < CHUNK_SIZE) ? size - chunk->start : CHUNK_SIZE;
+        lineReserve(mem_lines, &chunk->text, chunk->text.size ? chunk->text.size : 1);
+        memcpy(chunk->text.buf, &text[chunk->start], chunk->text.size);
+        chunk->col = c ? ll->chunks[c - 1].col + ll->chunks[c - 1].width : 0;
+        chunk->width = textWidth(chunk->text.buf, chunk->text.size, chunk->col, &chunk->tabs);
+    }
+    ll->size = size;
+    ll->width = ll->chunks[count - 1].col + ll->chunks[count - 1].width;
+    ll->highlightFrom = 0; // nothing has been highlighted yet
+    ll->highlightTo = count - 1;
+    ll->windowCol = -1;
+    return ll;
+}
+
+void longLineFree(struct longLine* ll){
+    if (!ll)
+        return;
+    for (int c = 0; c < ll->count; c++)
+        lineFree(mem_lines, ll->chunks[c].text.buf, ll->chunks[c].text.capacity);
+    lineFree(mem_render, ll->window.buf, ll->window.capacity);
+    memFree(mem_lines, ll->chunks);
+    memFree(mem_lines, ll);
+}
+
+// Writes the 'size' characters of the line to dest
+void longLineCopy(struct longLine* ll, char* dest){
+    for (int c = 0; c < ll->count; c++){
+        memcpy(dest, ll->chunks[c].text.buf, ll->chunks[c].text.size);
+        dest += ll->chunks[c].text.size;
+    }
+}
+
+// The character at pos (0 <= pos < size)
+int longLineChar(struct longLine* ll, int pos){
+    struct lineChunk* chunk = &ll->chunks[chunkAt(ll, pos)];
+    return (unsigned char) chunk->text.buf[pos - chunk->start];
+}
+
+// The rendered column (0 based) of the character at pos, the end of the line for pos == size
+int longLineColumn(struct longLine* ll, int pos){
+    struct lineChunk* chunk = &ll->chunks[chunkAt(ll, pos)];
+    int tabs;
+    return chunk->col + textWidth(chunk->text.buf, pos - chunk->start, chunk->col, &tabs);
+}
+
+// Inserts a character before the character at pos, at the end of the line if pos is out of its bounds
+void longLineInsert(struct longLine* ll, int pos, int c){
+    if (pos < 0 || pos > ll->size)
+        pos = ll->size;
+    int k = chunkAt(ll, pos);
+    struct lineChunk* chunk = &ll->chunks[k];
+    int at = pos - chunk->start;
+    lineReserve(mem_lines, &chunk->text, chunk->text.size + 1);
+    memmove(&chunk->text.buf[at + 1], &chunk->text.buf[at], chunk->text.size - at);
+    chunk->text.buf[at] = c;
+    chunk->text.size++;
+    ll->size++;
+    for (int i = k + 1; i < ll->count; i++)
+        ll->chunks[i].start++;
+    chunkChanged(ll, k);
+    if (chunk->text.size >= CHUNK_MAX)
+        splitChunk(ll, k, chunk->text.size / 2);
+}
+
+// Deletes the character at pos
+void longLineDelete(struct longLine* ll, int pos){
+    if (pos < 0 || pos >= ll->size)
+        return;
+    int k = chunkAt(ll, pos);
+    struct lineChunk* chunk = &ll->chunks[k];
+    int at = pos - chunk->start;
+    memmove(&chunk->text.buf[at], &chunk->text.buf[at + 1], chunk->text.size - at - 1);
+    chunk->text.size--;
+    ll->size--;
+    for (int i = k + 1; i < ll->count; i++)
+        ll->chunks[i].start--;
+    if (chunk->text.size == 0 && ll->count > 1){
+        // an empty chunk is let go of, the one after it begins in the state it began in
+        lineFree(mem_lines, chunk->text.buf, chunk->text.capacity);
+        if (k + 1 < ll->count)
+            ll->chunks[k + 1].entry = chunk->entry;
+        memmove(&ll->chunks[k], &ll->chunks[k + 1], sizeof(struct lineChunk) * (ll->count - k - 1));
+        ll->count--;
+        if (ll->highlightFrom > k)
+            ll->highlightFrom--;
+        if (ll->highlightTo > k)
+            ll->highlightTo--;
+        if (k == 0)
+            ll->chunks[0].col = 0;
+        k = k ? k - 1 : 0;
+    }
+    chunkChanged(ll, k);
+}
+
+// Cuts the line before the character at pos (0 < pos <= size), the rest of the line is returned as a new long line
+struct longLine* longLineSplit(struct longLine* ll, int pos){
+    int k = chunkAt(ll, pos);
+    if (pos > ll->chunks[k].start){
+        splitChunk(ll, k, pos - ll->chunks[k].start);
+        k++;
+    }
+    struct longLine* tail = memAlloc(mem_lines, sizeof(struct longLine));
+    if (!tail)
+        failExit("Could not allocate a long line");
+    memset(tail, 0, sizeof(struct longLine));
+    reserveChunks(tail, ll->count - k);
+    memcpy(tail->chunks, &ll->chunks[k], sizeof(struct lineChunk) * (ll->count - k));
+    tail->count = ll->count - k;
+    tail->size = ll->size - pos;
+    for (int c = 0; c < tail->count; c++)
+        tail->chunks[c].start -= pos;
+    shiftColumns(tail, 0);
+    // the entry states of the moved chunks still hold, once the first one is highlighted from the state the tail begins in
+    tail->exit = ll->exit;
+    tail->highlightFrom = 0;
+    tail->highlightTo = 0;
+    tail->windowCol = -1;
+
+    ll->count = k;
+    ll->size = pos;
+    chunkChanged(ll, k - 1);
+    return tail;
+}
+
+// Appends the text of tail to the line, tail is let go of
+void longLineJoin(struct longLine* ll, struct longLine* tail){
+    if (ll->size == 0){ // an empty line holds a single empty chunk
+        lineFree(mem_lines, ll->chunks[0].text.buf, ll->chunks[0].text.capacity);
+        ll->count = 0;
+    }
+    int first = ll->count;
+    if (tail->size){
+        reserveChunks(ll, ll->count + tail->count);
+        memcpy(&ll->chunks[first], tail->chunks, sizeof(struct lineChunk) * tail->count);
+        for (int c = first; c < first + tail->count; c++)
+            ll->chunks[c].start += ll->size;
+        ll->count += tail->count;
+        ll->size += tail->size;
+        ll->exit = tail->exit;
+        shiftColumns(ll, first);
+        if (tail->highlightFrom < tail->count){ // the tail was not highlighted yet
+            if (first + tail->highlightFrom < ll->highlightFrom)
+                ll->highlightFrom = first + tail->highlightFrom;
+            if (first + tail->highlightTo > ll->highlightTo)
+                ll->highlightTo = first + tail->highlightTo;
+        }
+    }
+    else
+        lineFree(mem_lines, tail->chunks[0].text.buf, tail->chunks[0].text.capacity);
+    lineFree(mem_render, tail->window.buf, tail->window.capacity);
+    memFree(mem_lines, tail->chunks);
+    memFree(mem_lines, tail);
+    if (ll->count == 0){ // both were empty
+        reserveChunks(ll, 1);
+        memset(&ll->chunks[0], 0, sizeof(struct lineChunk));
+        lineReserve(mem_lines, &ll->chunks[0].text, 1);
+        ll->count = 1;
+        ll->width = 0;
+    }
+    // the chunk before the joint is highlighted again, which gives the state the tail now begins in
+    int c = first ? first - 1 : 0;
+    if (c < ll->highlightFrom)
+        ll->highlightFrom = c;
+    if (c > ll->highlightTo)
+        ll->highlightTo = c;
+    ll->windowCol = -1;
+}
+
+// Same as zeroTabs(): maps the rendered position *xPos (1 based) to the index of its character (1 based) in *xPos
+// and returns the rendered position of that character
+int longLineZeroTabs(struct longLine* ll, int* xPos){
+    int target = *xPos - 1;
+    int c = chunkAtCol(ll, target);
+    int i = ll->chunks[c].start;
+    int idx = ll->chunks[c].col;
+    for (; c < ll->count && idx < target; c++){
+        struct lineChunk* chunk = &ll->chunks[c];
+        for (int k = 0; k < chunk->text.size && idx < target; k++, i++){
+            idx++;
+            if (chunk->text.buf[k] == '\t')
+                while (idx % TAB_SPACES != 0)
+                    idx++;
+        }
+    }
+    *xPos = i + 1;
+    return idx + 1;
+}
+
+// Renders chunk c into dest, tabs expanded to spaces, returns the columns written
+static int renderChunk(struct longLine* ll, int c, char* dest){
+    struct lineChunk* chunk = &ll->chunks[c];
+    if (chunk->tabs == 0){
+        memcpy(dest, chunk->text.buf, chunk->text.size);
+        return chunk->text.size;
+    }
+    int idx = 0;
+    for (int i = 0; i < chunk->text.size; i++){
+        if (chunk->text.buf[i] == '\t'){
+            dest[idx++] = ' ';
+            while ((chunk->col + idx) % TAB_SPACES != 0)
+                dest[idx++] = ' ';
+        }
+        else
+            dest[idx++] = chunk->text.buf[i];
+    }
+    return idx;
+}
+
+// Renders chunk c into the scratch text and highlights it from the state in hs, which is left at the end of the chunk
+// the highlighter may look at the characters following the chunk, a tab is as good as a space to it
+static void highlightChunk(struct longLine* ll, int c, struct highlightState* hs){
+    int width = ll->chunks[c].width;
+    reserveScratch(width + LOOKAHEAD + 1);
+    renderChunk(ll, c, scratchText);
+    int limit = width;
+    for (int n = c + 1; n < ll->count && limit < width + LOOKAHEAD; n++)
+        for (int i = 0; i < ll->chunks[n].text.size && limit < width + LOOKAHEAD; i++)
+            scratchText[limit++] = ll->chunks[n].text.buf[i] == '\t' ? ' ' : ll->chunks[n].text.buf[i];
+    scratchText[limit] = '\0';
+    highlightText(scratchText, width, limit, hs, scratchState);
+}
+
+// Brings the entry states of the chunks up to date, the line begins in the given state
+// only the chunks after an edit are highlighted, until one begins in the state it began in before
+void longLineHighlight(struct longLine* ll, const struct highlightState* entry){
+    if (!sameState(&ll->chunks[0].entry, entry)){
+        ll->chunks[0].entry = *entry;
+        ll->highlightFrom = 0;
+    }
+    for (int c = ll->highlightFrom; c < ll->count; c++){
+        struct highlightState hs = ll->chunks[c].entry;
+        highlightChunk(ll, c, &hs);
+        if (c == ll->count - 1)
+            ll->exit = exitState(&hs);
+        else if (c >= ll->highlightTo && sameState(&hs, &ll->chunks[c + 1].entry))
+            break; // the rest of the line is highlighted as it was
+        else
+            ll->chunks[c + 1].entry = hs;
+        ll->windowCol = -1;
+    }
+    ll->highlightFrom = ll->count;
+    ll->highlightTo = -1;
+}
+
+// Returns the 'width' rendered columns of the line from 'col' on, with their highlight spans
+// the window is kept until the line changes or other columns are asked for
+struct outputBuffer* longLineWindow(struct longLine* ll, int col, int width){
+    struct outputBuffer* window = &ll->window;
+    if (ll->windowCol == col && ll->windowWidth == width)
+        return window;
+
+    static unsigned char* state = NULL; // states of the window's columns
+    static int stateSize = 0;
+    int end = (col + width < ll->width) ? col + width : ll->width;
+    int size = (end > col) ? end - col : 0;
+    if (size > stateSize){
+        unsigned char* grown = memRealloc(mem_render, state, size);
+        if (!grown)
+            failExit("Could not render a long line");
+        state = grown;
+        stateSize = size;
+    }
+    lineReserve(mem_render, window, size + 1);
+    window->size = 0;
+    for (int c = chunkAtCol(ll, col); window->size < size && c < ll->count; c++){
+        struct highlightState hs = ll->chunks[c].entry;
+        highlightChunk(ll, c, &hs);
+        int from = col + window->size - ll->chunks[c].col; // first column of the chunk in the window
+        int len = ll->chunks[c].width - from;
+        if (len > size - window->size)
+            len = size - window->size;
+        if (len <= 0)
+            continue;
+        memcpy(&window->buf[window->size], &scratchText[from], len);
+        memcpy(&state[window->size], &scratchState[from], len);
+        window->size += len;
+    }
+    window->buf[window->size] = '\0';
+    storeSpans(window, state, normal);
+    ll->windowCol = col;
+    ll->windowWidth = width;
+    return window;
+}
+
+// Returns the rendered column of the first occurence of query from column fromCol on, -1 if there is none
+// each chunk is searched together with enough of the following ones to hold a match which begins in it
+int longLineFind(struct longLine* ll, const char* query, int fromCol){
+    int len = strlen(query);
+    if (fromCol < 0)
+        fromCol = 0;
+    if (fromCol > ll->width)
+        return -1;
+    for (int c = chunkAtCol(ll, fromCol); c < ll->count; c++){
+        int width = ll->chunks[c].width;
+        int last = c + 1;
+        int total = width;
+        while (last < ll->count && total < width + len)
+            total += ll->chunks[last++].width;
+        reserveScratch(total + 1);
+        int idx = 0;
+        for (int n = c; n < last; n++)
+            idx += renderChunk(ll, n, &scratchText[idx]);
+        scratchText[idx] = '\0';
+        int from = fromCol - ll->chunks[c].col;
+        char* match = strstr(&scratchText[from > 0 ? from : 0], query);
+        if (match && match - scratchText < width)
+            return ll->chunks[c].col + (match - scratchText);
+    }
+    return -1;
+}
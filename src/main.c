@@ -1,17 +1,48 @@
 #include "editor.h"
 
 // if you run 'bin/main.o absolutepath/xxx.txt', It should open text file.
+// 'bin/main.o --trace trace.json xxx.txt' (or EDITOR_TRACE=trace.json) records a trace of the session
+// 'bin/main.o --follow xxx.log' keeps adding the lines appended to the file
+// 'bin/main.o a.c b.c' opens each file in a document of its own (ctrl+n goes from one to the next)
+// 'bin/main.o --batch script a.conf b.conf' edits the files with the commands of the script, without a terminal
 int main (int argc, char* argv[]) {
+    int arg = 1;
+    int follow = 0;
+    while (argc > arg){
+        if (argc > arg + 1 && !strcmp(argv[arg], "--trace")){
+            traceInit(argv[arg + 1]);
+            arg += 2;
+        }
+        else if (argc > arg + 1 && !strcmp(argv[arg], "--batch"))
+            return batchRun(argv[arg + 1], &argv[arg + 2], argc - arg - 2);
+        else if (!strcmp(argv[arg], "--follow")){
+            follow = 1;
+            arg++;
+        }
+        else
+            break;
+    }
+    if (!traceEnabled && getenv("EDITOR_TRACE"))
+        traceInit(getenv("EDITOR_TRACE"));
+    
     // First turn of Echo mode and canonical mode
     turnOfFlags();
     editorInit();
-    loadStatusMessage("Try: ctrl+Q to quit | ctrl+s to save | ctrl+f to search");
-    if (argc > 1)
-        openFile(argv[1]);
+    loadStatusMessage("Try: ctrl+Q to quit | ctrl+s to save | ctrl+f to search | ctrl+g to go to");
+    if (argc > arg && follow)
+        followFile(argv[arg]);
+    else if (argc > arg){
+        openFile(argv[arg]);
+        for (int i = arg + 1; i < argc; i++) // the other files in documents of their own, the first is shown
+            documentOpen(argv[i]);
+        if (argc > arg + 1)
+            documentNext();
+    }
     
     refresh();
     while (1) {
         processKey();
+        documentsKeepBudget();
         refresh();
     }
     return 0;
@@ -0,0 +1,134 @@
+#include "editor.h"
+
+#include <limits.h>
+
+// Memory accounting, every allocation of the editor goes through memAlloc() / memRealloc() / memFree()
+// which keep the bytes and blocks held by each subsystem, shown by the status bar when the overlay is on (ctrl+t)
+// Bytes are what the allocator really holds: the usable size of each block plus its header
+
+#if defined(__APPLE__)
+#include <malloc/malloc.h>
+#define memBlockSize(ptr) ((ptr) ? malloc_size(ptr) : 0)
+#elif defined(__GLIBC__)
+#include <malloc.h>
+#define memBlockSize(ptr) malloc_usable_size(ptr)
+#else
+#define memBlockSize(ptr) 0 // no way to ask the allocator, only the blocks are counted
+#endif
+
+#define MEM_BLOCK_HEADER sizeof(size_t) // bookkeeping the allocator keeps in front of each block
+
+int memOverlay = 0;
+struct memStat memStats[mem_subsystems];
+
+static const char* memNames[mem_subsystems] = {"lines", "render", "tables", "screen", "frames", "misc", "undo"};
+
+// Moves the accounting of a subsystem from a block of 'oldSize' usable bytes to one of 'newSize'
+// the counts are updated atomically, the threads of find in files (see find.c) allocate while the editor goes on
+static void memAccount(int subsystem, size_t oldSize, int oldBlock, size_t newSize, int newBlock){
+    struct memStat* stat = &memStats[subsystem];
+    unsigned long bytes = __atomic_add_fetch(&stat->bytes,
+                                             (newSize + newBlock * MEM_BLOCK_HEADER) - (oldSize + oldBlock * MEM_BLOCK_HEADER),
+                                             __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stat->blocks, newBlock - oldBlock, __ATOMIC_RELAXED);
+    unsigned long peak = __atomic_load_n(&stat->peak, __ATOMIC_RELAXED);
+    while (bytes > peak && !__atomic_compare_exchange_n(&stat->peak, &peak, bytes, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+void* memAlloc(int subsystem, size_t size){
+    void* ptr = malloc(size);
+    if (ptr)
+        memAccount(subsystem, 0, 0, memBlockSize(ptr), 1);
+    return ptr;
+}
+
+// Same as realloc(), a size of 0 frees the block and returns NULL
+// on failure the old block is kept and NULL is returned
+void* memRealloc(int subsystem, void* ptr, size_t size){
+    if (size == 0){
+        memFree(subsystem, ptr);
+        return NULL;
+    }
+    size_t oldSize = memBlockSize(ptr);
+    void* res = realloc(ptr, size);
+    if (res)
+        memAccount(subsystem, oldSize, ptr != NULL, memBlockSize(res), 1);
+    return res;
+}
+
+void memFree(int subsystem, void* ptr){
+    if (!ptr)
+        return;
+    memAccount(subsystem, memBlockSize(ptr), 1, 0, 0);
+    free(ptr);
+}
+
+char* memStrdup(int subsystem, const char* str){
+    size_t len = strlen(str) + 1;
+    char* copy = memAlloc(subsystem, len);
+    if (copy)
+        memcpy(copy, str, len);
+    return copy;
+}
+
+// Writes a size with a unit, e.g. 512B, 12.4K, 3.1M, 8.0G
+int memSizeString(char* str, int size, double bytes){
+    if (bytes < 1024)
+        return snprintf(str, size, "%.0fB", bytes);
+    if (bytes < 1024 * 1024)
+        return snprintf(str, size, "%.1fK", bytes / 1024);
+    if (bytes < 1024.0 * 1024 * 1024)
+        return snprintf(str, size, "%.1fM", bytes / (1024 * 1024));
+    return snprintf(str, size, "%.1fG", bytes / (1024.0 * 1024 * 1024));
+}
+
+// Reads a size in bytes, e.g. 512, 64k, 12M, 2g (the units are powers of 1024)
+// returns 0 when the text is not a size or the size does not fit in a long long
+int memParseSize(const char* str, long long* bytes){
+    char* end;
+    errno = 0;
+    long long value = strtoll(str, &end, 10);
+    if (end == str || value < 0 || errno == ERANGE)
+        return 0;
+    long long unit = 1;
+    switch (tolower((unsigned char) *end)){
+        case 'g': unit *= 1024;
+        // fall through
+        case 'm': unit *= 1024;
+        // fall through
+        case 'k': unit *= 1024;
+            end++;
+    }
+    if (*end != '\0' || value > LLONG_MAX / unit)
+        return 0;
+    *bytes = value * unit;
+    return 1;
+}
+
+// Writes the overlay: the text of the document, then for each subsystem its bytes, blocks
+// and their ratio to the text, followed by the total per line
+// frames only live during a refresh, so their peak is shown instead
+int memOverlayString(char* str, int size){
+    double text = 0, total = 0;
+    for (int i = 0; i < openedFileLines; i++)
+        text += fromOpenedFile[i].size;
+    int len = snprintf(str, size, "text ");
+    len += memSizeString(&str[len], size - len, text);
+    for (int i = 0; i < mem_subsystems && len < size; i++){
+        struct memStat stat = {__atomic_load_n(&memStats[i].bytes, __ATOMIC_RELAXED),
+                               __atomic_load_n(&memStats[i].blocks, __ATOMIC_RELAXED),
+                               __atomic_load_n(&memStats[i].peak, __ATOMIC_RELAXED)};
+        double bytes = (i == mem_frames) ? stat.peak : stat.bytes;
+        total += stat.bytes;
+        len += snprintf(&str[len], size - len, " | %s ", memNames[i]);
+        if (len < size)
+            len += memSizeString(&str[len], size - len, bytes);
+        if (len < size)
+            len += snprintf(&str[len], size - len, " %lu %.1fx", stat.blocks, text ? bytes / text : 0);
+    }
+    if (len < size)
+        len += snprintf(&str[len], size - len, " | %.1fx %.0fB/ln",
+                        text ? total / text : 0, openedFileLines ? total / openedFileLines : 0);
+    return len < size ? len : size - 1;
+}
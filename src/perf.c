@@ -0,0 +1,61 @@
+#include "editor.h"
+
+// Timing of the editor's hot paths, shown by the status bar when the overlay is on (ctrl+p)
+// While the overlay is off, PERF_BEGIN / PERF_END only test a flag
+
+int perfOverlay = 0;
+struct perfStat perfStats[perf_stages];
+unsigned long perfHighlightedLines;
+unsigned long perfLastHighlightedLines;
+
+static const char* perfNames[perf_stages] = {"in", "ed", "hl", "rows", "out"};
+static int perfHistoryPos;
+
+// Current time in microseconds
+double perfNow(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+void perfBegin(int stage){
+    perfStats[stage].start = perfNow();
+}
+
+// Adds the time since perfBegin() to the stage, ending a stage which has not begun does nothing
+void perfEnd(int stage){
+    struct perfStat* stat = &perfStats[stage];
+    if (stat->start == 0)
+        return;
+    stat->current += perfNow() - stat->start;
+    stat->start = 0;
+}
+
+// Closes the frame: what was accumulated becomes the last value and joins the rolling average
+void perfFrame(){
+    for (int i = 0; i < perf_stages; i++){
+        struct perfStat* stat = &perfStats[i];
+        stat->last = stat->current;
+        stat->history[perfHistoryPos] = stat->current;
+        stat->current = 0;
+        double sum = 0;
+        for (int j = 0; j < PERF_HISTORY; j++)
+            sum += stat->history[j];
+        stat->average = sum / PERF_HISTORY;
+    }
+    perfHistoryPos = (perfHistoryPos + 1) % PERF_HISTORY;
+    perfLastHighlightedLines = perfHighlightedLines;
+    perfHighlightedLines = 0;
+}
+
+// Writes the overlay, last/average microseconds of each stage followed by the size of the last frame
+int perfOverlayString(char* str, int size){
+    int len = 0;
+    for (int i = 0; i < perf_stages && len < size; i++)
+        len += snprintf(&str[len], size - len, "%s %.0f/%.0f ",
+                        perfNames[i], perfStats[i].last, perfStats[i].average);
+    if (len < size)
+        len += snprintf(&str[len], size - len, "us %luB %luln",
+                        lastFrameBytes, perfLastHighlightedLines);
+    return len < size ? len : size - 1;
+}
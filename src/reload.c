@@ -0,0 +1,511 @@
+#include "editor.h"
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+// External changes: the opened file is watched, and when another process rewrites it the document takes in what changed
+// the file is cut into chunks of lines and only the hashes of the chunks are kept, for the file as it was last read or saved
+// a change is found by hashing the file again and lining the chunks up with the kept ones,
+// only the lines of the chunks which differ are read and replaced, so the rest keeps its highlighting and the cursor stays put
+// with unsaved edits the document is hashed as well, a change is taken in only where the document still holds what the file held,
+// where both have changed the edits are kept and the save which would have overwritten the other change has to be repeated
+//
+// the chunks end after lines whose hash ends in CHUNK_MASK zero bits, so an inserted line only moves the chunk it is in
+// (without inotify the file is only looked at before it is saved)
+
+#define CHUNK_MASK 63 // a chunk holds about 64 lines
+#define CHUNK_LINES_MAX 4096 // a run of lines which never end a chunk, like empty lines, is still cut
+#define SCAN_READ (1024 * 1024) // bytes read from the file at once when hashing it
+
+struct fileChunk {
+    unsigned long long hash;
+    int lines;
+    long long offset; // in the file, for the chunks of the file
+};
+
+// cuts text into chunks as it is fed, in pieces of any size
+struct chunker {
+    struct fileChunk* chunks;
+    int count;
+    int capacity;
+    unsigned long long hash; // of the chunk so far
+    int lines; // in the chunk so far
+    long long start; // offset of the chunk
+    long long offset; // offset of the next line
+    unsigned long long lineHash; // of the line so far
+    long long lineBytes;
+    int returns; // '\r' at the end of the line so far, they are only hashed if the line goes on
+};
+
+int fileWatchFd = -1;
+static char* watchedPath = NULL;
+static struct chunker disk; // the file as it was last read or saved
+static struct stat diskStat;
+static int conflictsLeft = 0; // changes of the file left out since the last save
+
+// The watch and the copy of the disk are those of the document in use (see document.c)
+void watchKeepState(){
+    keepDocumentState(&fileWatchFd, sizeof(fileWatchFd));
+    keepDocumentState(&watchedPath, sizeof(watchedPath));
+    keepDocumentState(&disk, sizeof(disk));
+    keepDocumentState(&diskStat, sizeof(diskStat));
+    keepDocumentState(&conflictsLeft, sizeof(conflictsLeft));
+}
+
+// Time of the last modification of a file, in nanoseconds where it is known to them
+long long fileModifiedAt(const struct stat* st){
+#ifdef __linux__
+    return st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+#else
+    return st->st_mtime * 1000000000LL;
+#endif
+}
+
+static int sameFile(const struct stat* a, const struct stat* b){
+    return a->st_ino == b->st_ino && a->st_dev == b->st_dev && a->st_size == b->st_size && fileModifiedAt(a) == fileModifiedAt(b);
+}
+
+static void chunkerReset(struct chunker* ck){
+    memFree(mem_misc, ck->chunks);
+    memset(ck, 0, sizeof(*ck));
+    ck->lineHash = FNV_OFFSET;
+}
+
+static void pushChunk(struct chunker* ck){
+    if (ck->count == ck->capacity){
+        int capacity = ck->capacity ? ck->capacity * 2 : 256;
+        struct fileChunk* grown = memRealloc(mem_misc, ck->chunks, sizeof(struct fileChunk) * capacity);
+        if (!grown)
+            failExit("Could not hash the file");
+        ck->chunks = grown;
+        ck->capacity = capacity;
+    }
+    ck->chunks[ck->count++] = (struct fileChunk) {ck->hash, ck->lines, ck->start};
+    ck->lines = 0;
+}
+
+// Ends the line scanned so far, rawSize counts its line ending
+static void endLine(struct chunker* ck, long long rawSize){
+    if (ck->lines == 0){
+        ck->hash = FNV_OFFSET;
+        ck->start = ck->offset;
+    }
+    // the bits of the hash of a line are mixed first, FNV leaves the hashes of lines which look alike close together
+    unsigned long long mixed = ck->lineHash;
+    mixed = (mixed ^ mixed >> 33) * 0xff51afd7ed558ccdULL;
+    mixed = (mixed ^ mixed >> 33) * 0xc4ceb9fe1a85ec53ULL;
+    mixed ^= mixed >> 33;
+    ck->hash = (ck->hash ^ mixed) * FNV_PRIME;
+    ck->lines++;
+    ck->offset += rawSize;
+    if ((mixed & CHUNK_MASK) == 0 || ck->lines == CHUNK_LINES_MAX)
+        pushChunk(ck);
+    ck->lineHash = FNV_OFFSET;
+    ck->lineBytes = 0;
+    ck->returns = 0;
+}
+
+// Hashes a piece of a line, the '\r' ending a line are left out as openFile() leaves them out
+static void scanBytes(struct chunker* ck, const char* text, size_t size){
+    size_t end = size;
+    while (end > 0 && text[end - 1] == '\r')
+        end--;
+    if (end > 0){
+        unsigned long long h = ck->lineHash;
+        for (; ck->returns > 0; ck->returns--)
+            h = (h ^ '\r') * FNV_PRIME;
+        for (size_t i = 0; i < end; i++)
+            h = (h ^ (unsigned char) text[i]) * FNV_PRIME;
+        ck->lineHash = h;
+    }
+    ck->returns += size - end;
+    ck->lineBytes += size;
+}
+
+// Hashes the text of a file, in pieces of any size
+static void scanText(struct chunker* ck, const char* text, size_t size){
+    const char* end = text + size;
+    const char* newline;
+    while ((newline = memchr(text, '\n', end - text))){
+        scanBytes(ck, text, newline - text);
+        endLine(ck, ck->lineBytes + 1);
+        text = newline + 1;
+    }
+    scanBytes(ck, text, end - text);
+}
+
+// The whole text has been scanned, a last line without a line ending is still a line
+static void scanEnd(struct chunker* ck){
+    if (ck->lineBytes > 0)
+        endLine(ck, ck->lineBytes);
+    if (ck->lines > 0)
+        pushChunk(ck);
+}
+
+// Hashes a line of the file as it is loaded, size leaves out its line ending and rawSize counts it
+void diskLine(const char* text, int size, int rawSize){
+    scanBytes(&disk, text, size);
+    endLine(&disk, rawSize);
+}
+
+static void hashDocument(struct chunker* ck){
+    chunkerReset(ck);
+    for (int i = 0; i < openedFileLines; i++){
+        struct outputBuffer* line = &fromOpenedFile[i];
+        if (isLongLine(line)){
+            struct longLine* ll = longLineOf(line);
+            for (int c = 0; c < ll->count; c++)
+                scanBytes(ck, ll->chunks[c].text.buf, ll->chunks[c].text.size);
+        }
+        else
+            scanBytes(ck, line->buf, line->size);
+        endLine(ck, ck->lineBytes + 1);
+    }
+    scanEnd(ck);
+}
+
+// Hashes the file as it is on the disk now, returns the descriptor it is read through, -1 when it cannot be read
+static int hashFile(struct chunker* ck, struct stat* st){
+    static char buf[SCAN_READ];
+    chunkerReset(ck);
+    int fd = open(watchedPath, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    ssize_t count;
+    while ((count = read(fd, buf, sizeof(buf))) > 0)
+        scanText(ck, buf, count);
+    if (count < 0 || fstat(fd, st) != 0){
+        close(fd);
+        return -1;
+    }
+    scanEnd(ck);
+    return fd;
+}
+
+// Starts watching the file the document has been loaded from, its lines have been given to diskLine()
+void watchFile(const char* path){
+    scanEnd(&disk);
+    if (watchedPath != path){
+        memFree(mem_misc, watchedPath);
+        watchedPath = memStrdup(mem_misc, path);
+    }
+    stat(path, &diskStat);
+#ifdef __linux__
+    if (batchMode)
+        return; // nothing is shown, the file is only looked at before it is saved
+    if (fileWatchFd < 0)
+        fileWatchFd = inotify_init1(IN_NONBLOCK);
+    // a rewrite is taken in once the writer closes the file, a file saved by renaming a new one over it is watched again
+    if (fileWatchFd >= 0)
+        inotify_add_watch(fileWatchFd, path, IN_CLOSE_WRITE | IN_MOVE_SELF | IN_DELETE_SELF | IN_ATTRIB);
+#endif
+}
+
+// Stops watching, the hashes are let go of and the next file loaded is hashed from its first line
+void unwatchFile(){
+    if (fileWatchFd >= 0)
+        close(fileWatchFd);
+    fileWatchFd = -1;
+    memFree(mem_misc, watchedPath);
+    watchedPath = NULL;
+    conflictsLeft = 0;
+    chunkerReset(&disk);
+}
+
+// Takes the number of changes of the file left out since the last save, which are then overwritten by the next save
+int fileConflicts(){
+    int conflicts = conflictsLeft;
+    conflictsLeft = 0;
+    return conflicts;
+}
+
+// The document has been written to the file, text is what has been written
+// what the file holds now is kept as its chunks, so the change the watch tells of is not taken for another process
+void fileSaved(const char* path, const char* text, size_t size){
+    conflictsLeft = 0;
+    if (streamFd >= 0)
+        return; // a followed file is still read as it grows
+    chunkerReset(&disk);
+    scanText(&disk, text, size);
+    watchFile(path);
+}
+
+// The file as it was last read or saved: its stat and a hash of its content, returns 0 when there is no such file
+int fileIdentity(struct stat* st, unsigned long long* hash){
+    if (watchedPath == NULL)
+        return 0;
+    *st = diskStat;
+    *hash = FNV_OFFSET;
+    for (int i = 0; i < disk.count; i++)
+        *hash = (*hash ^ disk.chunks[i].hash) * FNV_PRIME;
+    return 1;
+}
+
+// Whether the file on the disk is still the one last read or saved
+int fileUnchanged(){
+    struct stat st;
+    return watchedPath != NULL && stat(watchedPath, &st) == 0 && sameFile(&st, &diskStat);
+}
+
+// A table of the hashes of a run of chunks, telling which of them are found only once in the run
+struct uniqueSlot {
+    unsigned long long hash;
+    int index; // of the chunk, -1 for an empty slot and -2 for a hash found more than once
+};
+
+struct uniqueTable {
+    struct uniqueSlot* slots;
+    int mask;
+};
+
+static struct uniqueSlot* uniqueSlot(struct uniqueTable* t, unsigned long long hash){
+    int slot = hash & t->mask;
+    while (t->slots[slot].index != -1 && t->slots[slot].hash != hash)
+        slot = (slot + 1) & t->mask;
+    return &t->slots[slot];
+}
+
+static void uniqueBuild(struct uniqueTable* t, const struct fileChunk* chunks, int from, int to){
+    int size = 16;
+    while (size < 2 * (to - from))
+        size *= 2;
+    t->mask = size - 1;
+    t->slots = memAlloc(mem_misc, sizeof(struct uniqueSlot) * size);
+    if (!t->slots)
+        failExit("Could not compare the file");
+    for (int i = 0; i < size; i++)
+        t->slots[i].index = -1;
+    for (int i = from; i < to; i++){
+        struct uniqueSlot* slot = uniqueSlot(t, chunks[i].hash);
+        slot->index = slot->index == -1 ? i : -2;
+        slot->hash = chunks[i].hash;
+    }
+}
+
+// Lines the chunks of a up with the chunks of b, match[i] is the chunk of b holding what chunk i of a holds, -1 for none
+// the matches only go forward: the common start and end, then the chunks found once in both in between,
+// which are grown over the equal chunks next to them
+static void alignChunks(const struct chunker* a, const struct chunker* b, int* match){
+    int na = a->count;
+    int nb = b->count;
+    for (int i = 0; i < na; i++)
+        match[i] = -1;
+    int head = 0;
+    while (head < na && head < nb && a->chunks[head].hash == b->chunks[head].hash){
+        match[head] = head;
+        head++;
+    }
+    int tail = 0;
+    while (head + tail < na && head + tail < nb && a->chunks[na - 1 - tail].hash == b->chunks[nb - 1 - tail].hash){
+        match[na - 1 - tail] = nb - 1 - tail;
+        tail++;
+    }
+    if (head + tail == na || head + tail == nb)
+        return;
+    
+    struct uniqueTable ta, tb;
+    uniqueBuild(&ta, a->chunks, head, na - tail);
+    uniqueBuild(&tb, b->chunks, head, nb - tail);
+    int last = head - 1;
+    for (int i = head; i < na - tail; i++){
+        int j = uniqueSlot(&tb, a->chunks[i].hash)->index;
+        if (j > last && uniqueSlot(&ta, a->chunks[i].hash)->index == i){
+            match[i] = j;
+            last = j;
+        }
+    }
+    memFree(mem_misc, ta.slots);
+    memFree(mem_misc, tb.slots);
+    
+    int* bound = memAlloc(mem_misc, sizeof(int) * na);
+    if (!bound)
+        failExit("Could not compare the file");
+    int next = nb;
+    for (int i = na - 1; i >= 0; i--){ // the first chunk of b matched after chunk i
+        bound[i] = next;
+        if (match[i] >= 0)
+            next = match[i];
+    }
+    for (int i = 0; i + 1 < na; i++)
+        if (match[i] >= 0 && match[i + 1] < 0 && match[i] + 1 < bound[i + 1]
+                && a->chunks[i + 1].hash == b->chunks[match[i] + 1].hash)
+            match[i + 1] = match[i] + 1;
+    int prev = -1;
+    for (int i = 0; i < na; i++){ // the last chunk of b matched before chunk i
+        bound[i] = prev;
+        if (match[i] >= 0)
+            prev = match[i];
+    }
+    for (int i = na - 1; i > 0; i--)
+        if (match[i] >= 0 && match[i - 1] < 0 && match[i] - 1 > bound[i - 1]
+                && a->chunks[i - 1].hash == b->chunks[match[i] - 1].hash)
+            match[i - 1] = match[i] - 1;
+    memFree(mem_misc, bound);
+}
+
+static long long chunkOffset(const struct chunker* ck, int i){
+    return i == ck->count ? ck->offset : ck->chunks[i].offset;
+}
+
+// lines of the document to be replaced by bytes of the file
+struct region {
+    int at;
+    int count;
+    long long offset;
+    long long bytes;
+};
+
+// Moves a line of the document to where it is once count lines from at have been replaced by lines
+static int shiftedLine(int line, int at, int count, int lines){
+    if (line >= at + count)
+        return line + lines - count;
+    if (line >= at)
+        return at + (line - at < lines ? line - at : lines);
+    return line;
+}
+
+// Replaces the regions of the document by what the file holds there now, keeping the view on the lines it was on
+// returns the number of lines read
+static int applyRegions(int fd, struct region* regions, int count){
+    int reloaded = 0;
+    int cursorLine = cursorPos.y + rowOffset - 1;
+    int cursorMoved = 0;
+    for (int r = count - 1; r >= 0; r--){ // from the end, so the lines of the regions before do not move
+        struct region* region = &regions[r];
+        char* text = memAlloc(mem_misc, region->bytes ? region->bytes : 1);
+        if (!text)
+            failExit("Could not reload the file");
+        long long size = 0;
+        ssize_t got;
+        while (size < region->bytes && (got = pread(fd, text + size, region->bytes - size, region->offset + size)) > 0)
+            size += got;
+        int before = openedFileLines;
+        replaceRows(region->at, region->count, text, size);
+        memFree(mem_misc, text);
+        int lines = openedFileLines - before + region->count;
+        reloaded += lines;
+        cursorMoved |= cursorLine >= region->at && cursorLine < region->at + region->count;
+        cursorLine = shiftedLine(cursorLine, region->at, region->count, lines);
+        rowOffset = shiftedLine(rowOffset, region->at, region->count, lines);
+    }
+    
+    if (cursorLine > openedFileLines - 1)
+        cursorLine = openedFileLines > 0 ? openedFileLines - 1 : 0;
+    if (rowOffset > cursorLine)
+        rowOffset = cursorLine;
+    if (cursorLine - rowOffset >= screenrows)
+        rowOffset = cursorLine - screenrows + 1;
+    cursorPos.y = cursorLine - rowOffset + 1;
+    if (cursorMoved)
+        cursorPos.x = 1;
+    return reloaded;
+}
+
+// Looks whether the file on the disk differs from what was last read or saved, and takes its changes into the document
+// returns whether the document has changed or changes have been left out because the document has been edited in the same place
+int fileReload(){
+    struct stat st;
+    if (watchedPath == NULL || stat(watchedPath, &st) != 0 || sameFile(&st, &diskStat))
+        return 0;
+    TRACE_BEGIN(trace_reloadFile);
+    struct chunker now = {0};
+    struct chunker edited = {0};
+    int fd = hashFile(&now, &st);
+    if (fd < 0){
+        chunkerReset(&now);
+        TRACE_END(trace_reloadFile);
+        return 0;
+    }
+    
+    // without unsaved edits the document holds what the file held, and its chunks are the ones kept
+    int modified = fileModified;
+    if (modified)
+        hashDocument(&edited);
+    const struct chunker* document = modified ? &edited : &disk;
+    int* toNow = memAlloc(mem_misc, sizeof(int) * (disk.count + 1));
+    int* toDocument = memAlloc(mem_misc, sizeof(int) * (disk.count + 1));
+    int* lineOf = memAlloc(mem_misc, sizeof(int) * (document->count + 1));
+    struct region* regions = memAlloc(mem_misc, sizeof(struct region) * (disk.count + 1));
+    if (!toNow || !toDocument || !lineOf || !regions)
+        failExit("Could not reload the file");
+    alignChunks(&disk, &now, toNow);
+    if (modified)
+        alignChunks(&disk, &edited, toDocument);
+    else
+        for (int i = 0; i < disk.count; i++)
+            toDocument[i] = i;
+    toNow[disk.count] = now.count; // the ends of the chunks line up
+    toDocument[disk.count] = document->count;
+    lineOf[0] = 0;
+    for (int i = 0; i < document->count; i++)
+        lineOf[i + 1] = lineOf[i] + document->chunks[i].lines;
+    
+    // between two chunks which are the same in the file as it was and as it is, what lies has changed on the disk
+    // it is taken in if the document holds each chunk of it as it was, right after the one before
+    int count = 0;
+    int left = 0;
+    int kept = -1;
+    int keptNow = -1;
+    for (int k = 0; k <= disk.count; k++){
+        if (toNow[k] < 0)
+            continue;
+        if (k - kept > 1 || toNow[k] - keptNow > 1){
+            int first = kept < 0 ? -1 : toDocument[kept];
+            int unedited = kept < 0 || first >= 0;
+            for (int i = kept + 1; unedited && i <= k; i++)
+                unedited = toDocument[i] == first + (i - kept);
+            if (unedited){
+                long long offset = chunkOffset(&now, keptNow + 1);
+                regions[count++] = (struct region) {lineOf[first + 1], lineOf[first + k - kept] - lineOf[first + 1],
+                    offset, chunkOffset(&now, toNow[k]) - offset};
+            }
+            else
+                left++;
+        }
+        kept = k;
+        keptNow = toNow[k];
+    }
+    
+    int recording = undoRecording;
+    undoRecording = 0;
+    int reloaded = applyRegions(fd, regions, count);
+    undoRecording = recording;
+    close(fd);
+    fileModified = modified; // what is in the file is not an edit
+    if (count)
+        undoClear(); // the edits logged were made to lines which may have moved
+    memFree(mem_misc, toNow);
+    memFree(mem_misc, toDocument);
+    memFree(mem_misc, lineOf);
+    memFree(mem_misc, regions);
+    chunkerReset(&edited);
+    chunkerReset(&disk);
+    disk = now;
+    diskStat = st;
+    
+    if (left && count)
+        loadStatusMessage("Changed on disk: %d lines reloaded, %d edited places kept", reloaded, left);
+    else if (left)
+        loadStatusMessage("Changed on disk where edited: %d places kept", left);
+    else if (count)
+        loadStatusMessage("Changed on disk: %d lines reloaded", reloaded);
+    conflictsLeft += left;
+    TRACE_END(trace_reloadFile);
+    return count > 0 || left > 0;
+}
+
+// Reads the events of the watch, the file is looked at again if there has been any
+int fileWatchRead(){
+    static char events[4096];
+    int any = 0;
+    while (read(fileWatchFd, events, sizeof(events)) > 0)
+        any = 1;
+    if (!any)
+        return 0;
+#ifdef __linux__
+    // the file may have been replaced by another one with the same name, which is watched from now on
+    inotify_add_watch(fileWatchFd, watchedPath, IN_CLOSE_WRITE | IN_MOVE_SELF | IN_DELETE_SELF | IN_ATTRIB);
+#endif
+    return fileReload();
+}
@@ -0,0 +1,154 @@
+#include "editor.h"
+
+// Replacing (ctrl+r): every occurrence of a text in the document is replaced at once
+// the lines holding a match are rewritten in a single pass from the first match to the last, each built whole in a scratch buffer
+// and highlighted as it is written from the state the line above ends in, the lines between them only while that state has changed
+// the whole replacement is logged as a single record, the positions of the matches with the two texts, and undone in one step
+
+// The text of a line in one block, a long line is copied into *flat
+static const char* lineText(struct outputBuffer* line, char** flat, int* flatSize){
+    if (!isLongLine(line))
+        return line->buf;
+    if (line->size + 1 > *flatSize){
+        char* grown = memRealloc(mem_misc, *flat, line->size + 1);
+        if (!grown)
+            failExit("Could not replace");
+        *flat = grown;
+        *flatSize = line->size + 1;
+    }
+    longLineCopy(longLineOf(line), *flat);
+    return *flat;
+}
+
+static unsigned char lineExit(int at){
+    struct highlightState hs;
+    lineExitState(at, &hs);
+    return exitState(&hs);
+}
+
+// Replaces the removedLength characters at each match, which are in order and do not overlap, with text
+void replaceMatches(const struct textMatch* matches, int count, const char* removed, int removedLength,
+                    const char* text, int textLength){
+    if (count <= 0)
+        return;
+    struct textMatch* placed = memAlloc(mem_misc, sizeof(struct textMatch) * count); // where the text now is
+    char* flat = NULL;
+    int flatSize = 0;
+    char* out = NULL;
+    int outSize = 0;
+    if (!placed)
+        failExit("Could not replace");
+
+    int m = 0;
+    int changed = 0; // whether the line above ends in another state than before
+    for (int i = matches[0].line; i < openedFileLines && (m < count || changed); i++){
+        if (m < count && matches[m].line != i && !changed)
+            i = matches[m].line; // the lines up to the next match are as they were
+        unsigned char before = lineExit(i);
+        struct outputBuffer* line = &fromOpenedFile[i];
+        if (m < count && matches[m].line == i){
+            int last = m;
+            while (last < count && matches[last].line == i)
+                last++;
+            long long size = line->size + (long long) (last - m) * (textLength - removedLength);
+            if (size + 1 > outSize){
+                char* grown = memRealloc(mem_misc, out, size + 1);
+                if (!grown)
+                    failExit("Could not replace");
+                out = grown;
+                outSize = size + 1;
+            }
+            const char* old = lineText(line, &flat, &flatSize);
+            int from = 0;
+            int to = 0;
+            for (; m < last; m++){
+                memcpy(out + to, old + from, matches[m].pos - from);
+                to += matches[m].pos - from;
+                placed[m] = (struct textMatch) {i, to};
+                memcpy(out + to, text, textLength);
+                to += textLength;
+                from = matches[m].pos + removedLength;
+            }
+            memcpy(out + to, old + from, line->size - from);
+
+            if (isLongLine(line)){ // written again as a single block, updateBuffer() cuts it into chunks if it is still long
+                longLineFree(longLineOf(line));
+                line->buf = NULL;
+                line->capacity = 0;
+            }
+            lineReserve(mem_lines, line, size + 1);
+            memcpy(line->buf, out, size);
+            line->buf[size] = '\0';
+            line->size = size;
+            updateBuffer(&toRenderToScreen[i], line);
+        }
+        else
+            updateStatus(&toRenderToScreen[i]);
+        changed = lineExit(i) != before;
+    }
+    undoReplaced(placed, count, text, textLength, removed, removedLength);
+    memFree(mem_misc, placed);
+    memFree(mem_misc, flat);
+    memFree(mem_misc, out);
+    searchMatch.line = -1;
+    fileModified += 1;
+}
+
+// Replaces every occurrence of query with 'with', returns the number of occurrences
+int replaceText(const char* query, const char* with){
+    if (*query == '\0')
+        return 0;
+    TRACE_BEGIN(trace_replace);
+    int queryLength = strlen(query);
+    int withLength = strlen(with);
+    struct textMatch* matches = NULL;
+    int count = 0;
+    int capacity = 0;
+    char* flat = NULL;
+    int flatSize = 0;
+    for (int i = 0; i < openedFileLines; i++){
+        struct outputBuffer* line = &fromOpenedFile[i];
+        if (line->size < queryLength)
+            continue;
+        const char* text = lineText(line, &flat, &flatSize);
+        const char* at = text;
+        const char* end = text + line->size;
+        while ((at = memmem(at, end - at, query, queryLength))){
+            if (count == capacity){
+                capacity = capacity ? capacity * 2 : 256;
+                struct textMatch* grown = memRealloc(mem_misc, matches, sizeof(struct textMatch) * capacity);
+                if (!grown)
+                    failExit("Could not replace");
+                matches = grown;
+            }
+            matches[count++] = (struct textMatch) {i, at - text};
+            at += queryLength;
+        }
+    }
+    memFree(mem_misc, flat);
+
+    undoBoundary();
+    replaceMatches(matches, count, query, queryLength, with, withLength);
+    memFree(mem_misc, matches);
+    TRACE_END(trace_replace);
+    return count;
+}
+
+// Asks for a text and what to replace it with, and replaces every occurrence of it
+void replaceAll(){
+    char* query = userPrompt("Replace: %s (ESC to cancel)", NULL);
+    if (query == NULL)
+        return;
+    char* with = userPrompt("Replace with: %s (ESC to cancel)", NULL);
+    if (with == NULL){
+        memFree(mem_misc, query);
+        return;
+    }
+    int count = replaceText(query, with);
+    if (count)
+        loadStatusMessage("Replaced %d occurrences", count);
+    else
+        loadStatusMessage("Not found: %s", query);
+    memFree(mem_misc, query);
+    memFree(mem_misc, with);
+}
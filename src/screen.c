@@ -0,0 +1,332 @@
+#include "editor.h"
+
+// The screen is kept as two grids of cells
+// the back grid is composed on every refresh, the front grid is what the terminal is showing
+// only the cells which differ between the two are written out to the terminal
+// a cell holds a whole UTF-8 character, a wide one leaves the cell to its right covered (an empty string)
+
+struct screenCell* screenFront, * screenBack;
+int screenHeight;
+int screenWidth;
+struct pos screenCursor;
+unsigned long lastFrameBytes;
+unsigned long totalOutputBytes;
+int fullRedraw;
+int screenOrigin;
+
+static int frontValid = 0; // 0 when the terminal contents are unknown
+static int penState = -1; // color currently set on the terminal, -1 if unknown
+static int penAttr = -1; // attributes currently set on the terminal, -1 if unknown
+
+#define isBlankCell(cell) ((cell).c[0] == ' ' && (cell).state == normal && (cell).attr == attr_none)
+#define isSameCell(a, b) (memcmp((a).c, (b).c, sizeof((a).c)) == 0 && (a).state == (b).state && (a).attr == (b).attr)
+#define isCoveredCell(cell) ((cell).c[0] == '\0')
+#define isAsciiCell(cell) ((unsigned char) (cell).c[0] - 1 < 0x7f && (cell).c[1] == '\0')
+
+static const struct screenCell blankCell = {" ", normal, attr_none};
+
+// Allocates both grids for a terminal of the given size
+void screenInit(int rows, int cols){
+    memFree(mem_screen, screenFront);
+    memFree(mem_screen, screenBack);
+    screenHeight = rows;
+    screenWidth = cols;
+    screenFront = memAlloc(mem_screen, sizeof(struct screenCell) * rows * cols);
+    screenBack = memAlloc(mem_screen, sizeof(struct screenCell) * rows * cols);
+    if (!screenFront || !screenBack)
+        failExit("Could not allocate the screen");
+    screenClear();
+    screenInvalidate();
+}
+
+// Forgets what the terminal is showing, the next flush clears the screen and redraws every cell
+void screenInvalidate(){
+    frontValid = 0;
+    screenCursor.x = -1;
+    screenCursor.y = -1;
+}
+
+// Blanks the back grid before composing a new frame
+void screenClear(){
+    for (int i = 0; i < screenHeight * screenWidth; i++)
+        screenBack[i] = blankCell;
+}
+
+// Writes the len bytes of a UTF-8 string into the back grid at row y, column x (0 based), state holds one per byte
+// anything past the right edge of the screen is dropped, returns the column after the string
+int screenPut(int y, int x, const char* str, const unsigned char* state, int len, int attr){
+    y += screenOrigin;
+    if (y < 0 || y >= screenHeight)
+        return x;
+    struct screenCell* row = &screenBack[y * screenWidth];
+    if (utf8IsAscii(str, len)){ // a byte a column
+        for (int i = 0; i < len && x + i < screenWidth; i++){
+            if (x + i < 0)
+                continue;
+            unsigned char c = str[i];
+            memset(row[x + i].c, 0, sizeof(row[x + i].c));
+            row[x + i].c[0] = (iscntrl(c)) ? '?' : c; // a control byte would move the terminal cursor
+            row[x + i].state = state ? state[i] : normal;
+            row[x + i].attr = attr;
+        }
+        return x + len;
+    }
+    for (int i = 0; i < len && x < screenWidth; ){
+        int codepoint;
+        int length = utf8Decode(str + i, len - i, &codepoint);
+        int width = utf8Width(codepoint);
+        if (width == 0){ // drawn over the character on its left when it fits in the cell
+            int prev = x - 1;
+            while (prev > 0 && isCoveredCell(row[prev]))
+                prev--;
+            int used = prev >= 0 ? (int) strnlen(row[prev].c, sizeof(row[prev].c)) : 0;
+            if (prev >= 0 && used > 0 && used + length <= (int) sizeof(row[prev].c))
+                memcpy(row[prev].c + used, str + i, length);
+            i += length;
+            continue;
+        }
+        if (x >= 0){
+            struct screenCell* cell = &row[x];
+            memset(cell->c, 0, sizeof(cell->c));
+            if (codepoint < 0 || (codepoint < 0x80 && iscntrl(codepoint)) || (codepoint >= 0x80 && codepoint < 0xa0))
+                cell->c[0] = '?';
+            else if (width == 2 && x + 1 >= screenWidth)
+                cell->c[0] = ' '; // half of a wide character does not fit
+            else
+                memcpy(cell->c, str + i, length);
+            cell->state = state ? state[i] : normal;
+            cell->attr = attr;
+            if (width == 2 && x + 1 < screenWidth){
+                memset(row[x + 1].c, 0, sizeof(row[x + 1].c));
+                row[x + 1].state = cell->state;
+                row[x + 1].attr = attr;
+            }
+        }
+        else if (x + width > 0)
+            row[0] = (struct screenCell) {" ", normal, attr}; // the right half of a wide character cut by the edge
+        x += width;
+        i += length;
+    }
+    return x;
+}
+
+// Fills the rest of row y from column x with the given attribute
+void screenFill(int y, int x, int attr){
+    y += screenOrigin;
+    if (y < 0 || y >= screenHeight)
+        return;
+    for (; x < screenWidth; x++){
+        screenBack[y * screenWidth + x] = blankCell;
+        screenBack[y * screenWidth + x].attr = attr;
+    }
+}
+
+// Colors len cells of row y from column x, leaving their text as it is
+void screenSetState(int y, int x, int len, int state){
+    y += screenOrigin;
+    if (y < 0 || y >= screenHeight)
+        return;
+    if (x < 0){
+        len += x;
+        x = 0;
+    }
+    struct screenCell* row = &screenBack[y * screenWidth];
+    for (int i = 0; i < len && x + i < screenWidth; i++)
+        row[x + i].state = state;
+}
+
+// Composes count rows from y (counted from the origin) as the terminal already shows them, returns 0 when it is not known
+// a part of the screen which has not changed is kept this way instead of being composed again
+int screenKeep(int y, int count){
+    y += screenOrigin;
+    if (!frontValid || fullRedraw || y < 0 || y + count > screenHeight)
+        return 0;
+    memcpy(&screenBack[y * screenWidth], &screenFront[y * screenWidth], sizeof(struct screenCell) * count * screenWidth);
+    return 1;
+}
+
+// Asks the terminal to scroll rows top to bottom (1 based, inclusive) by the given number of lines
+// and shifts the front grid the same way, so that only the rows exposed differ afterwards
+void screenScroll(struct outputBuffer* out, int top, int bottom, int lines){
+    if (!frontValid || lines == 0 || top < 1 || bottom > screenHeight
+        || lines >= bottom - top + 1 || -lines >= bottom - top + 1)
+        return;
+    appendScrollSequence(out, top, bottom, lines);
+    screenCursor.x = 1; // setting the scroll region homes the cursor
+    screenCursor.y = 1;
+
+    int height = bottom - top + 1;
+    int shift = lines > 0 ? lines : -lines;
+    struct screenCell* region = &screenFront[(top - 1) * screenWidth];
+    if (lines > 0)
+        memmove(region, &region[shift * screenWidth],
+                sizeof(struct screenCell) * (height - shift) * screenWidth);
+    else
+        memmove(&region[shift * screenWidth], region,
+                sizeof(struct screenCell) * (height - shift) * screenWidth);
+    // exposed rows are blank after scrolling
+    struct screenCell* exposed = (lines > 0) ? &region[(height - shift) * screenWidth] : region;
+    for (int i = 0; i < shift * screenWidth; i++)
+        exposed[i] = blankCell;
+}
+
+// Appends the escape sequences needed to change the terminal's color and attributes
+static void appendPen(struct outputBuffer* out, int state, int attr){
+    if (attr != penAttr){
+        if (attr & attr_invert)
+            appendToBuffer(out, CL_INVERT_COLOR);
+        else {
+            appendToBuffer(out, CL_FMT_CLEAR);
+            penState = normal; // clearing the format also resets the color
+        }
+        penAttr = attr;
+    }
+    if (state != penState){
+        appendWithColor(out, NULL, 0, state);
+        penState = state;
+    }
+}
+
+// Writes the cheapest horizontal movement from column 'from' to column 'to' (1 based) on a row
+// moving right can be done by rewriting the cells already on the screen if they use the current pen
+static int horizontalMove(char* seq, int size, int from, int to, const struct screenCell* row){
+    int n = to - from;
+    if (n == 0){
+        seq[0] = '\0';
+        return 0;
+    }
+    int len = (n > 0) ? snprintf(seq, size, "\x1b[%dC", n) : snprintf(seq, size, "\x1b[%dD", -n);
+    if (n < 0 && -n < len && -n < size){ // backspaces
+        memset(seq, '\b', -n);
+        seq[-n] = '\0';
+        return -n;
+    }
+    if (n > 0 && n < len && n < size && row){
+        for (int i = 0; i < n; i++){
+            const struct screenCell* cell = &row[from - 1 + i];
+            if (cell->state != penState || cell->attr != penAttr || !isAsciiCell(*cell))
+                return len; // rewriting these cells would need a change of pen, or more bytes than they are wide
+        }
+        for (int i = 0; i < n; i++)
+            seq[i] = row[from - 1 + i].c[0];
+        seq[n] = '\0';
+        return n;
+    }
+    return len;
+}
+
+// Writes the cheapest vertical movement from row 'from' to row 'to' (1 based)
+static int verticalMove(char* seq, int size, int from, int to){
+    int n = to - from;
+    if (n == 0){
+        seq[0] = '\0';
+        return 0;
+    }
+    if (n < 0)
+        return snprintf(seq, size, "\x1b[%dA", -n);
+    int len = snprintf(seq, size, "\x1b[%dB", n);
+    if (n < len && n < size){ // line feeds keep the column since output processing is off
+        memset(seq, '\n', n);
+        seq[n] = '\0';
+        return n;
+    }
+    return len;
+}
+
+// Moves the terminal cursor to x, y (1 based) using the shortest sequence available:
+// an absolute position, relative movements, a carriage return or rewriting text already on the screen
+void screenMoveCursor(struct outputBuffer* out, int x, int y){
+    if (screenCursor.x == x && screenCursor.y == y)
+        return;
+    char best[48], vert[24], horz[24];
+    int bestLen;
+    if (x == 1 && y == 1)
+        bestLen = snprintf(best, sizeof(best), "\x1b[H");
+    else if (x == 1)
+        bestLen = snprintf(best, sizeof(best), "\x1b[%dH", y);
+    else
+        bestLen = snprintf(best, sizeof(best), "\x1b[%d;%dH", y, x);
+
+    if (screenCursor.y > 0 && y <= screenHeight && x <= screenWidth){
+        const struct screenCell* row = frontValid ? &screenFront[(y - 1) * screenWidth] : NULL;
+        int vLen = verticalMove(vert, sizeof(vert), screenCursor.y, y);
+        // relative to the current column
+        if (screenCursor.x > 0){
+            int hLen = horizontalMove(horz, sizeof(horz), screenCursor.x, x, row);
+            if (vLen + hLen < bestLen){
+                bestLen = vLen + hLen;
+                snprintf(best, sizeof(best), "%s%s", vert, horz);
+            }
+        }
+        // relative to the start of the line
+        int hLen = horizontalMove(horz, sizeof(horz), 1, x, row);
+        if (1 + vLen + hLen < bestLen){
+            bestLen = 1 + vLen + hLen;
+            snprintf(best, sizeof(best), "\r%s%s", vert, horz);
+        }
+    }
+    appendToBuffer(out, best, bestLen);
+    screenCursor.x = x;
+    screenCursor.y = y;
+}
+
+// Appends the cells of the back grid which differ from the front grid
+// and records them as shown on the terminal
+void screenFlush(struct outputBuffer* out){
+    if (fullRedraw)
+        screenInvalidate();
+    if (!frontValid){
+        appendToBuffer(out, CL_FMT_CLEAR);
+        appendToBuffer(out, CL_SCREEN_ALL);
+        penState = normal;
+        penAttr = attr_none;
+        for (int i = 0; i < screenHeight * screenWidth; i++)
+            screenFront[i] = blankCell;
+        frontValid = 1;
+    }
+
+    for (int y = 0; y < screenHeight; y++){
+        struct screenCell* back = &screenBack[y * screenWidth];
+        struct screenCell* front = &screenFront[y * screenWidth];
+        int end = screenWidth, frontEnd = screenWidth;
+        while (end > 0 && isBlankCell(back[end - 1]))
+            end--;
+        while (frontEnd > 0 && isBlankCell(front[frontEnd - 1]))
+            frontEnd--;
+
+        // write each run of changed cells
+        int x = 0;
+        while (x < end){
+            if (isSameCell(back[x], front[x])){
+                x++;
+                continue;
+            }
+            int runEnd = x;
+            while (runEnd < end && !isSameCell(back[runEnd], front[runEnd]))
+                runEnd++;
+            // a wide character is written whole, with the cell it covers
+            while (x > 0 && (isCoveredCell(back[x]) || isCoveredCell(front[x])))
+                x--;
+            while (runEnd < screenWidth && (isCoveredCell(back[runEnd]) || isCoveredCell(front[runEnd])))
+                runEnd++;
+            screenMoveCursor(out, x + 1, y + 1);
+            for (; x < runEnd; x++){
+                if (!isCoveredCell(back[x])){
+                    appendPen(out, back[x].state, back[x].attr);
+                    appendToBuffer(out, back[x].c, strnlen(back[x].c, sizeof(back[x].c)));
+                }
+                front[x] = back[x];
+            }
+            screenCursor.x = (x < screenWidth) ? x + 1 : -1; // cursor position is unreliable past the last column
+        }
+
+        // clear whatever is left over to the right
+        if (frontEnd > end){
+            screenMoveCursor(out, end + 1, y + 1);
+            appendPen(out, penState < 0 ? normal : penState, attr_none);
+            appendToBuffer(out, CL_LINE_RIGHT_OF_CURSOR);
+            for (x = end; x < screenWidth; x++)
+                front[x] = back[x];
+        }
+    }
+}
@@ -0,0 +1,115 @@
+#include "editor.h"
+
+// Storage of the lines of the document
+// Short blocks come in steps of 16 bytes, longer ones grow by a half or a third (256, 384, 512, 768, 1024...)
+// so little room is left unused and a line which grows a character at a time is only moved now and then
+// blocks up to SLAB_MAX bytes are carved out of slabs, pages of SLAB_SLOTS blocks of one size,
+// which hold no per block header and keep the short lines of a file next to each other in memory
+// larger blocks come straight from the allocator
+
+#define SLAB_STEP 16 // blocks up to SLAB_STEPPED bytes grow by this much
+#define SLAB_STEPPED 256
+#define SLAB_CLASSES 20 // 16, 32, ... 256, 384, 512, 768, 1024
+#define SLAB_SLOTS 64 // blocks per slab page
+
+struct slabPage {
+    struct slabPage* next;
+    // followed by SLAB_SLOTS blocks
+};
+
+struct slabHeap {
+    struct slabPage* pages; // every page, so that they can be let go of all at once
+    void* freeBlocks[SLAB_CLASSES]; // free blocks of each size, linked through their first bytes
+};
+
+static struct slabHeap heaps[mem_subsystems];
+
+// Each document has slabs of its own, so that they are let go of with it (see document.c)
+void slabKeepState(){
+    keepDocumentState(heaps, sizeof(heaps));
+}
+
+// the block size following 'capacity', past SLAB_STEPPED either a power of two or one and a half times a power of two
+#define nextCapacity(capacity) ((capacity) < SLAB_STEPPED ? (capacity) + SLAB_STEP \
+                                : ((capacity) & ((capacity) - 1)) ? (capacity) / 3 * 4 : (capacity) / 2 * 3)
+
+// Smallest block which holds size bytes
+int lineCapacity(int size){
+    int capacity = SLAB_STEP;
+    while (capacity < size)
+        capacity = nextCapacity(capacity);
+    return capacity;
+}
+
+static int slabClass(int capacity){
+    int class = 0;
+    for (int c = SLAB_STEP; c < capacity; c = nextCapacity(c))
+        class++;
+    return class;
+}
+
+// Returns a block of 'capacity' bytes (from lineCapacity()) for the given subsystem
+void* lineAlloc(int subsystem, int capacity){
+    if (capacity > SLAB_MAX)
+        return memAlloc(subsystem, capacity);
+
+    struct slabHeap* heap = &heaps[subsystem];
+    int class = slabClass(capacity);
+    if (!heap->freeBlocks[class]){
+        // carve a new page into free blocks
+        struct slabPage* page = memAlloc(subsystem, sizeof(struct slabPage) + (size_t) SLAB_SLOTS * capacity);
+        if (!page)
+            return NULL;
+        page->next = heap->pages;
+        heap->pages = page;
+        char* blocks = (char*) (page + 1);
+        for (int i = SLAB_SLOTS - 1; i >= 0; i--){
+            *(void**) &blocks[i * capacity] = heap->freeBlocks[class];
+            heap->freeBlocks[class] = &blocks[i * capacity];
+        }
+    }
+    void* block = heap->freeBlocks[class];
+    heap->freeBlocks[class] = *(void**) block;
+    return block;
+}
+
+// Gives back a block returned by lineAlloc()
+void lineFree(int subsystem, void* block, int capacity){
+    if (!block)
+        return;
+    if (capacity > SLAB_MAX){
+        memFree(subsystem, block);
+        return;
+    }
+    struct slabHeap* heap = &heaps[subsystem];
+    int class = slabClass(capacity);
+    *(void**) block = heap->freeBlocks[class];
+    heap->freeBlocks[class] = block;
+}
+
+// Makes room for 'size' bytes in the line's buffer, keeping its contents
+void lineReserve(int subsystem, struct outputBuffer* line, int size){
+    if (size <= line->capacity)
+        return;
+    int capacity = lineCapacity(size);
+    char* buf = lineAlloc(subsystem, capacity);
+    if (!buf)
+        failExit("Could not allocate a line");
+    if (line->buf)
+        memcpy(buf, line->buf, line->capacity);
+    lineFree(subsystem, line->buf, line->capacity);
+    line->buf = buf;
+    line->capacity = capacity;
+}
+
+// Lets go of every slab page of the subsystem at once
+// the blocks larger than SLAB_MAX have to be freed with lineFree() beforehand
+void lineFreeAll(int subsystem){
+    struct slabHeap* heap = &heaps[subsystem];
+    while (heap->pages){
+        struct slabPage* next = heap->pages->next;
+        memFree(subsystem, heap->pages);
+        heap->pages = next;
+    }
+    memset(heap->freeBlocks, 0, sizeof(heap->freeBlocks));
+}
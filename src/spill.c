@@ -0,0 +1,217 @@
+#include "editor.h"
+
+// Memory budget: with several documents open, the ones which are not shown give back their memory
+// once the editor holds more than EDITOR_MEMORY_BUDGET (in bytes, or with k, m or g), half of the memory of the machine by default
+// the documents used longest ago go first (see document.c), each gives back what is cheapest to have again:
+// first the rendering of its lines, the state each line ends in is kept so that they are rendered again without being highlighted,
+// then the text of a document without unsaved changes, read again from its file if the file has not changed,
+// last the text of the others, written to the swap file: an unlinked temporary file, emptied once it holds no document
+// a document is put back as it was when it is used again, with its undo history, folds and view
+
+static int spillLevel = spill_none;
+static unsigned char* spilledExits = NULL; // enum exit_state of each line
+static int spilledLines = 0;
+static long long swapOffset = 0; // of the lines in the swap file
+
+static FILE* swapFile = NULL;
+static int swappedDocuments = 0;
+static unsigned long budget = 0;
+
+// What has been let go of is that of the document in use (see document.c)
+void spillKeepState(){
+    keepDocumentState(&spillLevel, sizeof(spillLevel));
+    keepDocumentState(&spilledExits, sizeof(spilledExits));
+    keepDocumentState(&spilledLines, sizeof(spilledLines));
+    keepDocumentState(&swapOffset, sizeof(swapOffset));
+}
+
+// Bytes held by every part of the editor
+unsigned long memoryInUse(){
+    unsigned long bytes = 0;
+    for (int i = 0; i < mem_subsystems; i++)
+        bytes += __atomic_load_n(&memStats[i].bytes, __ATOMIC_RELAXED); // counted by the threads of find.c as well
+    return bytes;
+}
+
+unsigned long memoryBudget(){
+    if (budget == 0){
+        const char* value = getenv("EDITOR_MEMORY_BUDGET");
+        long long bytes = 0;
+        if (!value || !memParseSize(value, &bytes) || bytes == 0){
+            long pages = sysconf(_SC_PHYS_PAGES);
+            long pageSize = sysconf(_SC_PAGESIZE);
+            bytes = pages > 0 && pageSize > 0 ? (long long) pages * pageSize / 2 : 1024LL * 1024 * 1024;
+        }
+        budget = bytes;
+    }
+    return budget;
+}
+
+static int openSwap(){
+    if (swapFile)
+        return 1;
+    const char* dir = getenv("TMPDIR");
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/editor-swap-XXXXXX", dir && *dir ? dir : "/tmp");
+    int fd = mkstemp(path);
+    if (fd < 0)
+        return 0;
+    unlink(path); // only reachable through the descriptor, it goes away with the editor
+    swapFile = fdopen(fd, "w+");
+    if (!swapFile)
+        close(fd);
+    return swapFile != NULL;
+}
+
+// Writes the text of every line at the end of the swap file, each as its size followed by its bytes
+static int writeSwap(){
+    if (!openSwap() || fseeko(swapFile, 0, SEEK_END) != 0)
+        return 0;
+    swapOffset = ftello(swapFile);
+    char* copy = NULL;
+    int written = 1;
+    for (int i = 0; i < openedFileLines && written; i++){
+        struct outputBuffer* line = &fromOpenedFile[i];
+        const char* text = line->buf;
+        if (isLongLine(line)){
+            char* grown = memRealloc(mem_misc, copy, line->size + 1);
+            if (!grown)
+                break;
+            copy = grown;
+            longLineCopy(longLineOf(line), copy);
+            text = copy;
+        }
+        written = fwrite(&line->size, sizeof(line->size), 1, swapFile) == 1
+                  && fwrite(text, 1, line->size, swapFile) == (size_t) line->size;
+    }
+    memFree(mem_misc, copy);
+    if (fflush(swapFile) == 0 && written)
+        return 1;
+    clearerr(swapFile); // what was written is not kept, the document keeps its lines
+    if (ftruncate(fileno(swapFile), swapOffset) != 0)
+        loadStatusMessage("Could not empty the swap file");
+    return 0;
+}
+
+// Lets go of the document in use up to the level, returns 0 when nothing more could be let go of
+int spillDocument(int level){
+    if (spillLevel >= level || openedFileLines == 0 || streamFd >= 0)
+        return 0;
+    if (spillLevel == spill_none){
+        spilledExits = memAlloc(mem_misc, openedFileLines);
+        if (!spilledExits)
+            return 0;
+        for (int i = 0; i < openedFileLines; i++){
+            struct highlightState hs;
+            lineExitState(i, &hs);
+            spilledExits[i] = exitState(&hs);
+        }
+        dropRendering();
+        spillLevel = spill_render;
+        spilledLines = openedFileLines;
+        return 1;
+    }
+    if (spillLevel == spill_render && level == spill_clean && !fileModified && filename && fileUnchanged())
+        spillLevel = spill_clean;
+    else if (spillLevel == spill_render && level == spill_swapped && writeSwap()){
+        spillLevel = spill_swapped;
+        swappedDocuments++;
+    }
+    else
+        return 0;
+    freeLines();
+    wrapFree(); // counted again from the lines
+    return 1;
+}
+
+// Reads the lines of the file back, the file is the one they were read from
+static void readClean(){
+    FILE* f = fopen(filename, "r");
+    if (!f)
+        return;
+    char* line = NULL;
+    size_t size = 0;
+    int readCount;
+    while ((readCount = getline(&line, &size, f)) != -1){
+        while (readCount > 0 && (line[readCount - 1] == '\n' || line[readCount - 1] == '\r'))
+            readCount--;
+        int at = openedFileLines;
+        restoreLine(line, readCount, at < spilledLines ? spilledExits[at] : normal);
+    }
+    free(line);
+    fclose(f);
+}
+
+static void readSwap(){
+    char* text = NULL;
+    int capacity = 0;
+    int size;
+    if (fseeko(swapFile, swapOffset, SEEK_SET) != 0)
+        failExit("Could not read the swap file");
+    for (int i = 0; i < spilledLines; i++){
+        if (fread(&size, sizeof(size), 1, swapFile) != 1 || size < 0)
+            failExit("Could not read the swap file");
+        if (size + 1 > capacity){
+            char* grown = memRealloc(mem_misc, text, size + 1);
+            if (!grown)
+                failExit("Could not read the swap file");
+            text = grown;
+            capacity = size + 1;
+        }
+        if (fread(text, 1, size, swapFile) != (size_t) size)
+            failExit("Could not read the swap file");
+        restoreLine(text, size, spilledExits[i]);
+    }
+    memFree(mem_misc, text);
+    if (--swappedDocuments == 0 && ftruncate(fileno(swapFile), 0) != 0)
+        loadStatusMessage("Could not empty the swap file");
+}
+
+// Puts back what the document in use has let go of, returns 1 when the file had to be read again as it is now
+int spillRestore(){
+    if (spillLevel == spill_none)
+        return 0;
+    int changed = 0;
+    if (spillLevel == spill_render)
+        restoreRendering(spilledExits);
+    else if (spillLevel == spill_swapped)
+        readSwap();
+    else if (fileUnchanged())
+        readClean();
+    if (spillLevel == spill_clean && openedFileLines != spilledLines){ // the file has changed, it is read as it is now
+        char* file = memStrdup(mem_misc, filename);
+        freeLines();
+        foldFree();
+        lineIndexFree();
+        if (file && access(file, R_OK) == 0){
+            openFile(file);
+            loadStatusMessage("%.40s changed on disk while put aside, read again", file);
+        }
+        else
+            loadStatusMessage("%.40s could not be read again", filename);
+        memFree(mem_misc, file);
+        changed = 1;
+    }
+    trimLineTables();
+    wrapRowsFrom(0);
+    memFree(mem_misc, spilledExits);
+    spilledExits = NULL;
+    spillLevel = spill_none;
+    return changed;
+}
+
+// The document in use is being closed: the rendering is put back for the open cache, the rest is let go of
+void spillClose(){
+    if (spillLevel == spill_render){
+        restoreRendering(spilledExits);
+        memFree(mem_misc, spilledExits);
+        spilledExits = NULL;
+        spillLevel = spill_none;
+        return;
+    }
+    if (spillLevel == spill_swapped && --swappedDocuments == 0 && ftruncate(fileno(swapFile), 0) != 0)
+        loadStatusMessage("Could not empty the swap file");
+    memFree(mem_misc, spilledExits);
+    spilledExits = NULL;
+    spillLevel = spill_none;
+}
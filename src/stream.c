@@ -0,0 +1,243 @@
+#include "editor.h"
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+// Streaming open: 'bin/main.o -' reads the standard input, and a FIFO is read as it is written to
+// the stream is read while the editor waits for a key (see ttyRead()), a batch at a time,
+// so the screen is painted as soon as its lines arrive and the status bar counts the lines as they come
+// keys are read from /dev/tty when the standard input is the stream
+//
+// Following a file ('bin/main.o --follow file.log') reads it the same way, but its end is only where it stops for now:
+// inotify tells when it grows and only the bytes appended since are read, the view stays at the bottom if it was there
+// (without inotify the file is looked at each time the editor waits for a key)
+// the last line is shown even while it has no ending yet, and goes on as more of it is read unless the document has
+// been edited since: the edit may have changed that line or moved it, so the rest of it is read as a line of its own
+// a truncation is told by the file being shorter than what has been read, or no longer holding the last bytes read
+
+#define STREAM_READ 65536 // bytes read at once
+#define STREAM_BATCH_TIME 10000 // microseconds of reading before going back to the keyboard
+#define STREAM_FIRST_PAINT 1000000 // microseconds to wait for a screen full of lines before the first paint
+#define STREAM_TAIL 64 // last bytes read from a followed file, looked for again to tell it has been written over
+
+int streamFd = -1;
+int streamWatchFd = -1;
+static int following = 0;
+static char* partial = NULL; // the start of a line which has not ended yet
+static int partialSize = 0;
+static int partialCapacity = 0;
+static int partialShown = 0; // a followed file stopped in the middle of a line, which is the last line of the document
+static int shownModified = 0; // fileModified when that line was shown, an edit since ends it there
+static char tail[STREAM_TAIL]; // the bytes of the followed file just before the read offset
+static int tailSize = 0;
+
+// The stream is that of the document in use (see document.c)
+void streamKeepState(){
+    keepDocumentState(&streamFd, sizeof(streamFd));
+    keepDocumentState(&streamWatchFd, sizeof(streamWatchFd));
+    keepDocumentState(&following, sizeof(following));
+    keepDocumentState(&partial, sizeof(partial));
+    keepDocumentState(&partialSize, sizeof(partialSize));
+    keepDocumentState(&partialCapacity, sizeof(partialCapacity));
+    keepDocumentState(&partialShown, sizeof(partialShown));
+    keepDocumentState(&shownModified, sizeof(shownModified));
+    keepDocumentState(tail, sizeof(tail));
+    keepDocumentState(&tailSize, sizeof(tailSize));
+}
+
+// Adds a line to the end of the document, without its line ending
+static void streamLine(char* text, int size){
+    while (size > 0 && text[size - 1] == '\r')
+        size--;
+    insertNewLine(openedFileLines, text, size);
+}
+
+static void keepPartial(const char* text, int size){
+    if (size == 0)
+        return;
+    if (partialSize + size > partialCapacity){
+        int capacity = (partialSize + size) * 2;
+        char* grown = memRealloc(mem_misc, partial, capacity);
+        if (!grown)
+            failExit("Could not read the stream");
+        partial = grown;
+        partialCapacity = capacity;
+    }
+    memcpy(&partial[partialSize], text, size);
+    partialSize += size;
+}
+
+// Keeps the last bytes read from the followed file
+static void keepTail(const char* text, int size){
+    if (size >= STREAM_TAIL){
+        memcpy(tail, text + size - STREAM_TAIL, STREAM_TAIL);
+        tailSize = STREAM_TAIL;
+        return;
+    }
+    int keep = tailSize + size > STREAM_TAIL ? STREAM_TAIL - size : tailSize;
+    memmove(tail, tail + tailSize - keep, keep);
+    memcpy(tail + keep, text, size);
+    tailSize = keep + size;
+}
+
+// Whether the followed file has been truncated: it is shorter than what has been read, or it has grown
+// past that again since but no longer holds the bytes read last where they were
+static int truncated(){
+    struct stat st;
+    off_t offset = lseek(streamFd, 0, SEEK_CUR);
+    if (fstat(streamFd, &st) != 0 || offset < 0)
+        return 0;
+    if (st.st_size < offset)
+        return 1;
+    char now[STREAM_TAIL];
+    return tailSize > 0 && (pread(streamFd, now, tailSize, offset - tailSize) != tailSize || memcmp(now, tail, tailSize));
+}
+
+// Adds text which continues the line shown last
+static void continueLine(char* text, int size){
+    if (size > 0 && openedFileLines > 0)
+        appendString(fromOpenedFile, openedFileLines - 1, text, size);
+}
+
+// Adds the bytes read from the stream, returns the number of lines it ended
+static int streamText(char* text, int size){
+    int lines = 0;
+    char* line = text;
+    char* end = text + size;
+    char* newline;
+    while ((newline = memchr(line, '\n', end - line))){
+        if (partialShown){
+            continueLine(line, newline - line);
+            partialShown = 0;
+        }
+        else if (partialSize){
+            keepPartial(line, newline - line);
+            streamLine(partial, partialSize);
+            partialSize = 0;
+        }
+        else
+            streamLine(line, newline - line);
+        lines++;
+        line = newline + 1;
+    }
+    if (partialShown)
+        continueLine(line, end - line);
+    else
+        keepPartial(line, end - line);
+    return lines;
+}
+
+// Starts reading the document from fd, a file given as followPath is followed as it grows
+// returns once the first screen is full, the stream has ended or STREAM_FIRST_PAINT has passed
+void openStream(int fd, const char* followPath){
+    streamFd = fd;
+    streamWatchFd = fd;
+    following = followPath != NULL;
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    if (following){
+        streamWatchFd = -1;
+#ifdef __linux__
+        streamWatchFd = inotify_init1(IN_NONBLOCK);
+        if (streamWatchFd >= 0 && inotify_add_watch(streamWatchFd, followPath, IN_MODIFY) < 0){
+            close(streamWatchFd);
+            streamWatchFd = -1;
+        }
+#endif
+    }
+    double start = perfNow();
+    while (streamFd >= 0 && openedFileLines < screenrows && perfNow() - start < STREAM_FIRST_PAINT){
+        if (streamRead() == 0 && following)
+            break; // the file has been read to its end, there is nothing to wait for
+        struct pollfd pfd = {fd, POLLIN, 0};
+        poll(&pfd, 1, (STREAM_FIRST_PAINT - (perfNow() - start)) / 1000);
+    }
+}
+
+// Stops reading, the line left without an ending is added
+void closeStream(){
+    if (streamFd < 0)
+        return;
+    if (partialSize)
+        streamLine(partial, partialSize);
+    memFree(mem_misc, partial);
+    partial = NULL;
+    partialSize = partialCapacity = 0;
+    partialShown = 0;
+    tailSize = 0;
+    if (streamWatchFd >= 0 && streamWatchFd != streamFd)
+        close(streamWatchFd);
+    if (streamFd != STDIN_FILENO)
+        close(streamFd);
+    streamFd = -1;
+    streamWatchFd = -1;
+    following = 0;
+    trimLineTables();
+}
+
+// The document has been written over the followed file, what is in the file now is already in the document
+void streamSaved(){
+    if (!following)
+        return;
+    lseek(streamFd, 0, SEEK_END);
+    partialSize = 0;
+    partialShown = 0;
+    tailSize = 0;
+}
+
+// Reads what the stream holds, for at most STREAM_BATCH_TIME, and adds its complete lines to the end of the document
+// returns whether the document has changed, the stream is closed once it ends
+int streamRead(){
+    static char buf[STREAM_READ];
+    int changed = 0;
+    int modified = fileModified;
+    int recording = undoRecording;
+    undoRecording = 0;
+    int atBottom = following && cursorPos.y + rowOffset >= openedFileLines;
+    if (streamWatchFd >= 0 && streamWatchFd != streamFd)
+        while (read(streamWatchFd, buf, sizeof(buf)) > 0)
+            ; // the events only tell that the file has grown
+    if (following && truncated()){ // as log rotation does
+        lseek(streamFd, 0, SEEK_SET);
+        partialSize = 0;
+        partialShown = 0;
+        tailSize = 0;
+        loadStatusMessage("File truncated, following from its start");
+    }
+    if (partialShown && fileModified != shownModified)
+        partialShown = 0; // what follows is a line of its own
+    double start = perfNow();
+    while (streamFd >= 0 && perfNow() - start < STREAM_BATCH_TIME){
+        ssize_t count = read(streamFd, buf, sizeof(buf));
+        if (count < 0 && (errno == EAGAIN || errno == EINTR))
+            break; // nothing more for now
+        if (count == 0 && following){ // the end of the file for now, its last line is shown even if unfinished
+            if (partialSize){
+                streamLine(partial, partialSize);
+                partialSize = 0;
+                partialShown = 1;
+                shownModified = modified;
+                changed = 1;
+            }
+            break;
+        }
+        if (count <= 0){ // the stream has ended
+            changed |= partialSize != 0;
+            closeStream();
+            loadStatusMessage("End of input, %d lines", openedFileLines);
+            break;
+        }
+        if (following)
+            keepTail(buf, count);
+        changed |= streamText(buf, count) > 0 || partialShown;
+    }
+    fileModified = modified; // the lines of the stream are not edits
+    undoRecording = recording;
+    if (changed && atBottom){ // keep the last line in view
+        cursorPos.x = 1;
+        colOffset = 0;
+        rowOffset = openedFileLines > screenrows ? openedFileLines - screenrows : 0;
+        cursorPos.y = openedFileLines - rowOffset;
+    }
+    return changed;
+}
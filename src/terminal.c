@@ -0,0 +1,177 @@
+#include "editor.h"
+
+// The editor talks to the terminal through a backend
+// the tty backend is the real terminal, the memory backend replays input from a buffer
+// and only counts the output, so that the editor can run without a terminal (benchmarks)
+
+struct termios copyFlags;
+static int ttyIn = STDIN_FILENO;
+static int ttyOut = STDOUT_FILENO;
+
+// Reads a single byte from the terminal, times out after 1/10th of a second
+// or as soon as the stream the document is read from has more of it (see stream.c), or results of find in files are in (find.c)
+static int ttyRead(char* c){
+    if (streamFd >= 0 || fileWatchFd >= 0 || findWakeFd >= 0){
+        struct pollfd fds[4] = {{ttyIn, POLLIN, 0}, {streamWatchFd, POLLIN, 0}, {fileWatchFd, POLLIN, 0}, {findWakeFd, POLLIN, 0}};
+        if (poll(fds, 4, 100) <= 0 || !(fds[0].revents & POLLIN))
+            return 0;
+    }
+    return read(ttyIn, c, 1);
+}
+
+static int ttyWrite(const char* sequence, int count){
+    return write(ttyOut, sequence, count);
+}
+
+// Retreives the size of the terminal's width and height
+static int ttyGetSize(int *rows, int *cols){
+    struct winsize ws;
+    // ??maybe stands for: Terminal Input/Output Control) Get WINdow SiZe.)
+    int res = ioctl(ttyOut, TIOCGWINSZ, &ws);
+    if (res == -1 || ws.ws_col == 0){
+        // ioctl failed, try alternative method to get height and width
+        struct outputBuffer oBuf = {NULL, 0, 0, NULL};
+        appendToBuffer(&oBuf, REPOS_CURSOR_BOTTOM_RIGHT);
+        appendToBuffer(&oBuf, QUERRY_CURSOR_POS);
+        ttyWrite(oBuf.buf, oBuf.size);
+        memFree(mem_frames, oBuf.buf);
+        char buf[32];
+        unsigned int i = 0;
+        while (i < sizeof(buf) - 1) {
+            if (ttyRead(&buf[i]) != 1)
+                break; // error
+            if (buf[i] == 'R') {
+                buf[i] = '\0';
+                break; // terminate input once R is reached
+            }
+            i++;
+        }
+        if (buf[0] != '\x1b' || buf[1] != '[')
+            // Alternative method failed
+            return -1;
+        
+        int res = sscanf(&buf[2], "%d;%d", rows, cols);
+        if ( res != 2) // need to read both integers or
+            // or else Alternative method fails
+            return -1;
+        
+        return 0;
+    }
+    else {
+        *cols = ws.ws_col;
+        *rows = ws.ws_row;
+    }
+    return 0;
+}
+
+// Terminal is adjusted to a custom state
+static void ttyEnableRaw(){
+    struct termios rawFlags;
+    int res;
+    if (!isatty(STDIN_FILENO)){ // the document is piped in, keys come from the controlling terminal
+        ttyIn = open("/dev/tty", O_RDONLY);
+        if (ttyIn == -1)
+            failExit("Could not open the terminal");
+    }
+    res = tcgetattr(ttyIn, &rawFlags);
+    if (res == -1)
+        failExit("Could not retreive flags");
+    // Save original flags to restore them before exiting
+    copyFlags = rawFlags;
+    
+    // c_lflag: “local flags"  // c_iflag: "input flags"
+    // c_oflag: "output flags" // c_cflag: "control flags"
+    rawFlags.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+    // ~ECHO echo mode off
+    // ~ICANON canonical mode off - reads byte by byte, not line by line
+    // ~ISIG - reads ctr + c not as (SIGINT) and ctr + z not as (SIGTSTP) and ctr + y not to suspend to background
+    // ~IEXTEN - ctr + v not to have the terminal wait for you to type another character
+    //         - ctr + o not to discard the control character
+    rawFlags.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+    // ~BRKINT (old, usually not important) not have a break condition cause a SIGINT signal
+    // ~ICRNL - not to have the terminal helpfully translating any carriage returns into newlines (10, '\n').
+    // ~INPCK (old, usually not important) disables parity checking, which doesn’t seem to                  ly to modern terminal emulators.
+    // ~ISTRIP (old, usually turned off already) not to strip 8th bits of each input byte.
+    // ~IXON - reads ctr + s and ctrl + q, usually they toggling data from being/not being transmitted to the terminal, for XON and XOFF of transmissions.
+    
+    
+    rawFlags.c_oflag &= ~(OPOST);
+    //  ~OPOST - not to translate "\n" to "\r\n". terminal requires both of these characters in order to start a new line of text.
+    
+    rawFlags.c_cflag |= (CS8);
+    // |CS8 (a mask) sets the character size to 8 bits per byte. It is usually already set that way.
+    
+    // c_cc: control characters
+    rawFlags.c_cc[VMIN] = 0; // minimum number of bytes needed before read() can return
+    rawFlags.c_cc[VTIME] = 1; // maximum amount of time to wait before read() returns.  1/10th of a second
+    res = tcsetattr(ttyIn, TCSAFLUSH, &rawFlags);
+    // TCSAFLUSH argument specifies when to apply the change: it waits for all pending output to be written to the terminal, and also discards any input that hasn’t been read.
+    if (res == -1)
+        failExit("Could not set flags (raw mode)");
+}
+
+// Terminal is reset to it's natural state
+static void ttyDisableRaw(){
+    int res = tcsetattr(ttyIn, TCSAFLUSH, &copyFlags);
+    if (res == -1)
+        failExit("Could not reset flags");
+}
+
+struct terminalBackend ttyBackend = {
+    ttyRead, ttyWrite, ttyGetSize, ttyEnableRaw, ttyDisableRaw
+};
+
+/// In memory terminal
+
+struct memoryTerminal memoryTerminal = {NULL, 0, 0, 24, 80, 0, 0, NULL};
+
+// Queues input to be read by the editor as if it was typed
+void memoryTerminalInput(const char* input, int len){
+    struct memoryTerminal* mt = &memoryTerminal;
+    if (mt->inputPos == mt->inputSize)
+        mt->inputPos = mt->inputSize = 0; // everything has been read, reuse the buffer
+    char* ptr = realloc(mt->input, mt->inputSize + len);
+    if (ptr == NULL)
+        return;
+    memcpy(&ptr[mt->inputSize], input, len);
+    mt->input = ptr;
+    mt->inputSize += len;
+}
+
+// Hands out the queued input byte by byte
+// once it runs out, onDrained is given the chance to queue more (or to stop the editor)
+static int memoryRead(char* c){
+    struct memoryTerminal* mt = &memoryTerminal;
+    if (mt->inputPos == mt->inputSize && mt->onDrained)
+        mt->onDrained();
+    if (mt->inputPos == mt->inputSize)
+        return 0; // same as a tty timing out
+    *c = mt->input[mt->inputPos++];
+    return 1;
+}
+
+static int memoryWrite(const char* sequence, int count){
+    (void) sequence;
+    memoryTerminal.bytesWritten += count;
+    memoryTerminal.writes++;
+    return count;
+}
+
+static int memoryGetSize(int *rows, int *cols){
+    *rows = memoryTerminal.rows;
+    *cols = memoryTerminal.cols;
+    return 0;
+}
+
+static void memoryEnableRaw(){
+    // nothing to do, there is no line discipline
+}
+
+static void memoryDisableRaw(){
+}
+
+struct terminalBackend memoryBackend = {
+    memoryRead, memoryWrite, memoryGetSize, memoryEnableRaw, memoryDisableRaw
+};
+
+struct terminalBackend* terminal = &ttyBackend;
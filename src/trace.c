@@ -0,0 +1,158 @@
+#include "editor.h"
+
+// Tracing of the editor's hot paths (opt in with --trace file or EDITOR_TRACE=file)
+// Every thread records its spans into its own ring buffer, so recording never takes a lock
+// when the editor exits, the rings are written out in the Chrome trace format (chrome://tracing, Perfetto)
+// together with a latency histogram of each span
+
+#define TRACE_RING_SIZE (1 << 20) // events kept per thread, older ones are overwritten
+#define TRACE_SUB_BUCKETS 4 // histogram buckets per power of two
+#define TRACE_BUCKETS (40 * TRACE_SUB_BUCKETS) // up to 2^40 ns
+
+struct traceEvent {
+    int span;
+    double start; // microseconds
+    double duration;
+};
+
+struct traceRing {
+    struct traceEvent* events;
+    unsigned long head; // number of events ever recorded
+    int tid;
+    struct traceRing* next;
+};
+
+int traceEnabled = 0;
+static char* tracePath;
+static struct traceRing* traceRings; // every thread's ring, pushed without locking
+static __thread struct traceRing* localRing;
+static int nextTid = 1;
+static unsigned long histograms[trace_spans][TRACE_BUCKETS];
+static unsigned long longest[trace_spans]; // the longest of each span in nanoseconds, the buckets only bound it
+static double traceOrigin;
+
+static const char* traceNames[trace_spans] = {
+    "processKey", "refresh", "loadRows", "updateStatus", "saveFile", "openFile", "onSearch", "reloadFile", "replace", "lines"
+};
+
+// Starts recording, the trace is written to the given path when the editor exits
+void traceInit(const char* path){
+    free(tracePath);
+    tracePath = strdup(path);
+    traceOrigin = perfNow();
+    if (!traceEnabled)
+        atexit(traceWrite);
+    traceEnabled = 1;
+}
+
+// Returns the ring of the calling thread, creating it on first use
+static struct traceRing* traceLocalRing(){
+    if (localRing)
+        return localRing;
+    struct traceRing* ring = malloc(sizeof(struct traceRing));
+    if (!ring)
+        return NULL;
+    ring->events = malloc(sizeof(struct traceEvent) * TRACE_RING_SIZE);
+    if (!ring->events){
+        free(ring);
+        return NULL;
+    }
+    ring->head = 0;
+    ring->tid = __atomic_fetch_add(&nextTid, 1, __ATOMIC_RELAXED);
+    ring->next = __atomic_load_n(&traceRings, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&traceRings, &ring->next, ring, 0,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ; // another thread registered first, ring->next now holds the new head
+    localRing = ring;
+    return ring;
+}
+
+// Maps a duration to its histogram bucket, each power of two of nanoseconds is split in TRACE_SUB_BUCKETS
+static int traceBucket(double micro){
+    unsigned long ns = (unsigned long) (micro * 1000);
+    if (ns < TRACE_SUB_BUCKETS)
+        return ns;
+    int power = 63 - __builtin_clzl(ns);
+    int sub = (ns >> (power - 2)) & (TRACE_SUB_BUCKETS - 1);
+    int bucket = power * TRACE_SUB_BUCKETS + sub;
+    return bucket < TRACE_BUCKETS ? bucket : TRACE_BUCKETS - 1;
+}
+
+// Upper bound of a histogram bucket in microseconds
+static double traceBucketLimit(int bucket){
+    int power = bucket / TRACE_SUB_BUCKETS, sub = bucket % TRACE_SUB_BUCKETS;
+    if (power == 0)
+        return (bucket + 1) / 1000.0;
+    double low = (double) (1UL << power);
+    return (low + (sub + 1) * low / TRACE_SUB_BUCKETS) / 1000.0;
+}
+
+// Records a span which began at 'start' (from perfNow()) and ends now
+void traceEnd(int span, double start){
+    double now = perfNow();
+    __atomic_fetch_add(&histograms[span][traceBucket(now - start)], 1, __ATOMIC_RELAXED);
+    unsigned long ns = (unsigned long) ((now - start) * 1000);
+    unsigned long seen = __atomic_load_n(&longest[span], __ATOMIC_RELAXED);
+    while (ns > seen && !__atomic_compare_exchange_n(&longest[span], &seen, ns, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ; // another thread stored a span first, seen now holds it
+    struct traceRing* ring = traceLocalRing();
+    if (!ring)
+        return;
+    struct traceEvent* event = &ring->events[ring->head % TRACE_RING_SIZE];
+    event->span = span;
+    event->start = start - traceOrigin;
+    event->duration = now - start;
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+// Writes the recorded spans and the histograms to the trace file
+void traceWrite(){
+    if (!traceEnabled || !tracePath)
+        return;
+    FILE* f = fopen(tracePath, "w");
+    if (!f)
+        return;
+    int pid = getpid();
+    int first = 1;
+    fprintf(f, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [");
+    for (struct traceRing* ring = __atomic_load_n(&traceRings, __ATOMIC_ACQUIRE); ring; ring = ring->next){
+        unsigned long head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        unsigned long count = head < TRACE_RING_SIZE ? head : TRACE_RING_SIZE;
+        for (unsigned long i = head - count; i < head; i++){
+            struct traceEvent* event = &ring->events[i % TRACE_RING_SIZE];
+            fprintf(f, "%s\n{\"name\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": %d, \"tid\": %d}",
+                    first ? "" : ",", traceNames[event->span], event->start, event->duration, pid, ring->tid);
+            first = 0;
+        }
+    }
+    fprintf(f, "\n],\n\"histograms\": {");
+
+    // per span: count, percentiles (the upper bounds of their buckets), the longest span and the non empty buckets as [upper bound in us, count]
+    for (int span = 0; span < trace_spans; span++){
+        unsigned long total = 0;
+        for (int b = 0; b < TRACE_BUCKETS; b++)
+            total += histograms[span][b];
+        double percentiles[3] = {0, 0, 0}; // p50, p90, p99
+        const double ranks[3] = {0.5, 0.9, 0.99};
+        unsigned long seen = 0;
+        int p = 0;
+        for (int b = 0; b < TRACE_BUCKETS; b++){
+            seen += histograms[span][b];
+            while (p < 3 && total && seen >= ranks[p] * total)
+                percentiles[p++] = traceBucketLimit(b);
+        }
+        fprintf(f, "%s\n\"%s\": {\"count\": %lu, \"p50_us\": %.3f, \"p90_us\": %.3f, \"p99_us\": %.3f, \"max_us\": %.3f, \"buckets\": [",
+                span ? "," : "", traceNames[span], total, percentiles[0], percentiles[1], percentiles[2],
+                longest[span] / 1000.0);
+        int firstBucket = 1;
+        for (int b = 0; b < TRACE_BUCKETS; b++){
+            if (!histograms[span][b])
+                continue;
+            fprintf(f, "%s[%.3f, %lu]", firstBucket ? "" : ", ", traceBucketLimit(b), histograms[span][b]);
+            firstBucket = 0;
+        }
+        fprintf(f, "]}");
+    }
+    fprintf(f, "\n}}\n");
+    fclose(f);
+}
@@ -0,0 +1,545 @@
+#include "editor.h"
+
+// Undo and redo (ctrl+z and ctrl+y)
+// the primitives which change the lines log each change as a record: text or a line inserted, or text or a line deleted
+// along with the text it held, so undoing costs as much as the edit did however large the document is
+// the records of one command make a group which is undone at once, and characters typed or deleted one after the other
+// in a line are merged into a single record, of the group they continue
+// the records are packed one after the other in an arena, each followed by its size so that the log is walked back from its end
+// undoing applies the inverse of the records of the last group through the same primitives, which log them as the group to redo
+// the oldest groups are dropped once the logs hold more than EDITOR_UNDO_BUDGET bytes (k, m or g for KB, MB and GB)
+
+#define UNDO_BUDGET (16 * 1024 * 1024) // bytes of records kept when EDITOR_UNDO_BUDGET is not set
+
+enum undo_type {
+    undo_insert_text = 0, // length characters were inserted at pos
+    undo_delete_text, // length characters were deleted at pos, they follow the record
+    undo_insert_line, // the line was inserted
+    undo_delete_line, // the line was deleted, its length characters follow the record
+    undo_replace, // the text at pos matches was replaced (see replace.c), the length bytes following the record hold
+                  // the lengths of the text inserted and of the text removed, the two texts and the matches (see packMatches())
+    undo_move_lines, // the pos lines from line were put in another order, the one of moveRows(), packed in the length bytes following
+    undo_delete_lines, // pos lines were deleted, the length bytes following hold their lines, sizes and texts (see undoDeletedRows())
+    undo_insert_lines // pos lines were inserted, their lines are packed in the length bytes following
+};
+
+struct undoRecord {
+    int group;
+    int line;
+    int pos;
+    int length;
+    unsigned char type; // enum undo_type
+    unsigned char typed; // a single character typed or deleted, the next one may be merged into it
+};
+
+struct undoLog {
+    char* buf;
+    size_t start; // the oldest record kept, those before it have been dropped
+    size_t size;
+    size_t capacity;
+};
+
+int undoRecording = 1;
+static struct undoLog history = {NULL, 0, 0, 0}; // the groups to undo, the last one on top
+static struct undoLog future = {NULL, 0, 0, 0}; // the groups undone, to redo
+static struct undoLog* target = &history; // the log the edits go to
+static int lastGroup = 0; // groups are numbered in the order they are made, and keep their number through undo and redo
+static int group = 0; // the group being logged, 0 when the next edit begins a new one, -1 when it is too large to keep
+static int droppedGroup = 0; // the last group dropped from the history, the state an empty history stands for
+static int savedGroup = 0; // the group on top of the history when the document was saved, -1 when that state is out of reach
+static int replaying = 0;
+static size_t budget = 0;
+
+// The history and the future are those of the document in use (see document.c)
+void undoKeepState(){
+    keepDocumentState(&history, sizeof(history));
+    keepDocumentState(&future, sizeof(future));
+    keepDocumentState(&lastGroup, sizeof(lastGroup));
+    keepDocumentState(&group, sizeof(group));
+    keepDocumentState(&droppedGroup, sizeof(droppedGroup));
+    keepDocumentState(&savedGroup, sizeof(savedGroup));
+}
+
+static size_t recordBytes(const struct undoRecord* rec){
+    int text = rec->type == undo_insert_text || rec->type == undo_insert_line ? 0 : rec->length;
+    return sizeof(struct undoRecord) + text + sizeof(size_t);
+}
+
+static size_t logBytes(const struct undoLog* log){
+    return log->size - log->start;
+}
+
+// Reads the last record of the log and where it begins, returns 0 when the log is empty
+static int lastRecord(const struct undoLog* log, struct undoRecord* rec, size_t* at){
+    if (log->size == log->start)
+        return 0;
+    size_t bytes;
+    memcpy(&bytes, log->buf + log->size - sizeof(size_t), sizeof(size_t));
+    *at = log->size - bytes;
+    memcpy(rec, log->buf + *at, sizeof(struct undoRecord));
+    return 1;
+}
+
+// The group on top of the log, or the one the history was last cut down to
+static int topGroup(const struct undoLog* log){
+    struct undoRecord rec;
+    size_t at;
+    return lastRecord(log, &rec, &at) ? rec.group : droppedGroup;
+}
+
+static void clearLog(struct undoLog* log){
+    memFree(mem_undo, log->buf);
+    log->buf = NULL;
+    log->start = log->size = log->capacity = 0;
+}
+
+// Makes room for bytes more at the end of the log
+static void reserveLog(struct undoLog* log, size_t bytes){
+    if (log->size + bytes <= log->capacity)
+        return;
+    size_t capacity = log->capacity ? log->capacity * 2 : 4096;
+    if (capacity < log->size + bytes)
+        capacity = log->size + bytes;
+    char* grown = memRealloc(mem_undo, log->buf, capacity);
+    if (!grown)
+        failExit("Could not keep the undo history");
+    log->buf = grown;
+    log->capacity = capacity;
+}
+
+// Drops the oldest group of the log, the room it took is taken back once it is half of the log
+static void dropOldest(struct undoLog* log){
+    struct undoRecord rec;
+    memcpy(&rec, log->buf + log->start, sizeof(rec));
+    int oldest = rec.group;
+    while (log->start < log->size){
+        memcpy(&rec, log->buf + log->start, sizeof(rec));
+        if (rec.group != oldest)
+            break;
+        log->start += recordBytes(&rec);
+    }
+    if (log == &history)
+        droppedGroup = oldest;
+    else if (savedGroup >= oldest)
+        savedGroup = -1; // the groups from oldest on can no longer be redone
+    if (log->start > log->size / 2){
+        memmove(log->buf, log->buf + log->start, log->size - log->start);
+        log->size -= log->start;
+        log->start = 0;
+    }
+}
+
+// Drops the oldest groups until the logs fit in the budget, then what is left to redo,
+// and last the group being logged, which is then no longer logged
+static void keepBudget(){
+    if (replaying)
+        return; // the group being replayed is still read from its log
+    while (logBytes(&history) + logBytes(&future) > budget){
+        struct undoRecord oldest;
+        if (logBytes(&history))
+            memcpy(&oldest, history.buf + history.start, sizeof(oldest));
+        if (logBytes(&history) && oldest.group != group)
+            dropOldest(&history);
+        else if (logBytes(&future))
+            dropOldest(&future);
+        else {
+            clearLog(&history);
+            droppedGroup = group;
+            group = -1;
+        }
+    }
+}
+
+// Whether the edit is to be logged
+static int logging(){
+    if (!undoRecording || group < 0)
+        return 0;
+    if (budget == 0){
+        const char* value = getenv("EDITOR_UNDO_BUDGET");
+        long long bytes = 0;
+        budget = value && memParseSize(value, &bytes) && bytes > 0 ? bytes : UNDO_BUDGET;
+    }
+    if (!replaying && logBytes(&future)){ // a new edit, what was undone can no longer be redone
+        if (savedGroup > topGroup(&history))
+            savedGroup = -1;
+        clearLog(&future);
+    }
+    return 1;
+}
+
+// Adds one more character at index to the text of the last record, returns where it goes
+static char* growRecord(struct undoLog* log, size_t at, struct undoRecord* rec, int index){
+    reserveLog(log, 1);
+    char* text = log->buf + at + sizeof(struct undoRecord);
+    memmove(text + index + 1, text + index, rec->length - index);
+    rec->length++;
+    size_t bytes = recordBytes(rec);
+    memcpy(log->buf + at, rec, sizeof(struct undoRecord));
+    memcpy(log->buf + at + bytes - sizeof(size_t), &bytes, sizeof(size_t));
+    log->size = at + bytes;
+    return text + index;
+}
+
+// Logs a change, or merges a character into the record it continues, returns where the text deleted goes
+static char* logRecord(int type, int line, int pos, int length, int typed){
+    struct undoRecord rec;
+    size_t at;
+    if (typed && lastRecord(target, &rec, &at) && rec.typed && rec.type == type && rec.line == line
+            && (rec.group == group || (group == 0 && rec.group != savedGroup))){
+        if (type == undo_insert_text && pos == rec.pos + rec.length){
+            group = rec.group;
+            rec.length++;
+            memcpy(target->buf + at, &rec, sizeof(rec));
+            return NULL;
+        }
+        if (type == undo_delete_text && pos == rec.pos){ // deleting forward
+            group = rec.group;
+            return growRecord(target, at, &rec, rec.length);
+        }
+        if (type == undo_delete_text && pos == rec.pos - 1){ // deleting backward
+            group = rec.group;
+            rec.pos--;
+            return growRecord(target, at, &rec, 0);
+        }
+    }
+    if (group == 0)
+        group = ++lastGroup;
+    rec = (struct undoRecord) {group, line, pos, length, type, typed};
+    size_t bytes = recordBytes(&rec);
+    reserveLog(target, bytes);
+    char* dest = target->buf + target->size;
+    memcpy(dest, &rec, sizeof(rec));
+    memcpy(dest + bytes - sizeof(size_t), &bytes, sizeof(size_t));
+    target->size += bytes;
+    return dest + sizeof(rec);
+}
+
+static void copyText(const struct outputBuffer* line, char* dest){
+    if (isLongLine(line))
+        longLineCopy(longLineOf(line), dest);
+    else if (line->size)
+        memcpy(dest, line->buf, line->size);
+}
+
+// The next edit begins a new group, called by each command which edits
+void undoBoundary(){
+    if (!replaying)
+        group = 0;
+}
+
+// length characters have been inserted in the line at pos
+void undoInserted(int line, int pos, int length, int typed){
+    if (!logging())
+        return;
+    logRecord(undo_insert_text, line, pos, length, typed);
+    keepBudget();
+}
+
+// length characters are about to be deleted from the line at pos
+void undoDeleted(int line, int pos, const char* text, int length, int typed){
+    if (!logging())
+        return;
+    memcpy(logRecord(undo_delete_text, line, pos, length, typed), text, length);
+    keepBudget();
+}
+
+// The text held by the line holder is cut from the line at pos: the end of a line split in two, now held by the line below,
+// or the whole of a line about to be joined to the one above
+void undoCut(int line, int pos, int holder){
+    if (!logging())
+        return;
+    struct outputBuffer* text = &fromOpenedFile[holder];
+    copyText(text, logRecord(undo_delete_text, line, pos, text->size, 0));
+    keepBudget();
+}
+
+void undoInsertedLine(int at){
+    if (!logging())
+        return;
+    logRecord(undo_insert_line, at, 0, 0, 0);
+    keepBudget();
+}
+
+// The line is about to be deleted
+void undoDeletedLine(int at){
+    if (!logging())
+        return;
+    copyText(&fromOpenedFile[at], logRecord(undo_delete_line, at, 0, fromOpenedFile[at].size, 0));
+    keepBudget();
+}
+
+// Writes value in 7 bit groups, the high bit telling that more follow, returns the bytes it takes (dest may be NULL)
+static int packNumber(unsigned int value, unsigned char* dest){
+    int bytes = 0;
+    do {
+        if (dest)
+            dest[bytes] = (value & 127) | (value > 127 ? 128 : 0);
+        bytes++;
+        value >>= 7;
+    } while (value);
+    return bytes;
+}
+
+static unsigned int unpackNumber(const unsigned char** at){
+    unsigned int value = 0;
+    for (int shift = 0; ; shift += 7){
+        unsigned char byte = *(*at)++;
+        value |= (unsigned int) (byte & 127) << shift;
+        if (!(byte & 128))
+            return value;
+    }
+}
+
+// Packs the matches as the lines between each and the one before, and the characters between them in the same line,
+// a match takes two or three bytes instead of eight, returns the bytes written (dest may be NULL)
+static size_t packMatches(const struct textMatch* matches, int count, unsigned char* dest){
+    size_t bytes = 0;
+    for (int i = 0; i < count; i++){
+        int lines = i ? matches[i].line - matches[i - 1].line : matches[i].line;
+        int pos = i && lines == 0 ? matches[i].pos - matches[i - 1].pos : matches[i].pos;
+        bytes += packNumber(lines, dest ? dest + bytes : NULL);
+        bytes += packNumber(pos, dest ? dest + bytes : NULL);
+    }
+    return bytes;
+}
+
+static void unpackMatches(const unsigned char* at, int count, struct textMatch* matches){
+    for (int i = 0; i < count; i++){
+        int lines = unpackNumber(&at);
+        int pos = unpackNumber(&at);
+        matches[i].line = i ? matches[i - 1].line + lines : lines;
+        matches[i].pos = i && lines == 0 ? matches[i - 1].pos + pos : pos;
+    }
+}
+
+// Packs lines in increasing order as the lines between each and the one before, returns the bytes written (dest may be NULL)
+static size_t packLines(const int* lines, int count, unsigned char* dest){
+    size_t bytes = 0;
+    for (int i = 0; i < count; i++)
+        bytes += packNumber(i ? lines[i] - lines[i - 1] : lines[i], dest ? dest + bytes : NULL);
+    return bytes;
+}
+
+static const unsigned char* unpackLines(const unsigned char* at, int count, int* lines){
+    for (int i = 0; i < count; i++)
+        lines[i] = (i ? lines[i - 1] : 0) + unpackNumber(&at);
+    return at;
+}
+
+// The text at each of count matches, removed, has been replaced with inserted
+void undoReplaced(const struct textMatch* matches, int count, const char* inserted, int insertedLength,
+                  const char* removed, int removedLength){
+    if (!logging())
+        return;
+    int lengths[2] = {insertedLength, removedLength};
+    size_t bytes = sizeof(lengths) + insertedLength + removedLength + packMatches(matches, count, NULL);
+    char* dest = logRecord(undo_replace, matches[0].line, count, bytes, 0);
+    memcpy(dest, lengths, sizeof(lengths));
+    dest += sizeof(lengths);
+    memcpy(dest, inserted, insertedLength);
+    memcpy(dest + insertedLength, removed, removedLength);
+    packMatches(matches, count, (unsigned char*) dest + insertedLength + removedLength);
+    keepBudget();
+}
+
+// The count lines from at have been put in the order of moveRows()
+void undoMovedRows(int at, int count, const int* order){
+    if (!logging())
+        return;
+    size_t bytes = 0;
+    for (int i = 0; i < count; i++)
+        bytes += packNumber(order[i], NULL);
+    unsigned char* dest = (unsigned char*) logRecord(undo_move_lines, at, count, bytes, 0);
+    for (int i = 0; i < count; i++)
+        dest += packNumber(order[i], dest);
+    keepBudget();
+}
+
+// The count lines, in increasing order, are about to be deleted: their lines are kept, then the size of each, then their texts
+void undoDeletedRows(const int* lines, int count){
+    if (!logging())
+        return;
+    size_t bytes = packLines(lines, count, NULL);
+    for (int i = 0; i < count; i++)
+        bytes += packNumber(fromOpenedFile[lines[i]].size, NULL) + fromOpenedFile[lines[i]].size;
+    unsigned char* dest = (unsigned char*) logRecord(undo_delete_lines, lines[0], count, bytes, 0);
+    dest += packLines(lines, count, dest);
+    for (int i = 0; i < count; i++)
+        dest += packNumber(fromOpenedFile[lines[i]].size, dest);
+    for (int i = 0; i < count; i++){
+        copyText(&fromOpenedFile[lines[i]], (char*) dest);
+        dest += fromOpenedFile[lines[i]].size;
+    }
+    keepBudget();
+}
+
+// The count lines, in increasing order, have been inserted
+void undoInsertedRows(const int* lines, int count){
+    if (!logging())
+        return;
+    packLines(lines, count, (unsigned char*) logRecord(undo_insert_lines, lines[0], count, packLines(lines, count, NULL), 0));
+    keepBudget();
+}
+
+// Applies the inverse of a change of many lines at once, returns 0 when the document does not hold what was logged
+static int applyRowsInverse(const struct undoRecord* rec, const unsigned char* packed){
+    int count = rec->pos;
+    int* lines = memAlloc(mem_undo, sizeof(int) * count * 2);
+    if (!lines)
+        failExit("Could not undo");
+    int* numbers = lines + count;
+    int valid = 0;
+    if (rec->type == undo_move_lines){ // the lines go back to where they were
+        for (int i = 0; i < count; i++)
+            numbers[i] = unpackNumber(&packed);
+        for (int i = 0; i < count; i++)
+            lines[numbers[i]] = i;
+        valid = rec->line + count <= openedFileLines;
+        if (valid)
+            moveRows(rec->line, count, lines);
+    }
+    else if (rec->type == undo_delete_lines){
+        packed = unpackLines(packed, count, lines);
+        for (int i = 0; i < count; i++)
+            numbers[i] = unpackNumber(&packed);
+        valid = lines[count - 1] < openedFileLines + count;
+        if (valid)
+            insertRows(lines, count, (const char*) packed, numbers);
+    }
+    else {
+        unpackLines(packed, count, lines);
+        valid = lines[count - 1] < openedFileLines;
+        if (valid)
+            deleteRows(lines, count);
+    }
+    memFree(mem_undo, lines);
+    return valid;
+}
+
+// The document has been saved, the state it is in now is the one not to warn about
+void undoSaved(){
+    savedGroup = topGroup(&history);
+    group = 0; // typing on is not merged into the group saved
+}
+
+// Forgets the history, when a document is opened or closed, or has been changed other than by logged edits
+void undoClear(){
+    clearLog(&history);
+    clearLog(&future);
+    target = &history;
+    group = 0;
+    droppedGroup = ++lastGroup;
+    savedGroup = fileModified ? -1 : droppedGroup;
+}
+
+// Applies the inverse of the record, moving *line and *pos to where it took place
+// a change of text takes the cursor over a change of lines, returns 0 when the document does not hold what was logged
+static int applyInverse(const struct undoRecord* rec, char* text, int* line, int* pos, int* moved){
+    int at = rec->line;
+    switch (rec->type){
+        case undo_insert_text:
+            if (at >= openedFileLines || rec->pos + rec->length > fromOpenedFile[at].size)
+                return 0;
+            for (int i = 0; i < rec->length; i++)
+                deleteFromBuffer(&fromOpenedFile[at], at, rec->pos);
+            *pos = rec->pos;
+            break;
+        case undo_delete_text:
+            if (at >= openedFileLines || rec->pos > fromOpenedFile[at].size)
+                return 0;
+            for (int i = 0; i < rec->length; i++)
+                insertIntoBuffer(&fromOpenedFile[at], at, rec->pos + i, text[i]);
+            *pos = rec->typed ? rec->pos + rec->length : rec->pos;
+            break;
+        case undo_insert_line:
+            if (at >= openedFileLines)
+                return 0;
+            deleteRow(at);
+            updateFollowingStatus(at);
+            if (!*moved){
+                *line = at;
+                *pos = 0;
+            }
+            return 1;
+        case undo_delete_line:
+            if (at > openedFileLines)
+                return 0;
+            insertNewLine(at, text, rec->length);
+            updateFollowingStatus(at + 1);
+            if (!*moved){
+                *line = at;
+                *pos = 0;
+            }
+            return 1;
+        case undo_move_lines:
+        case undo_delete_lines:
+        case undo_insert_lines:
+            *line = at;
+            *pos = 0;
+            *moved = 1;
+            return applyRowsInverse(rec, (unsigned char*) text);
+        case undo_replace: {
+            int lengths[2];
+            memcpy(lengths, text, sizeof(lengths));
+            char* inserted = text + sizeof(lengths);
+            char* removed = inserted + lengths[0];
+            struct textMatch* matches = memAlloc(mem_undo, sizeof(struct textMatch) * rec->pos);
+            if (!matches)
+                failExit("Could not undo");
+            unpackMatches((unsigned char*) removed + lengths[1], rec->pos, matches);
+            int valid = matches[rec->pos - 1].line < openedFileLines;
+            if (valid)
+                replaceMatches(matches, rec->pos, inserted, lengths[0], removed, lengths[1]);
+            *line = at;
+            *pos = matches[0].pos;
+            *moved = 1;
+            memFree(mem_undo, matches);
+            return valid;
+        }
+    }
+    updateBuffer(&toRenderToScreen[at], &fromOpenedFile[at]);
+    updateFollowingStatus(at + 1);
+    *line = at;
+    *moved = 1;
+    return 1;
+}
+
+// Applies the inverse of the last group of from, logging it as a group of to
+static void replay(struct undoLog* from, struct undoLog* to, const char* nothing){
+    struct undoRecord rec;
+    size_t at;
+    if (!lastRecord(from, &rec, &at)){
+        loadStatusMessage("%s", nothing);
+        return;
+    }
+    int replayed = rec.group;
+    int line = -1, pos = 0, moved = 0, matched = 1;
+    target = to;
+    group = replayed;
+    replaying = 1;
+    while (matched && lastRecord(from, &rec, &at) && rec.group == replayed){
+        matched = applyInverse(&rec, from->buf + at + sizeof(rec), &line, &pos, &moved);
+        from->size = at;
+    }
+    replaying = 0;
+    target = &history;
+    group = 0;
+    if (!matched){
+        undoClear();
+        loadStatusMessage("The document no longer holds what was logged, the undo history is cleared");
+    }
+    else if (topGroup(&history) == savedGroup)
+        fileModified = 0;
+    else if (!fileModified)
+        fileModified = 1;
+    showPosition(line, pos);
+    keepBudget();
+}
+
+void undo(){
+    replay(&history, &future, "Nothing to undo");
+}
+
+void redo(){
+    replay(&future, &history, "Nothing to redo");
+}
@@ -0,0 +1,158 @@
+#include "editor.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// UTF-8 text
+// the lines keep their bytes as they are, a character is decoded only where its columns matter: rendering a line,
+// mapping a column to the index of its character and drawing it on the screen
+// most lines of most files are ASCII, a line is checked 16 bytes at a time and then handled a byte a column as before
+
+// Returns 1 when no byte of the text is above 127
+int utf8IsAscii(const char* text, int size){
+    int i = 0;
+#ifdef __SSE2__
+    __m128i seen = _mm_setzero_si128();
+    for (; i + 16 <= size; i += 16)
+        seen = _mm_or_si128(seen, _mm_loadu_si128((const __m128i*) (text + i)));
+    if (_mm_movemask_epi8(seen))
+        return 0;
+#else
+    unsigned long long seen = 0;
+    for (; i + 8 <= size; i += 8){
+        unsigned long long word;
+        memcpy(&word, text + i, sizeof(word));
+        seen |= word;
+    }
+    if (seen & 0x8080808080808080ULL)
+        return 0;
+#endif
+    for (; i < size; i++)
+        if (text[i] & 0x80)
+            return 0;
+    return 1;
+}
+
+// Decodes the character at the start of the size bytes of text into *codepoint and returns its length in bytes
+// a byte which does not begin a valid sequence is a character of its own, with a codepoint of -1
+int utf8Decode(const char* text, int size, int* codepoint){
+    const unsigned char* s = (const unsigned char*) text;
+    int length, min;
+    if (s[0] < 0x80){
+        *codepoint = s[0];
+        return 1;
+    }
+    if (s[0] >= 0xc2 && s[0] <= 0xdf){
+        length = 2;
+        min = 0x80;
+        *codepoint = s[0] & 0x1f;
+    }
+    else if (s[0] >= 0xe0 && s[0] <= 0xef){
+        length = 3;
+        min = 0x800;
+        *codepoint = s[0] & 0x0f;
+    }
+    else if (s[0] >= 0xf0 && s[0] <= 0xf4){
+        length = 4;
+        min = 0x10000;
+        *codepoint = s[0] & 0x07;
+    }
+    else {
+        *codepoint = -1;
+        return 1;
+    }
+    if (length > size){
+        *codepoint = -1;
+        return 1;
+    }
+    for (int i = 1; i < length; i++){
+        if ((s[i] & 0xc0) != 0x80){
+            *codepoint = -1;
+            return 1;
+        }
+        *codepoint = (*codepoint << 6) | (s[i] & 0x3f);
+    }
+    if (*codepoint < min || *codepoint > 0x10ffff || (*codepoint >= 0xd800 && *codepoint <= 0xdfff)){
+        *codepoint = -1;
+        return 1;
+    }
+    return length;
+}
+
+// Bytes of the sequence a lead byte begins, 1 for ASCII and for bytes which begin none
+int utf8Length(int lead){
+    unsigned char c = lead;
+    return (c >= 0xc2 && c <= 0xdf) ? 2 : (c >= 0xe0 && c <= 0xef) ? 3 : (c >= 0xf0 && c <= 0xf4) ? 4 : 1;
+}
+
+// Index of the character before the one at index
+int utf8Previous(const char* text, int index){
+    int start = index - 1;
+    while (start > 0 && index - start < 4 && (text[start] & 0xc0) == 0x80)
+        start--;
+    int codepoint;
+    if (start < 0 || utf8Decode(text + start, index - start, &codepoint) != index - start)
+        return index - 1; // not the end of a valid sequence, a single byte is stepped over
+    return start;
+}
+
+struct codeRange {
+    int first, last;
+};
+
+// characters drawn over the one before them
+static const struct codeRange zeroWidth[] = {
+    {0x0300, 0x036f}, {0x0483, 0x0489}, {0x0591, 0x05bd}, {0x05bf, 0x05bf}, {0x05c1, 0x05c2}, {0x05c4, 0x05c5},
+    {0x05c7, 0x05c7}, {0x0610, 0x061a}, {0x064b, 0x065f}, {0x0670, 0x0670}, {0x06d6, 0x06dc}, {0x06df, 0x06e4},
+    {0x06e7, 0x06e8}, {0x06ea, 0x06ed}, {0x0900, 0x0902}, {0x093a, 0x093a}, {0x093c, 0x093c}, {0x0941, 0x0948},
+    {0x094d, 0x094d}, {0x0951, 0x0957}, {0x0e31, 0x0e31}, {0x0e34, 0x0e3a}, {0x0e47, 0x0e4e}, {0x1ab0, 0x1aff},
+    {0x1dc0, 0x1dff}, {0x200b, 0x200f}, {0x202a, 0x202e}, {0x2060, 0x2064}, {0x20d0, 0x20ff}, {0xfe00, 0xfe0f},
+    {0xfe20, 0xfe2f}, {0xfeff, 0xfeff}, {0xe0100, 0xe01ef}
+};
+
+// characters taking two columns: CJK, Hangul, full width forms and emoji
+static const struct codeRange doubleWidth[] = {
+    {0x1100, 0x115f}, {0x231a, 0x231b}, {0x2329, 0x232a}, {0x23e9, 0x23ec}, {0x23f0, 0x23f0}, {0x23f3, 0x23f3},
+    {0x25fd, 0x25fe}, {0x2614, 0x2615}, {0x2648, 0x2653}, {0x267f, 0x267f}, {0x2693, 0x2693}, {0x26a1, 0x26a1},
+    {0x26aa, 0x26ab}, {0x26bd, 0x26be}, {0x26c4, 0x26c5}, {0x26ce, 0x26ce}, {0x26d4, 0x26d4}, {0x26ea, 0x26ea},
+    {0x26f2, 0x26f3}, {0x26f5, 0x26f5}, {0x26fa, 0x26fa}, {0x26fd, 0x26fd}, {0x2705, 0x2705}, {0x270a, 0x270b},
+    {0x2728, 0x2728}, {0x274c, 0x274c}, {0x274e, 0x274e}, {0x2753, 0x2755}, {0x2757, 0x2757}, {0x2795, 0x2797},
+    {0x27b0, 0x27b0}, {0x27bf, 0x27bf}, {0x2b1b, 0x2b1c}, {0x2b50, 0x2b50}, {0x2b55, 0x2b55}, {0x2e80, 0x303e},
+    {0x3041, 0x33ff}, {0x3400, 0x4dbf}, {0x4e00, 0x9fff}, {0xa000, 0xa4cf}, {0xa960, 0xa97f}, {0xac00, 0xd7a3},
+    {0xf900, 0xfaff}, {0xfe10, 0xfe19}, {0xfe30, 0xfe6f}, {0xff00, 0xff60}, {0xffe0, 0xffe6}, {0x16fe0, 0x16fe4},
+    {0x17000, 0x187f7}, {0x18800, 0x18cd5}, {0x1b000, 0x1b2fb}, {0x1f004, 0x1f004}, {0x1f0cf, 0x1f0cf},
+    {0x1f18e, 0x1f18e}, {0x1f191, 0x1f19a}, {0x1f200, 0x1f202}, {0x1f210, 0x1f23b}, {0x1f240, 0x1f248},
+    {0x1f250, 0x1f251}, {0x1f260, 0x1f265}, {0x1f300, 0x1f320}, {0x1f32d, 0x1f335}, {0x1f337, 0x1f37c},
+    {0x1f37e, 0x1f393}, {0x1f3a0, 0x1f3ca}, {0x1f3cf, 0x1f3d3}, {0x1f3e0, 0x1f3f0}, {0x1f3f4, 0x1f3f4},
+    {0x1f3f8, 0x1f43e}, {0x1f440, 0x1f440}, {0x1f442, 0x1f4fc}, {0x1f4ff, 0x1f53d}, {0x1f54b, 0x1f54e},
+    {0x1f550, 0x1f567}, {0x1f57a, 0x1f57a}, {0x1f595, 0x1f596}, {0x1f5a4, 0x1f5a4}, {0x1f5fb, 0x1f64f},
+    {0x1f680, 0x1f6c5}, {0x1f6cc, 0x1f6cc}, {0x1f6d0, 0x1f6d2}, {0x1f6d5, 0x1f6d7}, {0x1f6eb, 0x1f6ec},
+    {0x1f6f4, 0x1f6fc}, {0x1f7e0, 0x1f7eb}, {0x1f90c, 0x1f93a}, {0x1f93c, 0x1f945}, {0x1f947, 0x1f9ff},
+    {0x1fa70, 0x1faff}, {0x20000, 0x2fffd}, {0x30000, 0x3fffd}
+};
+
+static int inRanges(const struct codeRange* ranges, int count, int codepoint){
+    int low = 0, high = count - 1;
+    while (low <= high){
+        int mid = (low + high) / 2;
+        if (codepoint < ranges[mid].first)
+            high = mid - 1;
+        else if (codepoint > ranges[mid].last)
+            low = mid + 1;
+        else
+            return 1;
+    }
+    return 0;
+}
+
+// Columns a character takes on the terminal, a byte which is not valid UTF-8 is shown in one
+int utf8Width(int codepoint){
+    if (codepoint < 0x300)
+        return 1;
+    if (inRanges(zeroWidth, sizeof(zeroWidth) / sizeof(zeroWidth[0]), codepoint))
+        return 0;
+    if (codepoint >= 0x1100 && inRanges(doubleWidth, sizeof(doubleWidth) / sizeof(doubleWidth[0]), codepoint))
+        return 2;
+    return 1;
+}
@@ -0,0 +1,326 @@
+#include "editor.h"
+
+// Soft wrapping (ctrl+w): a line wider than the screen goes on over as many rows as it needs
+// the screen rows each line takes are kept in a Fenwick tree, so the row a line begins on
+// and the line a row belongs to are found in O(log n) whatever the size of the document
+// editing a line updates its own count, a change to the lines from 'at' (inserted, deleted or moved)
+// leaves the tree up to date until that line, the rest is added back the next time it is asked for, in O(log n) a line
+// the rows of every line are kept too and moved with the lines, as the line tables are, so adding the tree back
+// only measures the lines which are new or have changed, the others are counts already known
+//
+// the cursor still moves a line at a time, rowOffset is the line at the top of the screen, always shown from its first row
+//
+// the lines hidden in a fold take no row. Without wrapping, the rows are only the lines shown, which
+// the folds map in O(log n) of their own (see fold.c), so the functions below work in both cases
+
+int softWrap = 0;
+
+static int* tree = NULL; // tree[p] holds the rows of the lines (p - lowbit(p), p], counted from 1
+static int treeCapacity = 0;
+static int treeCount = 0; // nodes which are up to date
+static int* counts = NULL; // counts[i] holds the rows of the line i, -1 when it is to be measured again
+static int countsKnown = 0; // lines whose entry in counts is set
+static int treeCols = 0; // the width of the screen the rows were counted for
+
+#define lowbit(p) ((p) & -(p))
+
+// The rows counted are those of the document in use (see document.c)
+void wrapKeepState(){
+    keepDocumentState(&tree, sizeof(tree));
+    keepDocumentState(&treeCapacity, sizeof(treeCapacity));
+    keepDocumentState(&treeCount, sizeof(treeCount));
+    keepDocumentState(&counts, sizeof(counts));
+    keepDocumentState(&countsKnown, sizeof(countsKnown));
+    keepDocumentState(&treeCols, sizeof(treeCols));
+}
+
+// Screen rows taken by the line, at least one
+static int lineRows(int at){
+    if (foldCount && foldHides(at))
+        return 0;
+    int width = lineWidth(&toRenderToScreen[at]);
+    return width > 0 ? (width - 1) / screencols + 1 : 1;
+}
+
+// Rows of the lines before the p'th, the p first nodes must be up to date
+static int rowsBefore(int p){
+    int rows = 0;
+    for (; p > 0; p -= lowbit(p))
+        rows += tree[p];
+    return rows;
+}
+
+// Makes room for the rows of lines lines in the tree and the counts
+static void reserveTree(int lines){
+    if (lines + 1 <= treeCapacity)
+        return;
+    int capacity = treeCapacity ? treeCapacity : 1024;
+    while (capacity < lines + 1)
+        capacity *= 2;
+    int* grown = memRealloc(mem_tables, tree, sizeof(int) * capacity);
+    if (!grown)
+        failExit("Could not wrap the lines");
+    tree = grown;
+    grown = memRealloc(mem_tables, counts, sizeof(int) * capacity);
+    if (!grown)
+        failExit("Could not wrap the lines");
+    counts = grown;
+    treeCapacity = capacity;
+}
+
+// Brings the tree up to date with every line of the document
+static void extendTree(){
+    if (treeCols != screencols){
+        treeCount = countsKnown = 0;
+        treeCols = screencols;
+    }
+    if (countsKnown > openedFileLines)
+        countsKnown = openedFileLines;
+    if (treeCount >= openedFileLines){
+        treeCount = openedFileLines;
+        return;
+    }
+    reserveTree(openedFileLines);
+    for (; countsKnown < openedFileLines; countsKnown++)
+        counts[countsKnown] = -1;
+    for (int p = treeCount + 1; p <= openedFileLines; p++){ // its children come before it, already up to date
+        if (counts[p - 1] < 0)
+            counts[p - 1] = lineRows(p - 1);
+        tree[p] = counts[p - 1];
+        for (int child = 1; child < lowbit(p); child *= 2)
+            tree[p] += tree[p - child];
+    }
+    treeCount = openedFileLines;
+}
+
+// The lines from at have changed, their rows are counted again when they are asked for
+void wrapRowsFrom(int at){
+    if (at < 0)
+        at = 0;
+    if (treeCount > at)
+        treeCount = at;
+    if (countsKnown > at)
+        countsKnown = at;
+}
+
+// The lines from 'from' up to 'to' have changed (a fold hides or shows them), they are measured again
+void wrapLinesChanged(int from, int to){
+    if (from < 0)
+        from = 0;
+    if (to > countsKnown)
+        to = countsKnown;
+    for (int i = from; i < to; i++)
+        counts[i] = -1;
+    if (treeCount > from)
+        treeCount = from;
+}
+
+// The count lines from at have been replaced by 'lines' lines, the counts of the lines after them are moved
+void wrapLinesReplaced(int at, int count, int lines){
+    if (!softWrap || at < 0 || at + count > countsKnown){
+        wrapRowsFrom(at);
+        return;
+    }
+    reserveTree(countsKnown - count + lines);
+    memmove(&counts[at + lines], &counts[at + count], sizeof(int) * (countsKnown - at - count));
+    for (int i = at; i < at + lines; i++)
+        counts[i] = -1;
+    countsKnown += lines - count;
+    if (treeCount > at)
+        treeCount = at;
+}
+
+// The count lines given in increasing order have been deleted, the counts of the others are moved up once
+void wrapRowsDeleted(const int* lines, int count){
+    if (!softWrap || lines[count - 1] >= countsKnown){
+        wrapRowsFrom(lines[0]);
+        return;
+    }
+    int to = lines[0];
+    int next = 0;
+    for (int i = lines[0]; i < countsKnown; i++){
+        if (next < count && lines[next] == i)
+            next++;
+        else
+            counts[to++] = counts[i];
+    }
+    countsKnown = to;
+    if (treeCount > lines[0])
+        treeCount = lines[0];
+}
+
+// count lines have been inserted so that they are at the given lines, in increasing order
+void wrapRowsInserted(const int* lines, int count){
+    if (!softWrap || lines[count - 1] >= countsKnown + count){
+        wrapRowsFrom(lines[0]);
+        return;
+    }
+    reserveTree(countsKnown + count);
+    int next = count - 1;
+    int from = countsKnown - 1;
+    for (int i = countsKnown + count - 1; i >= lines[0]; i--){
+        if (next >= 0 && lines[next] == i){
+            counts[i] = -1;
+            next--;
+        }
+        else
+            counts[i] = counts[from--];
+    }
+    countsKnown += count;
+    if (treeCount > lines[0])
+        treeCount = lines[0];
+}
+
+// The line at has been rendered again, its rows are updated in the tree
+void wrapLineChanged(int at){
+    int p = at + 1;
+    if (!softWrap || treeCols != screencols || at >= openedFileLines)
+        return;
+    if (p > treeCount){ // measured when the tree gets to it
+        if (at < countsKnown)
+            counts[at] = -1;
+        return;
+    }
+    int rows = lineRows(at);
+    int delta = rows - counts[at];
+    counts[at] = rows;
+    if (delta == 0)
+        return;
+    for (; p <= treeCount; p += lowbit(p))
+        tree[p] += delta;
+}
+
+void wrapFree(){
+    memFree(mem_tables, tree);
+    memFree(mem_tables, counts);
+    tree = counts = NULL;
+    treeCapacity = treeCount = countsKnown = 0;
+}
+
+// The screen row, counted from the top of the document, the line begins on
+int wrapRowOf(int line){
+    if (line > openedFileLines)
+        line = openedFileLines;
+    if (!softWrap)
+        return line > 0 ? line - foldHiddenBefore(line) : 0;
+    extendTree();
+    return line > 0 ? rowsBefore(line) : 0;
+}
+
+// The line the screen row, counted from the top of the document, belongs to
+int wrapLineAt(int row){
+    if (!softWrap){
+        int line = foldLineAt(row);
+        return line < openedFileLines ? line : openedFileLines - 1;
+    }
+    extendTree();
+    int p = 0;
+    int top = 1;
+    while (top * 2 <= treeCount)
+        top *= 2;
+    for (int step = top; step > 0; step /= 2) // the most lines whose rows all come before row
+        if (p + step <= treeCount && tree[p + step] <= row){
+            p += step;
+            row -= tree[p];
+        }
+    return p < openedFileLines ? p : openedFileLines - 1;
+}
+
+// The line to show at the top of the screen so that line is about 'above' rows under it
+int wrapTop(int line, int above){
+    int row = wrapRowOf(line) - above;
+    if (row <= 0)
+        return 0;
+    int top = wrapLineAt(row);
+    if (wrapRowOf(top) < row) // begins above that row, the line after it is shown from its first row
+        top = foldNext(top);
+    return top < line ? top : line;
+}
+
+// Row of the cursor in its line and its column in that row (0 based)
+static void cursorRow(int line, int* row, int* col){
+    if (!softWrap){ // a row a line, scrolled by colOffset
+        *row = 0;
+        *col = cursorPos.x - 1;
+        return;
+    }
+    int column = cursorPos.x + colOffset - 1;
+    int rows = line < openedFileLines ? lineRows(line) : 1;
+    *row = column / screencols;
+    if (*row > rows - 1)
+        *row = rows - 1; // at the end of a line which fills its last row
+    *col = column - *row * screencols;
+    if (*col > screencols - 1)
+        *col = screencols - 1;
+}
+
+// Moves rowOffset so that the row of the cursor is on the screen, keeping the line the cursor is on
+// a fold the cursor has been put in (by a search, a jump or an undo) is opened
+void wrapScroll(){
+    if (softWrap)
+        colOffset = 0;
+    int line = cursorPos.y + rowOffset - 1;
+    if (openedFileLines == 0 || line >= openedFileLines)
+        return;
+    if (line < 0)
+        line = 0;
+    if (foldCount && foldHides(line))
+        foldOpen(line);
+    rowOffset = foldShown(rowOffset);
+    if (line < rowOffset)
+        rowOffset = line;
+    cursorPos.y = line - rowOffset + 1;
+    int row, col;
+    cursorRow(line, &row, &col);
+    int below = wrapRowOf(line) + row - wrapRowOf(rowOffset); // rows from the top of the screen to the cursor
+    if (below >= screenrows){
+        rowOffset = wrapTop(line, screenrows - 1 - row);
+        if (wrapRowOf(line) + row - wrapRowOf(rowOffset) >= screenrows) // a line taller than the screen
+            rowOffset = line;
+        cursorPos.y = line - rowOffset + 1;
+    }
+}
+
+// Where the cursor is on the screen (1 based)
+void wrapCursor(int* x, int* y){
+    int line = cursorPos.y + rowOffset - 1;
+    if (openedFileLines == 0 || line >= openedFileLines){
+        *x = cursorPos.x;
+        *y = cursorPos.y;
+        return;
+    }
+    int row, col;
+    cursorRow(line, &row, &col);
+    *x = col + 1;
+    *y = wrapRowOf(line) + row - wrapRowOf(rowOffset) + 1;
+    if (*y > screenrows) // in a line taller than the screen, below its rows which are shown
+        *y = screenrows;
+}
+
+// Moves the screen a page of rows up (-1) or down (1), the cursor goes to the line at the top
+void wrapPage(int direction){
+    if (openedFileLines == 0)
+        return;
+    int row = wrapRowOf(rowOffset) + direction * (screenrows - 1);
+    int last = wrapRowOf(openedFileLines) - 1;
+    if (row > last)
+        row = last;
+    if (row <= 0)
+        rowOffset = 0;
+    else {
+        rowOffset = wrapLineAt(row);
+        if (direction < 0 && wrapRowOf(rowOffset) < row && foldNext(rowOffset) < openedFileLines)
+            rowOffset = foldNext(rowOffset);
+    }
+    cursorPos.y = 1;
+}
+
+// Turns soft wrapping on or off
+void wrapToggle(){
+    softWrap = !softWrap;
+    colOffset = 0;
+    wrapRowsFrom(0);
+    if (!softWrap)
+        wrapFree();
+    loadStatusMessage("Soft wrap %s", softWrap ? "on" : "off");
+}